@@ -4,13 +4,39 @@
 
 #include <cassert>
 #include <cstring>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <iostream>
+#include <stdexcept>
 
 namespace engine {
+	struct BufferFlushStats {
+		VkDeviceSize bytesWritten = 0;		// copied in by writeToBuffer / writeToIndex
+		VkDeviceSize bytesFlushed = 0;		// after rounding to nonCoherentAtomSize and merging
+		uint64_t flushCalls = 0;			// vkFlushMappedMemoryRanges calls
+		uint64_t rangesFlushed = 0;
+	};
+
+	/*
+		A VkBuffer with its own sub-allocation. host visible buffers are always mapped.
+		writes through writeToBuffer / writeToIndex (or markDirty after writing through getMappedMemory) are remembered as
+		dirty ranges rounded out to nonCoherentAtomSize, flushDirty() merges overlapping and adjacent ones and flushes them all
+		in one vkFlushMappedMemoryRanges call. coherent memory is never flushed.
+		device local buffers marked with setMovable can be moved to other memory by the Defragmenter, so their VkBuffer handle
+		changes between frames: fetch it with getBuffer() when recording instead of keeping it
+	*/
 	class Buffer {
+		struct DirtyRange {
+			VkDeviceSize begin;
+			VkDeviceSize end;
+		};
+
 		Device& device;
 		void* mapped = nullptr;
 		VkBuffer buffer = VK_NULL_HANDLE;
-		VkDeviceMemory memory = VK_NULL_HANDLE;
+		Allocation memory{};	// sub-allocated, bound at memory.offset
 
 		VkDeviceSize bufferSize;
 		uint32_t instanceCount;
@@ -18,10 +44,18 @@ namespace engine {
 		VkDeviceSize alignmentSize;
 		VkBufferUsageFlags usageFlags;
 		VkMemoryPropertyFlags memoryPropertyFlags;
+		bool coherent;
+		VkDeviceSize atomSize;
+		std::vector<DirtyRange> dirtyRanges;	// unsorted, merged when flushed
+		BufferFlushStats flushStats{};
+		bool movable = false;
+		uint64_t readyTicket = 0;				// UploadBatcher ticket that fills it, it's only moved once that completed
 
-		static auto getAlignment(VkDeviceSize instanceSize, VkDeviceSize minOffsetAlignment) -> VkDeviceSize;
+		auto destroyLater(VkBuffer buffer, Allocation memory) -> void;
 
 	public:
+		static auto getAlignment(VkDeviceSize instanceSize, VkDeviceSize minOffsetAlignment) -> VkDeviceSize;
+
 		Buffer(
 			Device& device,
 			VkDeviceSize instanceSize,
@@ -49,6 +83,20 @@ namespace engine {
 		auto descriptorInfoForIndex(int index) -> VkDescriptorBufferInfo;
 		auto invalidateIndex(int index) -> VkResult;
 
+		auto markDirty(VkDeviceSize size = VK_WHOLE_SIZE, VkDeviceSize offset = 0) -> void;
+		auto flushDirty() -> VkResult;
+		auto hasDirtyRanges() const -> bool { return !this->dirtyRanges.empty(); }
+		auto getFlushStats() const -> const BufferFlushStats& { return this->flushStats; }
+		auto resetFlushStats() -> void { this->flushStats = {}; }
+
+		static auto benchmark(Device& device, uint32_t frameCount = 10000) -> void;
+
+		auto setMovable(uint64_t readyTicket = 0) -> void;	// needs VK_BUFFER_USAGE_TRANSFER_SRC_BIT and device local memory
+		auto isMovable() const -> bool { return this->movable; }
+		auto getReadyTicket() const -> uint64_t { return this->readyTicket; }
+		auto relocate(VkCommandBuffer commandBuffer, uint64_t excludeBlock) -> void;
+		auto getAllocation() const -> const Allocation& { return this->memory; }
+
 		auto getBuffer() const -> VkBuffer { return this->buffer; }
 		auto getMappedMemory() const -> void* { return this->mapped; }
 		auto getInstanceCount() const -> uint32_t { return this->instanceCount; }
@@ -82,7 +130,9 @@ namespace engine {
 		instanceSize{ instanceSize },
 		instanceCount{ instanceCount },
 		usageFlags{ usageFlags },
-		memoryPropertyFlags{ memoryPropertyFlags }
+		memoryPropertyFlags{ memoryPropertyFlags },
+		coherent{ (memoryPropertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0 },
+		atomSize{ device.properties.limits.nonCoherentAtomSize }
 	{
 		this->alignmentSize = getAlignment(instanceSize, minOffsetAlignment);
 		this->bufferSize = this->alignmentSize * instanceCount;
@@ -91,8 +141,16 @@ namespace engine {
 
 	Buffer::~Buffer() {
 		this->unmap();
-		vkDestroyBuffer(this->device.device(), this->buffer, nullptr);
-		vkFreeMemory(this->device.device(), this->memory, nullptr);
+		if (this->movable)
+			this->device.unregisterMovableBuffer(this);
+		this->destroyLater(this->buffer, this->memory);
+	}
+	// frames in flight may still read it, so it goes once they finished instead of after a vkDeviceWaitIdle
+	auto Buffer::destroyLater(VkBuffer buffer, Allocation memory) -> void {
+		this->device.deletionQueue().push([&device = this->device, buffer, memory]() mutable {
+			vkDestroyBuffer(device.device(), buffer, nullptr);
+			device.allocator().free(memory);
+		});
 	}
 
 	/**
@@ -102,22 +160,24 @@ namespace engine {
 	 * buffer range.
 	 * @param offset (Optional) Byte offset from beginning
 	 *
+	 * @note Host visible memory is mapped once by the allocator, this only points into that mapping
+	 *
 	 * @return VkResult of the buffer mapping call
 	 */
 	auto Buffer::map(VkDeviceSize size, VkDeviceSize offset) -> VkResult {
-		assert(this->buffer && this->memory && "Called map on buffer before create");
-		return vkMapMemory(this->device.device(), this->memory, offset, size, 0, &this->mapped);
+		assert(this->buffer && this->memory.valid() && "Called map on buffer before create");
+		if (!this->memory.mapped)
+			return VK_ERROR_MEMORY_MAP_FAILED;
+		this->mapped = static_cast<char*>(this->memory.mapped) + offset;
+		return VK_SUCCESS;
 	}
 	/**
 	 * Unmap a mapped memory range
 	 *
-	 * @note Does not return a result as vkUnmapMemory can't fail
+	 * @note The block stays mapped for other buffers sharing it, only this buffer's pointer is dropped
 	 */
 	auto Buffer::unmap() -> void {
-		if (this->mapped) {
-			vkUnmapMemory(this->device.device(), this->memory);
-			this->mapped = nullptr;
-		}
+		this->mapped = nullptr;
 	}
 
 	/**
@@ -139,6 +199,8 @@ namespace engine {
 			memOffset += offset;
 			memcpy(memOffset, data, size);
 		}
+		this->flushStats.bytesWritten += size == VK_WHOLE_SIZE ? this->bufferSize : size;
+		this->markDirty(size, offset);
 	}
 	/**
 	 * Flush a memory range of the buffer to make it visible to the device
@@ -152,11 +214,12 @@ namespace engine {
 	 * @return VkResult of the flush call
 	 */
 	auto Buffer::flush(VkDeviceSize size, VkDeviceSize offset) -> VkResult {
+		if (this->coherent) return VK_SUCCESS;
 		VkMappedMemoryRange mappedRange = {};
 		mappedRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-		mappedRange.memory = this->memory;
-		mappedRange.offset = offset;
-		mappedRange.size = size;
+		mappedRange.memory = this->memory.memory;
+		mappedRange.offset = this->memory.offset + offset;	// allocation offsets are multiples of nonCoherentAtomSize
+		mappedRange.size = size == VK_WHOLE_SIZE ? this->memory.size - offset : size;	// whole size would reach into other buffers in the block
 		return vkFlushMappedMemoryRanges(this->device.device(), 1, &mappedRange);
 	}
 	/**
@@ -184,9 +247,9 @@ namespace engine {
 	auto Buffer::invalidate(VkDeviceSize size, VkDeviceSize offset) -> VkResult {
 		VkMappedMemoryRange mappedRange = {};
 		mappedRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-		mappedRange.memory = this->memory;
-		mappedRange.offset = offset;
-		mappedRange.size = size;
+		mappedRange.memory = this->memory.memory;
+		mappedRange.offset = this->memory.offset + offset;	// allocation offsets are multiples of nonCoherentAtomSize
+		mappedRange.size = size == VK_WHOLE_SIZE ? this->memory.size - offset : size;	// whole size would reach into other buffers in the block
 		return vkInvalidateMappedMemoryRanges(this->device.device(), 1, &mappedRange);
 	}
 	/**
@@ -230,4 +293,164 @@ namespace engine {
 	auto Buffer::invalidateIndex(int index) -> VkResult {
 		return this->invalidate(this->alignmentSize, index * this->alignmentSize);
 	}
+
+	/**
+	 * Remember a written range of the buffer for the next flushDirty
+	 *
+	 * @note writeToBuffer and writeToIndex already do this, only needed after writing through getMappedMemory
+	 *
+	 * @param size (Optional) Size of the written range. Pass VK_WHOLE_SIZE for the rest of the buffer
+	 * @param offset (Optional) Byte offset from beginning
+	 *
+	 */
+	auto Buffer::markDirty(VkDeviceSize size, VkDeviceSize offset) -> void {
+		if (this->coherent) return;
+		VkDeviceSize end = size == VK_WHOLE_SIZE ? this->bufferSize : offset + size;
+		// rounded out to whole atoms, the allocation starts on one and is a whole number of them (or ends the memory object)
+		DirtyRange range{ offset & ~(this->atomSize - 1), std::min((end + this->atomSize - 1) & ~(this->atomSize - 1), this->memory.size) };
+		if (!this->dirtyRanges.empty()) {	// sequential writes grow the last range instead of adding one
+			DirtyRange& last = this->dirtyRanges.back();
+			if (range.begin <= last.end && range.end >= last.begin) {
+				last.begin = std::min(last.begin, range.begin);
+				last.end = std::max(last.end, range.end);
+				return;
+			}
+		}
+		this->dirtyRanges.push_back(range);
+	}
+	/**
+	 * Flush every range written since the last flushDirty, merged, in one vkFlushMappedMemoryRanges call
+	 *
+	 * @note Does nothing for coherent memory
+	 *
+	 * @return VkResult of the flush call
+	 */
+	auto Buffer::flushDirty() -> VkResult {
+		if (this->dirtyRanges.empty()) return VK_SUCCESS;
+
+		std::sort(this->dirtyRanges.begin(), this->dirtyRanges.end(), [](const DirtyRange& a, const DirtyRange& b) { return a.begin < b.begin; });
+		std::vector<VkMappedMemoryRange> mappedRanges;
+		for (const DirtyRange& range : this->dirtyRanges) {
+			if (!mappedRanges.empty()) {
+				VkMappedMemoryRange& last = mappedRanges.back();
+				if (this->memory.offset + range.begin <= last.offset + last.size) {	// overlapping or touching
+					last.size = std::max(last.size, this->memory.offset + range.end - last.offset);
+					continue;
+				}
+			}
+			VkMappedMemoryRange mappedRange = {};
+			mappedRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+			mappedRange.memory = this->memory.memory;
+			mappedRange.offset = this->memory.offset + range.begin;
+			mappedRange.size = range.end - range.begin;
+			mappedRanges.push_back(mappedRange);
+		}
+		this->dirtyRanges.clear();
+
+		for (const VkMappedMemoryRange& mappedRange : mappedRanges)
+			this->flushStats.bytesFlushed += mappedRange.size;
+		this->flushStats.flushCalls++;
+		this->flushStats.rangesFlushed += mappedRanges.size();
+		return vkFlushMappedMemoryRanges(this->device.device(), static_cast<uint32_t>(mappedRanges.size()), mappedRanges.data());
+	}
+
+	/**
+	 * Bytes copied and flushed per frame for a buffer of 256 lights (64 bytes each) where a handful change each frame,
+	 * written whole and flushed whole vs only the changed lights written and flushed through the dirty ranges
+	 *
+	 * @param frameCount (Optional) Frames to simulate
+	 *
+	 */
+	auto Buffer::benchmark(Device& device, uint32_t frameCount) -> void {
+		constexpr uint32_t lightCount = 256;
+		constexpr VkDeviceSize lightSize = 64;
+		constexpr uint32_t changedPerFrame = 8;
+
+		Buffer buffer{ device, lightSize, lightCount, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT };
+		buffer.map();
+		if (buffer.coherent) {
+			std::cout << "buffer flush benchmark: the only host visible memory is coherent, nothing is ever flushed\n";
+			return;
+		}
+		std::vector<char> lights(lightCount * lightSize, 0);
+		std::mt19937 rng{ 7 };
+
+		auto run = [&](const char* name, bool whole) {
+			buffer.resetFlushStats();
+			auto start = std::chrono::high_resolution_clock::now();
+			for (uint32_t frame = 0; frame < frameCount; frame++) {
+				for (uint32_t i = 0; i < changedPerFrame; i++) {
+					uint32_t light = rng() % lightCount;
+					lights[light * lightSize] = static_cast<char>(frame);
+					if (!whole)
+						buffer.writeToIndex(&lights[light * lightSize], light);
+				}
+				if (whole) {
+					buffer.writeToBuffer(lights.data());
+					buffer.dirtyRanges.clear();	// the old path flushed everything every frame
+					buffer.flush();
+					buffer.flushStats.bytesFlushed += buffer.bufferSize;
+					buffer.flushStats.flushCalls++;
+					buffer.flushStats.rangesFlushed++;
+				}
+				else {
+					buffer.flushDirty();
+				}
+			}
+			float ms = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - start).count();
+			const BufferFlushStats& stats = buffer.getFlushStats();
+			std::cout << name << ": " << stats.bytesWritten / frameCount << " bytes copied, " << stats.bytesFlushed / frameCount << " bytes flushed in "
+				<< static_cast<float>(stats.rangesFlushed) / stats.flushCalls << " ranges per frame, " << 1000.0f * ms / frameCount << "us per frame\n";
+		};
+		std::cout << "buffer flush benchmark, " << changedPerFrame << " of " << lightCount << " lights change per frame, atom size " << buffer.atomSize << "\n";
+		run("  whole buffer", true);
+		run("  dirty ranges", false);
+	}
+
+	/**
+	 * Let the Defragmenter move this buffer to other device memory
+	 *
+	 * @param readyTicket (Optional) UploadBatcher ticket of the copy that fills the buffer, it isn't moved before that completed
+	 *
+	 */
+	auto Buffer::setMovable(uint64_t readyTicket) -> void {
+		assert(this->memory.mapped == nullptr && "Only device local buffers can be moved");
+		assert((this->usageFlags & VK_BUFFER_USAGE_TRANSFER_SRC_BIT) && "Moving copies the buffer, it has to be a transfer source");
+		this->readyTicket = readyTicket;
+		if (!this->movable)
+			this->device.registerMovableBuffer(this);
+		this->movable = true;
+	}
+	/**
+	 * Record a copy of the whole buffer into a new buffer and allocation and switch this buffer over to it.
+	 * commands recorded after this (behind a transfer to read barrier) see the new buffer, the old one is destroyed once the frames
+	 * in flight that may still use it finished
+	 *
+	 * @param commandBuffer Graphics queue command buffer, outside a render pass
+	 * @param excludeBlock Id of the memory block the new allocation must not come from, the one being emptied
+	 *
+	 */
+	auto Buffer::relocate(VkCommandBuffer commandBuffer, uint64_t excludeBlock) -> void {
+		VkBufferCreateInfo bufferInfo{};
+		bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		bufferInfo.size = this->bufferSize;
+		bufferInfo.usage = this->usageFlags;
+		bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		VkBuffer newBuffer;
+		if (vkCreateBuffer(this->device.device(), &bufferInfo, nullptr, &newBuffer) != VK_SUCCESS)
+			throw std::runtime_error("failed to create relocated buffer!");
+
+		VkMemoryRequirements requirements;
+		vkGetBufferMemoryRequirements(this->device.device(), newBuffer, &requirements);
+		Allocation newMemory = this->device.allocator().allocate(requirements, this->memory.memoryType, false, this->memory.category, excludeBlock);
+		vkBindBufferMemory(this->device.device(), newBuffer, newMemory.memory, newMemory.offset);
+
+		VkBufferCopy copyRegion{};
+		copyRegion.size = this->bufferSize;
+		vkCmdCopyBuffer(commandBuffer, this->buffer, newBuffer, 1, &copyRegion);
+
+		this->destroyLater(this->buffer, this->memory);
+		this->buffer = newBuffer;
+		this->memory = newMemory;
+	}
 }
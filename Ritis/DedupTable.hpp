@@ -0,0 +1,144 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <type_traits>
+
+namespace engine {
+	// 64 bit hash over the raw bytes of a value, 8 bytes per step then a murmur3 style finalizer
+	inline auto hashBytes(const void* data, size_t size) -> uint64_t {
+		const unsigned char* bytes = static_cast<const unsigned char*>(data);
+		uint64_t h = 0x9e3779b97f4a7c15ull ^ (size * 0xff51afd7ed558ccdull);
+		size_t i = 0;
+		for (; i + 8 <= size; i += 8) {
+			uint64_t k;
+			std::memcpy(&k, bytes + i, 8);	// memcpy avoids unaligned reads, compilers turn it into a single load
+			k *= 0x87c37b91114253d5ull;
+			k = (k << 31) | (k >> 33);
+			h ^= k * 0x4cf5ad432745937full;
+			h = ((h << 27) | (h >> 37)) * 5 + 0x52dce729;
+		}
+		if (i < size) {						// tail (ie, the last 4 bytes of a 44 byte vertex)
+			uint64_t k = 0;
+			std::memcpy(&k, bytes + i, size - i);
+			h ^= k * 0x87c37b91114253d5ull;
+		}
+		h ^= h >> 33;
+		h *= 0xff51afd7ed558ccdull;
+		h ^= h >> 33;
+		h *= 0xc4ceb9fe1a85ec53ull;
+		h ^= h >> 33;
+		return h;
+	}
+
+	/*
+		Flat open addressing (linear probing) table used to deduplicate values while appending them to an array.
+		Slots only hold a 32 bit hash and an index into the key array, so a probe touches 8 bytes per slot
+		and no memory is allocated per unique value (unlike std::unordered_map, which allocates a node per key).
+
+		Keys are hashed and compared by their raw bytes, so T must be trivially copyable without padding.
+		Note for floats this means 0.0f and -0.0f are different keys, which only costs a duplicate vertex.
+
+		usage:
+			DedupTable<Vertex> table{ vertices, expectedCount };	// expectedCount unique values, not inserts. grows past it as needed
+			uint32_t index = table.insert(vertex); // appends to vertices if not already present
+	*/
+	template <typename T>
+	class DedupTable {
+		static_assert(std::is_trivially_copyable_v<T>, "DedupTable hashes raw bytes, T must be trivially copyable");
+
+		struct Slot {
+			uint32_t hash;
+			uint32_t index;		// EMPTY when unused
+		};
+
+		std::vector<T>& keys;
+		std::vector<Slot> slots;
+		size_t mask = 0;
+
+		static auto capacityFor(size_t count) -> size_t;
+		auto rehash(size_t capacity) -> void;
+	public:
+		static constexpr uint32_t EMPTY = ~0u;
+
+		DedupTable(std::vector<T>& keys, size_t expectedCount = 0);
+
+		DedupTable(const DedupTable&) = delete;
+		DedupTable& operator=(const DedupTable&) = delete;
+
+		auto insert(const T& key) -> uint32_t;
+		auto find(const T& key) const -> uint32_t;	// EMPTY if not present
+		auto size() const -> size_t { return this->keys.size(); }
+		auto capacity() const -> size_t { return this->slots.size(); }
+		auto memoryUsage() const -> size_t { return this->slots.size() * sizeof(Slot); }	// bytes of slots, the keys live in the caller's array
+	};
+
+	// power of two with load factor <= 0.5 for the expected count
+	template <typename T>
+	auto DedupTable<T>::capacityFor(size_t count) -> size_t {
+		size_t capacity = 16;
+		while (capacity < count * 2)
+			capacity <<= 1;
+		return capacity;
+	}
+
+	template <typename T>
+	DedupTable<T>::DedupTable(std::vector<T>& keys, size_t expectedCount) : keys{ keys } {
+		this->rehash(capacityFor(expectedCount > keys.size() ? expectedCount : keys.size()));
+		for (uint32_t i = 0; i < keys.size(); i++) {	// index anything already in the array
+			uint32_t hash = static_cast<uint32_t>(hashBytes(&keys[i], sizeof(T)));
+			size_t slot = hash & this->mask;
+			while (this->slots[slot].index != EMPTY)
+				slot = (slot + 1) & this->mask;
+			this->slots[slot] = { hash, i };
+		}
+	}
+
+	template <typename T>
+	auto DedupTable<T>::rehash(size_t capacity) -> void {
+		std::vector<Slot> old = std::move(this->slots);
+		this->slots.assign(capacity, Slot{ 0, EMPTY });
+		this->mask = capacity - 1;
+		for (const auto& entry : old) {	// stored hashes mean keys never need rehashing
+			if (entry.index == EMPTY) continue;
+			size_t slot = entry.hash & this->mask;
+			while (this->slots[slot].index != EMPTY)
+				slot = (slot + 1) & this->mask;
+			this->slots[slot] = entry;
+		}
+	}
+
+	// single probe sequence for both lookup and insert (no count() then operator[])
+	template <typename T>
+	auto DedupTable<T>::insert(const T& key) -> uint32_t {
+		if ((this->keys.size() + 1) * 4 > this->slots.size() * 3)	// keep load factor under 0.75 if the estimate was low
+			this->rehash(this->slots.size() * 2);
+
+		uint32_t hash = static_cast<uint32_t>(hashBytes(&key, sizeof(T)));
+		size_t slot = hash & this->mask;
+		while (this->slots[slot].index != EMPTY) {
+			const Slot& entry = this->slots[slot];
+			if (entry.hash == hash && std::memcmp(&this->keys[entry.index], &key, sizeof(T)) == 0)
+				return entry.index;
+			slot = (slot + 1) & this->mask;
+		}
+		uint32_t index = static_cast<uint32_t>(this->keys.size());
+		this->keys.push_back(key);
+		this->slots[slot] = { hash, index };
+		return index;
+	}
+	template <typename T>
+	auto DedupTable<T>::find(const T& key) const -> uint32_t {
+		uint32_t hash = static_cast<uint32_t>(hashBytes(&key, sizeof(T)));
+		size_t slot = hash & this->mask;
+		while (this->slots[slot].index != EMPTY) {
+			const Slot& entry = this->slots[slot];
+			if (entry.hash == hash && std::memcmp(&this->keys[entry.index], &key, sizeof(T)) == 0)
+				return entry.index;
+			slot = (slot + 1) & this->mask;
+		}
+		return EMPTY;
+	}
+}
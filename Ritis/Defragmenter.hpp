@@ -0,0 +1,196 @@
+#pragma once
+
+#include "Device.hpp"
+#include "Buffer.hpp"
+
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <chrono>
+#include <iostream>
+
+namespace engine {
+	constexpr const float DEFRAGMENT_TIME_BUDGET = 0.5f;					// ms of cpu time per frame spent moving buffers
+	constexpr const VkDeviceSize DEFRAGMENT_BYTE_BUDGET = 16ull << 20;		// bytes copied per frame at most
+	constexpr const float DEFRAGMENT_MAX_OCCUPANCY = 0.5f;					// only blocks at most this full are emptied
+	constexpr const uint32_t DEFRAGMENT_RETRY_FRAMES = 600;					// frames before blocks that could not be emptied are tried again
+
+	struct DefragmenterStats {
+		uint64_t buffersMoved = 0;
+		uint64_t bytesMoved = 0;
+		uint64_t blocksEmptied = 0;		// blocks whose memory was freed after their movable buffers moved out
+	};
+
+	/*
+		Moves movable buffers (Buffer::setMovable, the vertex and index buffers of every Model) out of sparsely used memory blocks,
+		so that after long load / unload churn the blocks can be freed and free space comes back as whole blocks.
+		update() picks the least occupied block the rest of its memory type can absorb and records copies of the buffers in it into
+		the frame's command buffer, within a cpu time and byte budget, a little more every frame.
+		the buffers switch to their new copy right away, so everything recorded afterwards draws from it, and the old copies go through
+		the device's DeletionQueue. once a block holds nothing movable anymore it empties as those are destroyed.
+		blocks that also hold something else (uniform buffers, images) are skipped for DEFRAGMENT_RETRY_FRAMES frames.
+
+		usage:
+			if (auto commandBuffer = renderer.beginFrame()) {
+				defragmenter.update(commandBuffer);	// before anything in the frame binds model buffers
+	*/
+	class Defragmenter {
+		Device& device;
+		float timeBudget;
+		VkDeviceSize byteBudget;
+		float maxOccupancy;
+		uint64_t target = 0;				// MemoryBlock::id, a freed block's address can come back for a new one, its id never does
+		std::vector<uint64_t> skipped;
+		std::vector<uint64_t> draining;		// nothing movable left, freed once the old copies are destroyed (if nothing unmovable stays)
+		uint32_t framesSinceRetry = 0;
+		DefragmenterStats stats{};
+
+		auto countReleasedBlocks() -> void;
+	public:
+		Defragmenter(
+			Device& device,
+			float timeBudget = DEFRAGMENT_TIME_BUDGET,
+			VkDeviceSize byteBudget = DEFRAGMENT_BYTE_BUDGET,
+			float maxOccupancy = DEFRAGMENT_MAX_OCCUPANCY);
+
+		Defragmenter(const Defragmenter&) = delete;
+		Defragmenter& operator=(const Defragmenter&) = delete;
+
+		auto update(VkCommandBuffer commandBuffer) -> VkDeviceSize;	// outside a render pass, returns the bytes copied
+		auto getStats() const -> const DefragmenterStats& { return this->stats; }
+
+		static auto soakTest(Device& device, uint32_t rounds = 20, uint32_t churnPerRound = 4000) -> void;
+	};
+
+	Defragmenter::Defragmenter(Device& device, float timeBudget, VkDeviceSize byteBudget, float maxOccupancy) :
+		device{ device }, timeBudget{ timeBudget }, byteBudget{ byteBudget }, maxOccupancy{ maxOccupancy }
+	{}
+
+	auto Defragmenter::update(VkCommandBuffer commandBuffer) -> VkDeviceSize {
+		auto start = std::chrono::high_resolution_clock::now();
+		this->countReleasedBlocks();
+		if (++this->framesSinceRetry >= DEFRAGMENT_RETRY_FRAMES) {
+			this->framesSinceRetry = 0;
+			this->skipped.clear();
+		}
+		if (!this->target)
+			this->target = this->device.allocator().findSparseBlock(this->maxOccupancy, this->skipped);
+		if (!this->target) return 0;
+
+		std::vector<Buffer*> candidates;
+		bool waiting = false;	// on uploads into buffers of the block
+		for (Buffer* buffer : this->device.getMovableBuffers()) {
+			const MemoryBlock* block = buffer->getAllocation().block;
+			if (!block || block->id != this->target) continue;
+			if (this->device.uploadBatcher().isComplete(buffer->getReadyTicket()))
+				candidates.push_back(buffer);
+			else
+				waiting = true;
+		}
+		if (candidates.empty()) {
+			if (!waiting) {	// nothing movable left, what remains is either on its way out or can't move
+				this->skipped.push_back(this->target);
+				if (std::find(this->draining.begin(), this->draining.end(), this->target) == this->draining.end())
+					this->draining.push_back(this->target);
+				this->target = 0;
+			}
+			return 0;
+		}
+
+		// the buffers may have been written by uploads or read by earlier frames, the copies read them
+		VkMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+		VkDeviceSize moved = 0;
+		for (Buffer* buffer : candidates) {
+			buffer->relocate(commandBuffer, this->target);
+			moved += buffer->getBufferSize();
+			this->stats.buffersMoved++;
+
+			float elapsed = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - start).count();
+			if (moved >= this->byteBudget || elapsed >= this->timeBudget) break;
+		}
+		this->stats.bytesMoved += moved;
+
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+		vkCmdPipelineBarrier(
+			commandBuffer,
+			VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			0, 1, &barrier, 0, nullptr, 0, nullptr);
+		return moved;
+	}
+	// a block only counts as emptied once the allocator actually freed it, one still holding unmovable allocations never does
+	auto Defragmenter::countReleasedBlocks() -> void {
+		std::erase_if(this->draining, [&](uint64_t id) {
+			if (this->device.allocator().hasBlock(id)) return false;
+			this->stats.blocksEmptied++;
+			return true;
+		});
+	}
+
+	// churns movable buffers of random sizes through the allocator, then defragments, and reports fragmentation after each round
+	auto Defragmenter::soakTest(Device& device, uint32_t rounds, uint32_t churnPerRound) -> void {
+		constexpr size_t maxLiveBuffers = 1024;
+		std::vector<std::unique_ptr<Buffer>> live;
+		std::mt19937 rng{ 11 };
+
+		auto report = [&](uint32_t round, const char* when) {
+			MemoryFragmentation f = device.allocator().getFragmentation();
+			std::cout << "  round " << round << " " << when << ": " << f.blocks << " blocks, " << (f.usedBytes >> 20) << "/" << (f.blockBytes >> 20)
+				<< "MB used, largest free " << (f.largestFree >> 10) << "KB, fragmentation " << 100.0f * f.fragmentation << "%\n";
+		};
+		auto collect = [&] {	// no frames are running, so nothing advances the deletion queue
+			vkDeviceWaitIdle(device.device());
+			device.deletionQueue().flush();
+		};
+
+		std::cout << "defragmenter soak test, " << rounds << " rounds of " << churnPerRound << " buffer creations / destructions\n";
+		auto start = std::chrono::high_resolution_clock::now();
+		DefragmenterStats total{};
+		for (uint32_t round = 0; round < rounds; round++) {
+			for (uint32_t i = 0; i < churnPerRound; i++) {
+				if (!live.empty() && (live.size() >= maxLiveBuffers || rng() % 2 == 0)) {
+					size_t victim = rng() % live.size();
+					std::swap(live[victim], live.back());
+					live.pop_back();
+				}
+				else {
+					VkDeviceSize size = VkDeviceSize{ 4096 } << (rng() % 8);	// 4KB to 512KB
+					live.push_back(std::make_unique<Buffer>(
+						device, size, 1,
+						VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+						VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT));
+					live.back()->setMovable();
+				}
+			}
+			collect();
+			report(round, "churned");
+
+			Defragmenter defragmenter{ device, 1000.0f, ~VkDeviceSize{ 0 } };
+			for (uint32_t pass = 0; pass < 256; pass++) {	// one block per pass at most, a pass with nothing to copy picks the next one
+				VkCommandBuffer commandBuffer = device.beginSingleTimeCommands();
+				defragmenter.update(commandBuffer);
+				device.endSingleTimeCommands(commandBuffer);
+				collect();
+				if (!device.allocator().findSparseBlock(DEFRAGMENT_MAX_OCCUPANCY, defragmenter.skipped) && !defragmenter.target) break;
+			}
+			defragmenter.countReleasedBlocks();	// the last pass' blocks were freed by collect()
+			total.buffersMoved += defragmenter.stats.buffersMoved;
+			total.bytesMoved += defragmenter.stats.bytesMoved;
+			total.blocksEmptied += defragmenter.stats.blocksEmptied;
+			report(round, "defragmented");
+		}
+		float seconds = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - start).count();
+		std::cout << "  moved " << total.buffersMoved << " buffers, " << (total.bytesMoved >> 20) << "MB, emptied " << total.blocksEmptied
+			<< " blocks in " << seconds << "s\n";
+
+		live.clear();
+		collect();
+	}
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <functional>
+#include <cstdint>
+
+namespace engine {
+	/*
+		Holds the destruction of vulkan objects back until no frame in flight can still be using them.
+		push() tags the destroy call with the current frame, advance() is called once a frame after the renderer waited for the
+		fence of the frame slot it's about to reuse, which proves every frame at least framesInFlight old has finished.
+		flush() destroys everything, only when the device is idle.
+		thread safe, destroy calls run on whichever thread calls advance() or flush()
+
+		usage:
+			device.deletionQueue().push([device = device.device(), buffer] { vkDestroyBuffer(device, buffer, nullptr); });
+	*/
+	class DeletionQueue {
+		struct Entry {
+			uint64_t frame;
+			std::function<void()> destroy;
+		};
+		std::deque<Entry> entries;		// in push order, so frames never decrease
+		uint64_t frame = 0;				// frames begun so far
+		std::mutex mutex;
+
+		auto collect(uint64_t lastFinishedFrame) -> void;
+	public:
+		DeletionQueue() = default;
+		~DeletionQueue() { this->flush(); }
+
+		DeletionQueue(const DeletionQueue&) = delete;
+		DeletionQueue& operator=(const DeletionQueue&) = delete;
+
+		auto push(std::function<void()> destroy) -> void;
+		auto advance(uint32_t framesInFlight) -> void;	// a new frame began, its slot's last FrameTimeline value has signaled
+		auto flush() -> void;
+		auto getPendingCount() -> size_t;
+	};
+
+	auto DeletionQueue::push(std::function<void()> destroy) -> void {
+		std::lock_guard<std::mutex> lock{ this->mutex };
+		this->entries.push_back({ this->frame, std::move(destroy) });
+	}
+	auto DeletionQueue::advance(uint32_t framesInFlight) -> void {
+		uint64_t frame;
+		{
+			std::lock_guard<std::mutex> lock{ this->mutex };
+			frame = ++this->frame;
+		}
+		// pushed during frame n means last recorded into frame n at the latest, and frame n's fence is the one waited for framesInFlight frames later
+		if (frame >= framesInFlight)
+			this->collect(frame - framesInFlight);
+	}
+	auto DeletionQueue::flush() -> void {
+		while (this->getPendingCount() > 0)
+			this->collect(UINT64_MAX);
+	}
+	auto DeletionQueue::getPendingCount() -> size_t {
+		std::lock_guard<std::mutex> lock{ this->mutex };
+		return this->entries.size();
+	}
+
+	auto DeletionQueue::collect(uint64_t lastFinishedFrame) -> void {
+		std::deque<Entry> finished;
+		{
+			std::lock_guard<std::mutex> lock{ this->mutex };
+			while (!this->entries.empty() && this->entries.front().frame <= lastFinishedFrame) {
+				finished.push_back(std::move(this->entries.front()));
+				this->entries.pop_front();
+			}
+		}
+		for (Entry& entry : finished)	// outside the lock, destroying may queue more (a model's buffers)
+			entry.destroy();
+	}
+}
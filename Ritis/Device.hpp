@@ -1,6 +1,11 @@
 #pragma once
 
 #include "Window.hpp"
+#include "MemoryAllocator.hpp"
+#include "StagingRing.hpp"
+#include "UploadBatcher.hpp"
+#include "DeletionQueue.hpp"
+#include "FrameTimeline.hpp"
 
 // std lib headers
 #include <string>
@@ -9,8 +14,11 @@
 #include <iostream>
 #include <set>
 #include <unordered_set>
+#include <memory>
+#include <mutex>
 
 namespace engine {
+    class Buffer;
 
     struct SwapChainSupportDetails {
         VkSurfaceCapabilitiesKHR capabilities;
@@ -21,8 +29,10 @@ namespace engine {
     struct QueueFamilyIndices {
         uint32_t graphicsFamily;
         uint32_t presentFamily;
+        uint32_t transferFamily;
         bool graphicsFamilyHasValue = false;
         bool presentFamilyHasValue = false;
+        bool transferFamilyHasValue = false;    // a family without graphics, so copies on it run alongside rendering
         bool isComplete() { return graphicsFamilyHasValue && presentFamilyHasValue; }
     };
 
@@ -34,7 +44,7 @@ namespace engine {
         const bool enableValidationLayers = true;
 #endif
 
-        Device(Window& window);
+        Device(Window* window);     // nullptr for headless: no surface or swap chain, render into an OffscreenTarget
         ~Device();
 
         // Not copyable or movable
@@ -46,11 +56,25 @@ namespace engine {
         VkCommandPool getCommandPool() { return commandPool; }
         VkDevice device() { return device_; }
         VkSurfaceKHR surface() { return surface_; }
+        bool isHeadless() { return window == nullptr; }
         VkQueue graphicsQueue() { return graphicsQueue_; }
         VkQueue presentQueue() { return presentQueue_; }
+        VkQueue transferQueue() { return transferQueue_; }  // the graphics queue when there is no dedicated transfer family
+        bool hasDedicatedTransferQueue() { return transferQueue_ != graphicsQueue_; }
+        MemoryAllocator& allocator() { return *allocator_; }
+        StagingRing& stagingRing() { return *stagingRing_; }
+        UploadBatcher& uploadBatcher() { return *uploadBatcher_; }
+        DeletionQueue& deletionQueue() { return deletionQueue_; }  // for destroying things frames in flight may still use
+        FrameTimeline& frameTimeline() { return *frameTimeline_; }  // which frames the gpu has finished, every frame submission signals it
+
+        // device local buffers the Defragmenter may move, see Buffer::setMovable
+        void registerMovableBuffer(Buffer* buffer);
+        void unregisterMovableBuffer(Buffer* buffer);
+        std::vector<Buffer*> getMovableBuffers();
 
         SwapChainSupportDetails getSwapChainSupport() { return querySwapChainSupport(physicalDevice); }
         uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
+        bool hasMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
         QueueFamilyIndices findPhysicalQueueFamilies() { return findQueueFamilies(physicalDevice); }
         VkFormat findSupportedFormat(
             const std::vector<VkFormat>& candidates, VkImageTiling tiling, VkFormatFeatureFlags features);
@@ -61,20 +85,24 @@ namespace engine {
             VkBufferUsageFlags usage,
             VkMemoryPropertyFlags properties,
             VkBuffer& buffer,
-            VkDeviceMemory& bufferMemory);
+            Allocation& bufferMemory);
         VkCommandBuffer beginSingleTimeCommands();
         void endSingleTimeCommands(VkCommandBuffer commandBuffer);
-        void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
-        void copyBufferToImage(
+        // copies are batched, wait on the returned UploadBatcher ticket before relying on the data
+        uint64_t copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size, VkDeviceSize srcOffset = 0);
+        uint64_t copyBufferToImage(
             VkBuffer buffer, VkImage image, uint32_t width, uint32_t height, uint32_t layerCount);
 
+        // preferredProperties are added to properties when some memory type has both, like LAZILY_ALLOCATED for transient attachments
         void createImageWithInfo(
             const VkImageCreateInfo& imageInfo,
             VkMemoryPropertyFlags properties,
             VkImage& image,
-            VkDeviceMemory& imageMemory);
+            Allocation& imageMemory,
+            VkMemoryPropertyFlags preferredProperties = 0);
 
         VkPhysicalDeviceProperties properties;
+        VkPhysicalDeviceFeatures enabledFeatures = {};  // optional features are only set when the device supports them
 
     private:
         void createInstance();
@@ -92,21 +120,31 @@ namespace engine {
         void populateDebugMessengerCreateInfo(VkDebugUtilsMessengerCreateInfoEXT& createInfo);
         void hasGflwRequiredInstanceExtensions();
         bool checkDeviceExtensionSupport(VkPhysicalDevice device);
+        bool isDeviceExtensionAvailable(VkPhysicalDevice device, const char* extensionName);
         SwapChainSupportDetails querySwapChainSupport(VkPhysicalDevice device);
 
         VkInstance instance;
         VkDebugUtilsMessengerEXT debugMessenger;
         VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
-        Window& window;
+        Window* window;
         VkCommandPool commandPool;
 
         VkDevice device_;
-        VkSurfaceKHR surface_;
+        VkSurfaceKHR surface_ = VK_NULL_HANDLE;
         VkQueue graphicsQueue_;
         VkQueue presentQueue_;
+        VkQueue transferQueue_;
+        bool memoryBudgetSupported = false;             // VK_EXT_memory_budget, optional
+        std::unique_ptr<MemoryAllocator> allocator_;    // every buffer and image is sub-allocated from here
+        std::unique_ptr<StagingRing> stagingRing_;      // every host to device upload is staged through here
+        std::unique_ptr<UploadBatcher> uploadBatcher_;  // and copied in batches from here
+        DeletionQueue deletionQueue_;                   // advanced by the renderer every frame
+        std::unique_ptr<FrameTimeline> frameTimeline_;  // signaled by every frame submission, outlives swap chains
+        std::unordered_set<Buffer*> movableBuffers_;
+        std::mutex movableBuffersMutex_;
 
         const std::vector<const char*> validationLayers = { "VK_LAYER_KHRONOS_validation" };
-        const std::vector<const char*> deviceExtensions = { VK_KHR_SWAPCHAIN_EXTENSION_NAME };
+        std::vector<const char*> deviceExtensions = { VK_KHR_SWAPCHAIN_EXTENSION_NAME };  // emptied when headless
     };
 
     // local callback functions
@@ -149,16 +187,36 @@ namespace engine {
     }
 
     // class member functions
-    Device::Device(Window& window) : window{ window } {
+    Device::Device(Window* window) : window{ window } {
+        if (window == nullptr) {
+            deviceExtensions.clear();   // nothing to present, so software implementations without a swap chain (lavapipe in CI) qualify too
+        }
         createInstance();               // create vulkan instance (API connection)
         setupDebugMessenger();          // setup error checking, cause vulkan won't do much. disable for release build
         createSurface();                // connect vulkan and glfw
         pickPhysicalDevice();           // graphics card select
         createLogicalDevice();          // map phys device into model
         createCommandPool();
+        allocator_ = std::make_unique<MemoryAllocator>(device_, physicalDevice, properties, memoryBudgetSupported);
+        stagingRing_ = std::make_unique<StagingRing>(device_, *allocator_);
+        QueueFamilyIndices queueFamilies = findPhysicalQueueFamilies();
+        uploadBatcher_ = std::make_unique<UploadBatcher>(
+            device_,
+            graphicsQueue_,
+            queueFamilies.graphicsFamily,
+            transferQueue_,
+            queueFamilies.transferFamilyHasValue ? queueFamilies.transferFamily : queueFamilies.graphicsFamily,
+            *stagingRing_);
+        frameTimeline_ = std::make_unique<FrameTimeline>(device_);
     }
 
     Device::~Device() {
+        vkDeviceWaitIdle(device_);
+        deletionQueue_.flush(); // still holds buffers, which need the allocator
+        frameTimeline_.reset();
+        uploadBatcher_.reset();
+        stagingRing_.reset();
+        allocator_.reset();
         vkDestroyCommandPool(device_, commandPool, nullptr);
         vkDestroyDevice(device_, nullptr);
 
@@ -181,7 +239,7 @@ namespace engine {
         appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
         appInfo.pEngineName = "No Engine";
         appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-        appInfo.apiVersion = VK_API_VERSION_1_0;
+        appInfo.apiVersion = VK_API_VERSION_1_2;    // timeline semaphores
 
         VkInstanceCreateInfo createInfo = {};
         createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
@@ -241,6 +299,9 @@ namespace engine {
 
         std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
         std::set<uint32_t> uniqueQueueFamilies = { indices.graphicsFamily, indices.presentFamily };
+        if (indices.transferFamilyHasValue) {
+            uniqueQueueFamilies.insert(indices.transferFamily);
+        }
 
         float queuePriority = 1.0f;
         for (uint32_t queueFamily : uniqueQueueFamilies) {
@@ -252,18 +313,32 @@ namespace engine {
             queueCreateInfos.push_back(queueCreateInfo);
         }
 
-        VkPhysicalDeviceFeatures deviceFeatures = {};
-        deviceFeatures.samplerAnisotropy = VK_TRUE;
+        VkPhysicalDeviceFeatures supportedFeatures;
+        vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+
+        enabledFeatures.samplerAnisotropy = VK_TRUE;
+        enabledFeatures.multiDrawIndirect = supportedFeatures.multiDrawIndirect; // meshlet draws fall back to one indirect draw per cluster without it
+
+        VkPhysicalDeviceVulkan12Features features12 = {};
+        features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+        features12.timelineSemaphore = VK_TRUE; // upload batches signal a timeline semaphore, checked in isDeviceSuitable
 
         VkDeviceCreateInfo createInfo = {};
         createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+        createInfo.pNext = &features12;
 
         createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
         createInfo.pQueueCreateInfos = queueCreateInfos.data();
 
-        createInfo.pEnabledFeatures = &deviceFeatures;
-        createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-        createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+        createInfo.pEnabledFeatures = &enabledFeatures;
+        std::vector<const char*> enabledExtensions = deviceExtensions;
+        memoryBudgetSupported = isDeviceExtensionAvailable(physicalDevice, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+        if (memoryBudgetSupported) { // lets the allocator report the real per heap budget
+            enabledExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+        }
+
+        createInfo.enabledExtensionCount = static_cast<uint32_t>(enabledExtensions.size());
+        createInfo.ppEnabledExtensionNames = enabledExtensions.data();
 
         // might not really be necessary anymore because device specific validation layers
         // have been deprecated
@@ -281,6 +356,13 @@ namespace engine {
 
         vkGetDeviceQueue(device_, indices.graphicsFamily, 0, &graphicsQueue_);
         vkGetDeviceQueue(device_, indices.presentFamily, 0, &presentQueue_);
+        if (indices.transferFamilyHasValue) {
+            vkGetDeviceQueue(device_, indices.transferFamily, 0, &transferQueue_);
+            std::cout << "dedicated transfer queue family: " << indices.transferFamily << std::endl;
+        }
+        else {
+            transferQueue_ = graphicsQueue_;
+        }
     }
 
     void Device::createCommandPool() {
@@ -289,23 +371,26 @@ namespace engine {
         VkCommandPoolCreateInfo poolInfo = {};
         poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
         poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily;
-        poolInfo.flags =
-            VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+        poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;  // single time commands only, frames record from the renderer's own pools
 
         if (vkCreateCommandPool(device_, &poolInfo, nullptr, &commandPool) != VK_SUCCESS) {
             throw std::runtime_error("failed to create command pool!");
         }
     }
 
-    void Device::createSurface() { window.createWindowSurface(instance, &surface_); }
+    void Device::createSurface() {
+        if (window != nullptr) {
+            window->createWindowSurface(instance, &surface_);
+        }
+    }
 
     bool Device::isDeviceSuitable(VkPhysicalDevice device) {
         QueueFamilyIndices indices = findQueueFamilies(device);
 
         bool extensionsSupported = checkDeviceExtensionSupport(device);
 
-        bool swapChainAdequate = false;
-        if (extensionsSupported) {
+        bool swapChainAdequate = window == nullptr;
+        if (extensionsSupported && window != nullptr) {
             SwapChainSupportDetails swapChainSupport = querySwapChainSupport(device);
             swapChainAdequate = !swapChainSupport.formats.empty() && !swapChainSupport.presentModes.empty();
         }
@@ -313,8 +398,21 @@ namespace engine {
         VkPhysicalDeviceFeatures supportedFeatures;
         vkGetPhysicalDeviceFeatures(device, &supportedFeatures);
 
+        VkPhysicalDeviceProperties deviceProperties;
+        vkGetPhysicalDeviceProperties(device, &deviceProperties);
+        bool timelineSemaphores = false;
+        if (deviceProperties.apiVersion >= VK_API_VERSION_1_2) {
+            VkPhysicalDeviceVulkan12Features features12 = {};
+            features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+            VkPhysicalDeviceFeatures2 features2 = {};
+            features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+            features2.pNext = &features12;
+            vkGetPhysicalDeviceFeatures2(device, &features2);
+            timelineSemaphores = features12.timelineSemaphore;
+        }
+
         return indices.isComplete() && extensionsSupported && swapChainAdequate &&
-            supportedFeatures.samplerAnisotropy;
+            supportedFeatures.samplerAnisotropy && timelineSemaphores;
     }
 
     void Device::populateDebugMessengerCreateInfo(
@@ -365,11 +463,13 @@ namespace engine {
     }
 
     std::vector<const char*> Device::getRequiredExtensions() {
-        uint32_t glfwExtensionCount = 0;
-        const char** glfwExtensions;
-        glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
-
-        std::vector<const char*> extensions(glfwExtensions, glfwExtensions + glfwExtensionCount);
+        std::vector<const char*> extensions;
+        if (window != nullptr) {    // headless doesn't initialize glfw at all
+            uint32_t glfwExtensionCount = 0;
+            const char** glfwExtensions;
+            glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+            extensions.assign(glfwExtensions, glfwExtensions + glfwExtensionCount);
+        }
 
         if (enableValidationLayers) {
             extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
@@ -421,6 +521,21 @@ namespace engine {
         return requiredExtensions.empty();
     }
 
+    bool Device::isDeviceExtensionAvailable(VkPhysicalDevice device, const char* extensionName) {
+        uint32_t extensionCount;
+        vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+
+        std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+        vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
+
+        for (const auto& extension : availableExtensions) {
+            if (std::strcmp(extension.extensionName, extensionName) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
     QueueFamilyIndices Device::findQueueFamilies(VkPhysicalDevice device) {
         QueueFamilyIndices indices;
 
@@ -437,7 +552,12 @@ namespace engine {
                 indices.graphicsFamilyHasValue = true;
             }
             VkBool32 presentSupport = false;
-            vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface_, &presentSupport);
+            if (window != nullptr) {
+                vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface_, &presentSupport);
+            }
+            else {
+                presentSupport = (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0; // headless never presents, the graphics family stands in
+            }
             if (queueFamily.queueCount > 0 && presentSupport) {
                 indices.presentFamily = i;
                 indices.presentFamilyHasValue = true;
@@ -449,6 +569,22 @@ namespace engine {
             i++;
         }
 
+        // transfer only (the copy engine) if there is one, otherwise any family without graphics, such as async compute
+        i = 0;
+        for (const auto& queueFamily : queueFamilies) {
+            bool transfer = queueFamily.queueCount > 0 && (queueFamily.queueFlags & VK_QUEUE_TRANSFER_BIT) &&
+                !(queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT);
+            bool transferOnly = transfer && !(queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT);
+            if (transferOnly || (transfer && !indices.transferFamilyHasValue)) {
+                indices.transferFamily = i;
+                indices.transferFamilyHasValue = true;
+            }
+            if (transferOnly) {
+                break;
+            }
+            i++;
+        }
+
         return indices;
     }
 
@@ -508,12 +644,39 @@ namespace engine {
         throw std::runtime_error("failed to find suitable memory type!");
     }
 
+    void Device::registerMovableBuffer(Buffer* buffer) {
+        std::lock_guard<std::mutex> lock{ movableBuffersMutex_ };
+        movableBuffers_.insert(buffer);
+    }
+
+    void Device::unregisterMovableBuffer(Buffer* buffer) {
+        std::lock_guard<std::mutex> lock{ movableBuffersMutex_ };
+        movableBuffers_.erase(buffer);
+    }
+
+    std::vector<Buffer*> Device::getMovableBuffers() {
+        std::lock_guard<std::mutex> lock{ movableBuffersMutex_ };
+        return std::vector<Buffer*>(movableBuffers_.begin(), movableBuffers_.end());
+    }
+
+    bool Device::hasMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) {
+        VkPhysicalDeviceMemoryProperties memProperties;
+        vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+        for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
+            if ((typeFilter & (1 << i)) &&
+                (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+                return true;
+            }
+        }
+        return false;
+    }
+
     void Device::createBuffer(
         VkDeviceSize size,
         VkBufferUsageFlags usage,
         VkMemoryPropertyFlags properties,
         VkBuffer& buffer,
-        VkDeviceMemory& bufferMemory
+        Allocation& bufferMemory
     ) {
         VkBufferCreateInfo bufferInfo{};
         bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -528,16 +691,16 @@ namespace engine {
         VkMemoryRequirements memRequirements;
         vkGetBufferMemoryRequirements(device_, buffer, &memRequirements);
 
-        VkMemoryAllocateInfo allocInfo{};
-        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-        allocInfo.allocationSize = memRequirements.size;
-        allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties); // allocate memory such that is follows properties
-
-        if (vkAllocateMemory(device_, &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate vertex buffer memory!");
-        }
+        uint32_t memoryType = findMemoryType(memRequirements.memoryTypeBits, properties); // allocate memory such that is follows properties
+        MemoryCategory category = MemoryCategory::Other; // for the allocator's usage report only
+        if (usage & VK_BUFFER_USAGE_VERTEX_BUFFER_BIT) category = MemoryCategory::Vertex;
+        else if (usage & VK_BUFFER_USAGE_INDEX_BUFFER_BIT) category = MemoryCategory::Index;
+        else if (usage & VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT) category = MemoryCategory::Uniform;
+        else if (usage & (VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT)) category = MemoryCategory::Storage;
+        else if (usage == VK_BUFFER_USAGE_TRANSFER_SRC_BIT) category = MemoryCategory::Staging;
+        bufferMemory = allocator_->allocate(memRequirements, memoryType, false, category);
 
-        vkBindBufferMemory(device_, buffer, bufferMemory, 0); // binding memory to buffer
+        vkBindBufferMemory(device_, buffer, bufferMemory.memory, bufferMemory.offset); // binding memory to buffer
     }
 
     VkCommandBuffer Device::beginSingleTimeCommands() {
@@ -566,56 +729,33 @@ namespace engine {
         submitInfo.commandBufferCount = 1;
         submitInfo.pCommandBuffers = &commandBuffer;
 
-        vkQueueSubmit(graphicsQueue_, 1, &submitInfo, VK_NULL_HANDLE);
-        vkQueueWaitIdle(graphicsQueue_); // can be avoided with memory barrier
+        VkFenceCreateInfo fenceInfo{};
+        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        VkFence fence;
+        vkCreateFence(device_, &fenceInfo, nullptr, &fence);
+
+        vkQueueSubmit(graphicsQueue_, 1, &submitInfo, fence);
+        vkWaitForFences(device_, 1, &fence, VK_TRUE, UINT64_MAX);  // only this submission, frames in flight on the queue keep going
 
+        vkDestroyFence(device_, fence, nullptr);
         vkFreeCommandBuffers(device_, commandPool, 1, &commandBuffer);
     }
 
-    void Device::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size) {
-        VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-
-        VkBufferCopy copyRegion{};
-        copyRegion.srcOffset = 0;  // Optional
-        copyRegion.dstOffset = 0;  // Optional
-        copyRegion.size = size;
-        vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
-
-        endSingleTimeCommands(commandBuffer);
+    uint64_t Device::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size, VkDeviceSize srcOffset) {
+        return uploadBatcher_->copyBuffer(srcBuffer, dstBuffer, size, srcOffset);
     }
 
-    void Device::copyBufferToImage(
+    uint64_t Device::copyBufferToImage(
         VkBuffer buffer, VkImage image, uint32_t width, uint32_t height, uint32_t layerCount) {
-        VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-
-        VkBufferImageCopy region{};
-        region.bufferOffset = 0;
-        region.bufferRowLength = 0;
-        region.bufferImageHeight = 0;
-
-        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        region.imageSubresource.mipLevel = 0;
-        region.imageSubresource.baseArrayLayer = 0;
-        region.imageSubresource.layerCount = layerCount;
-
-        region.imageOffset = { 0, 0, 0 };
-        region.imageExtent = { width, height, 1 };
-
-        vkCmdCopyBufferToImage(
-            commandBuffer,
-            buffer,
-            image,
-            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-            1,
-            &region);
-        endSingleTimeCommands(commandBuffer);
+        return uploadBatcher_->copyBufferToImage(buffer, 0, image, width, height, layerCount);
     }
 
     void Device::createImageWithInfo(
         const VkImageCreateInfo& imageInfo,
         VkMemoryPropertyFlags properties,
         VkImage& image,
-        VkDeviceMemory& imageMemory) {
+        Allocation& imageMemory,
+        VkMemoryPropertyFlags preferredProperties) {
         if (vkCreateImage(device_, &imageInfo, nullptr, &image) != VK_SUCCESS) {
             throw std::runtime_error("failed to create image!");
         }
@@ -623,16 +763,15 @@ namespace engine {
         VkMemoryRequirements memRequirements;
         vkGetImageMemoryRequirements(device_, image, &memRequirements);
 
-        VkMemoryAllocateInfo allocInfo{};
-        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-        allocInfo.allocationSize = memRequirements.size;
-        allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
-
-        if (vkAllocateMemory(device_, &allocInfo, nullptr, &imageMemory) != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate image memory!");
+        if (preferredProperties != 0 && hasMemoryType(memRequirements.memoryTypeBits, properties | preferredProperties)) {
+            properties |= preferredProperties;
         }
+        uint32_t memoryType = findMemoryType(memRequirements.memoryTypeBits, properties);
+        bool attachment = imageInfo.usage & (VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT);
+        imageMemory = allocator_->allocate(
+            memRequirements, memoryType, imageInfo.tiling == VK_IMAGE_TILING_OPTIMAL, attachment ? MemoryCategory::Attachment : MemoryCategory::Other);
 
-        if (vkBindImageMemory(device_, image, imageMemory, 0) != VK_SUCCESS) {
+        if (vkBindImageMemory(device_, image, imageMemory.memory, imageMemory.offset) != VK_SUCCESS) {
             throw std::runtime_error("failed to bind image memory!");
         }
     }
@@ -5,10 +5,16 @@
 #include "Renderer.hpp"
 #include "systems/SimpleRenderSystem.hpp"
 #include "systems/PointLightSystem.hpp"
+#include "systems/MeshletRenderSystem.hpp"
 #include "Buffer.hpp"
 #include "Camera.hpp"
 #include "KeyboardMovementController.hpp"
 #include "Descriptors.hpp"
+#include "ModelLoader.hpp"
+#include "FrameUniformAllocator.hpp"
+#include "Defragmenter.hpp"
+#include "ThreadPool.hpp"
+#include "FramePacer.hpp"
 
 #define GLM_FORCE_RADIANS					// functions expect radians, not degrees
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE			// Depth buffer values will range from 0 to 1, not -1 to 1
@@ -21,60 +27,223 @@
 #include <stdexcept>
 #include <array>
 #include <chrono>
+#include <string>
+#include <cstdlib>
+#include <fstream>
+#include <unordered_set>
+#include <algorithm>
 
 constexpr const float MAX_FRAME_TIME = 1.0f;
+constexpr const bool LOD_BENCHMARK_SCENE = false;	// fills the scene with vases at increasing depth and logs lod triangle counts every second
+constexpr const bool PACKED_VERTEX_SCENE = false;	// adds a VertexFormat::Packed smooth vase beside the full one, they should look the same
+constexpr const bool MESHLET_BENCHMARK_SCENE = false;	// adds a large subdivided smooth vase drawn through meshlet culling and logs rejected triangles every second
+constexpr const bool DEDUP_BENCHMARK = false;		// times vertex deduplication through DedupTable and std::unordered_map at startup
+constexpr const bool PARALLEL_IMPORT_CHECK = false;	// imports an obj serially and in parallel at startup, throws unless the results are byte identical
+constexpr const bool ALLOCATOR_BENCHMARK = false;	// creates and frees 100k buffers through the gpu memory allocator at startup and logs the timing
+constexpr const bool STAGING_BENCHMARK = false;		// streams small and large uploads through the staging ring at startup and logs MB/s
+constexpr const bool FLUSH_BENCHMARK = false;		// compares bytes copied and flushed per frame for whole buffer vs dirty range flushes at startup
+constexpr const bool DEFRAGMENT_SOAK_TEST = false;	// churns buffers through the allocator and defragmenter at startup and logs fragmentation per round
+constexpr const bool PARALLEL_RECORDING = false;	// records the game objects into secondary command buffers across threads, worth it with thousands of objects
+constexpr const bool RECORDING_BENCHMARK = false;	// times recording 10k to 100k objects with 1 up to every core at startup
+constexpr const bool LATENCY_LOG = false;			// logs the average and worst input to gpu done latency every second
+constexpr const float MEMORY_LOG_INTERVAL = 10.0f;		// seconds between gpu memory usage lines, 0 to never log them
+constexpr const float MEMORY_BUDGET_WARNING = 0.9f;		// warn once a memory heap passes this fraction of its budget
+constexpr const uint32_t HEADLESS_FRAMES = 1000;			// frames a headless run renders when --frames isn't given
+constexpr const float HEADLESS_FRAME_TIME = 1.0f / 60.0f;	// fixed time step of headless runs, so frame n shows the same scene every run
+constexpr const int COMPARE_TOLERANCE = 2;					// per channel difference --compare still counts as the same pixel
 
 namespace engine {
+	/*
+		Settings picked at launch, from the command line:
+			--frames-in-flight <n>	1 for the least latency, up to SwapChain::MAX_FRAMES_IN_FLIGHT for the most throughput
+			--low-latency			FramePacing::LowLatency
+			--headless				no window, frames are rendered into an OffscreenTarget
+			--frames <n>			stop after n frames, headless runs default to HEADLESS_FRAMES
+			--output <file.ppm>		save the last frame of a headless run
+			--compare <file.ppm>	compare the saved frame against an earlier --output, and log how many pixels differ
+			--packed				load the scene's models with VertexFormat::Packed
+
+		packed vertices should render the same as full ones:
+			app --headless --frames 300 --output full.ppm
+			app --headless --frames 300 --packed --output packed.ppm --compare full.ppm
+		both runs also log the scene's vertex and index buffer sizes when they end
+	*/
+	struct AppConfig {
+		uint32_t framesInFlight = SwapChain::DEFAULT_FRAMES_IN_FLIGHT;
+		FramePacing pacing = FramePacing::Throughput;
+		bool headless = false;
+		uint32_t frameCount = 0;	// 0 runs until the window closes
+		std::string output;
+		std::string compare;
+		VertexFormat vertexFormat = VertexFormat::Full;
+
+		static auto fromArgs(int argc, char** argv) -> AppConfig;
+	};
+
+	auto AppConfig::fromArgs(int argc, char** argv) -> AppConfig {
+		AppConfig config{};
+		for (int i = 1; i < argc; i++) {
+			std::string arg = argv[i];
+			if (arg == "--frames-in-flight" && i + 1 < argc) {
+				int frames = std::atoi(argv[++i]);
+				if (frames < 1 || frames > SwapChain::MAX_FRAMES_IN_FLIGHT)
+					throw std::runtime_error("--frames-in-flight must be between 1 and " + std::to_string(SwapChain::MAX_FRAMES_IN_FLIGHT));
+				config.framesInFlight = static_cast<uint32_t>(frames);
+			}
+			else if (arg == "--low-latency")
+				config.pacing = FramePacing::LowLatency;
+			else if (arg == "--headless")
+				config.headless = true;
+			else if (arg == "--frames" && i + 1 < argc) {
+				int frames = std::atoi(argv[++i]);
+				if (frames < 1)
+					throw std::runtime_error("--frames must be at least 1");
+				config.frameCount = static_cast<uint32_t>(frames);
+			}
+			else if (arg == "--output" && i + 1 < argc)
+				config.output = argv[++i];
+			else if (arg == "--compare" && i + 1 < argc)
+				config.compare = argv[++i];
+			else if (arg == "--packed")
+				config.vertexFormat = VertexFormat::Packed;
+			else
+				throw std::runtime_error("unknown argument " + arg);
+		}
+		if (config.headless && config.frameCount == 0)
+			config.frameCount = HEADLESS_FRAMES;	// nothing else ends a headless run
+		if (!config.output.empty() && !config.headless)
+			throw std::runtime_error("--output needs --headless");
+		if (!config.compare.empty() && config.output.empty())
+			throw std::runtime_error("--compare needs --output");
+		return config;
+	}
+
 	class FirstApp {
-		Window window{ WIDTH, HEIGHT, "Vulkan Learning" };
-		Device device{ window };
-		Renderer renderer{ window, device };
+		AppConfig config;
+		std::unique_ptr<Window> window{ config.headless ? nullptr : std::make_unique<Window>(WIDTH, HEIGHT, "Vulkan Learning") };
+		Device device{ this->window.get() };
+		Renderer renderer{ this->window.get(), device, config.framesInFlight, { WIDTH, HEIGHT } };
+		ModelRegistry modelRegistry{};		// shares models loaded from the same file, see ModelRegistry.hpp
+		ModelLoader modelLoader{ device, &modelRegistry };	// destroyed before device, waits for imports and uploads still in flight
+		Defragmenter defragmenter{ device };				// moves model buffers out of sparse memory blocks a bit every frame
 
 		// order of declarations matters
 		std::unique_ptr<DescriptorPool> globalPool{}; // pool needs to be destroyed before devices
 		GameObject::Map gameObjects;
+		std::unique_ptr<ThreadPool> recordingPool{};	// only with PARALLEL_RECORDING or RECORDING_BENCHMARK
 
 		auto loadGameObjects() -> void;
 	public:
 		static constexpr int WIDTH = 800;
 		static constexpr int HEIGHT = 600;
 		
-		FirstApp();
+		FirstApp(const AppConfig& config = {});
 		~FirstApp();
 
 		FirstApp(const FirstApp&) = delete;
 		FirstApp& operator=(const FirstApp&) = delete;
 
 		auto run() -> void;
+		auto saveFrame(const std::string& path) -> void;	// binary ppm of the offscreen target's last frame
+		auto logModelMemory() const -> void;				// vertex and index bytes of every model in the scene
+		static auto compareFrames(const std::string& path, const std::string& referencePath) -> void;
 	};
 
-	FirstApp::FirstApp() {
+	FirstApp::FirstApp(const AppConfig& config) : config{ config } {
+		std::cout << "Frames in flight: " << this->config.framesInFlight
+			<< ", pacing: " << (this->config.pacing == FramePacing::LowLatency ? "low latency" : "throughput")
+			<< (this->config.headless ? ", headless" : "") << "\n";
 		this->globalPool = DescriptorPool::Builder(this->device)
-			.setMaxSets(SwapChain::MAX_FRAMES_IN_FLIGHT)
-			.addPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, SwapChain::MAX_FRAMES_IN_FLIGHT)
+			.setMaxSets(1)
+			.addPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1)
 			.build();
 		this->loadGameObjects();
+
+		ModelRegistryStats registryStats = this->modelRegistry.getStats();
+		std::cout << "Model registry: " << registryStats.hits << " hits, " << registryStats.misses << " misses\n";
+
+		if (DEDUP_BENCHMARK)
+			Model::Builder::benchmarkDedup("models/smooth_vase.obj");
+		if (PARALLEL_IMPORT_CHECK)
+			Model::Builder::checkParallelImport("models/smooth_vase.obj");
+		if (ALLOCATOR_BENCHMARK)
+			this->device.allocator().benchmark(100000);
+		if (STAGING_BENCHMARK)
+			StagingRing::benchmark(this->device.device(), this->device.allocator(), this->device.graphicsQueue(), this->device.findPhysicalQueueFamilies().graphicsFamily);
+		if (FLUSH_BENCHMARK)
+			Buffer::benchmark(this->device);
+		if (DEFRAGMENT_SOAK_TEST)
+			Defragmenter::soakTest(this->device);
+		if (PARALLEL_RECORDING || RECORDING_BENCHMARK)
+			this->recordingPool = std::make_unique<ThreadPool>(std::max(1u, std::thread::hardware_concurrency()) - 1);	// the recording thread is the last one
+		this->device.allocator().printStats();
+		this->device.allocator().setBudgetWarningFraction(MEMORY_BUDGET_WARNING);
+		this->device.allocator().logUsage();
 	}
 	FirstApp::~FirstApp() {}
 
 	auto FirstApp::loadGameObjects() -> void {
-		std::shared_ptr<Model> flatModel = Model::createModelFromFile(device, "models/flat_vase.obj");
+		ModelImportOptions importOptions{};
+		importOptions.vertexFormat = this->config.vertexFormat;
+		importOptions.optimize = true;	// vertex cache/overdraw reordering, prints ACMR/ATVR before and after on first import
+
+		// vases stream in on the loader's threads and appear once uploaded, the frame loop starts right away
+		ModelHandle flatModel = this->modelLoader.load("models/flat_vase.obj", importOptions);
 		auto gameObj1 = GameObject::createGameObject();
-		gameObj1.model = flatModel;
+		this->modelLoader.bindWhenReady(gameObj1.getId(), flatModel);
 		gameObj1.transform.translation = { -0.5f, 0.5f, 0.0f };
 		gameObj1.transform.scale = glm::vec3{ 3.0f, 1.5f, 3.0f };
 
 		this->gameObjects.emplace(gameObj1.getId(), std::move(gameObj1));
 
-		std::shared_ptr<Model> smoothModel = Model::createModelFromFile(device, "models/smooth_vase.obj");
+		ModelImportOptions smoothImportOptions = importOptions;
+		smoothImportOptions.lodLevels = 4;	// flat_vase has no lods, its per face normals make every vertex a seam the simplifier has to keep
+		ModelHandle smoothModel = this->modelLoader.load("models/smooth_vase.obj", smoothImportOptions);
 		auto gameObj2 = GameObject::createGameObject();
-		gameObj2.model = smoothModel;
+		this->modelLoader.bindWhenReady(gameObj2.getId(), smoothModel);
 		gameObj2.transform.translation = { 0.5f, 0.5f, 0.0f };
 		gameObj2.transform.scale = glm::vec3{ 3.0f, 1.5f, 3.0f };
 
 		this->gameObjects.emplace(gameObj2.getId(), std::move(gameObj2));
 
-		std::shared_ptr<Model> floorModel = Model::createModelFromFile(device, "models/quad.obj");
+		if (PACKED_VERTEX_SCENE) {
+			ModelImportOptions packedImportOptions = smoothImportOptions;
+			packedImportOptions.vertexFormat = VertexFormat::Packed;	// separate registry entry, same mesh cache
+			auto packedVase = GameObject::createGameObject();
+			this->modelLoader.bindWhenReady(packedVase.getId(), this->modelLoader.load("models/smooth_vase.obj", packedImportOptions));
+			packedVase.transform.translation = { 1.5f, 0.5f, 0.0f };
+			packedVase.transform.scale = glm::vec3{ 3.0f, 1.5f, 3.0f };
+			this->gameObjects.emplace(packedVase.getId(), std::move(packedVase));
+		}
+
+		if (MESHLET_BENCHMARK_SCENE) {
+			Model::Builder denseBuilder{};
+			denseBuilder.loadModel("models/smooth_vase.obj");
+			denseBuilder.subdivide(3);		// 64x the triangles of smooth_vase, same shape
+			denseBuilder.optimize();		// cache friendly order makes spatially tight meshlets
+			denseBuilder.buildMeshlets();
+			auto denseVase = GameObject::createGameObject();
+			denseVase.model = std::make_shared<Model>(device, denseBuilder);
+			denseVase.transform.translation = { 0.0f, 0.5f, 4.0f };
+			denseVase.transform.scale = glm::vec3{ 12.0f, 6.0f, 12.0f };
+			this->gameObjects.emplace(denseVase.getId(), std::move(denseVase));
+		}
+
+		if (LOD_BENCHMARK_SCENE) {
+			for (int row = 0; row < 40; row++) {		// rows from right in front of the camera out to the far plane
+				for (int column = -10; column <= 10; column++) {
+					auto vase = GameObject::createGameObject();
+					this->modelLoader.bindWhenReady(vase.getId(), this->modelLoader.load("models/smooth_vase.obj", smoothImportOptions));	// registry hit after the first
+					vase.transform.translation = { column * 1.0f, 0.5f, 1.0f + row * 2.0f };
+					vase.transform.scale = glm::vec3{ 3.0f, 1.5f, 3.0f };
+					this->gameObjects.emplace(vase.getId(), std::move(vase));
+				}
+			}
+		}
+
+		ModelImportOptions floorImportOptions{};
+		floorImportOptions.vertexFormat = this->config.vertexFormat;
+		std::shared_ptr<Model> floorModel = Model::createModelFromFile(device, "models/quad.obj", floorImportOptions);
 		auto floor = GameObject::createGameObject();
 		floor.model = floorModel;
 		floor.transform.translation = { 0.0f, 0.5f, 0.0f };
@@ -105,35 +274,30 @@ namespace engine {
 		}
 	}
 	auto FirstApp::run() -> void {
-		std::vector<std::unique_ptr<Buffer>> uboBuffers(SwapChain::MAX_FRAMES_IN_FLIGHT);
-		for (int i = 0; i < uboBuffers.size(); i++) {
-			uboBuffers[i] = std::make_unique<Buffer>(
-				this->device,
-				sizeof(GlobalUniformBufferObject),
-				1, // write to frame's instance without dealing with sync issues (say frame 1 is rendering, can still store UBO for frame 2)
-				VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT // no coherent bit, opt to use flush instead, even though 1 buffer per swapchain frame
-			);
-			uboBuffers[i]->map();
-		}
+		// every frame's GlobalUniformBufferObject (and anything else systems push) lives in one mapped buffer, a region per frame in flight
+		FrameUniformAllocator frameUniforms{ this->device, FRAME_UNIFORM_CAPACITY, this->renderer.getFramesInFlight() };
 
 		auto globalSetLayout = DescriptorSetLayout::Builder(this->device)
-			.addBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_ALL_GRAPHICS)
-			.build(); // VK_SHADER_STAGE_ALL_GRAPHICS = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT
-
-		std::vector<VkDescriptorSet> globalDescriptorSets(SwapChain::MAX_FRAMES_IN_FLIGHT);
-		for (int i = 0; i < globalDescriptorSets.size(); i++) {
-			auto bufferInfo = uboBuffers[i]->descriptorInfo();
-			DescriptorWriter(*globalSetLayout, *globalPool)
-				.writeBuffer(0, &bufferInfo)
-				.build(globalDescriptorSets[i]);
-		}
+			.addBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_ALL_GRAPHICS | VK_SHADER_STAGE_COMPUTE_BIT)
+			.build(); // VK_SHADER_STAGE_ALL_GRAPHICS = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, compute for meshlet culling
+
+		VkDescriptorSet globalDescriptorSet;	// one set for all frames, the dynamic offset picks the frame's ubo
+		auto bufferInfo = frameUniforms.descriptorInfo(sizeof(GlobalUniformBufferObject));
+		DescriptorWriter(*globalSetLayout, *globalPool)
+			.writeBuffer(0, &bufferInfo)
+			.build(globalDescriptorSet);
 
 		SimpleRenderSystem simpleRenderSystem{
 			this->device,
 			this->renderer.getSwapChainRenderPass(),
 			globalSetLayout->getDescriptorSetLayout()
 		};
+		MeshletRenderSystem meshletRenderSystem{
+			this->device,
+			this->renderer.getSwapChainRenderPass(),
+			globalSetLayout->getDescriptorSetLayout(),
+			this->renderer.getFramesInFlight()
+		};
 		PointLightSystem pointLightSystem{
 			this->device,
 			this->renderer.getSwapChainRenderPass(),
@@ -143,27 +307,60 @@ namespace engine {
 		Camera camera{};
 		camera.setViewTarget(glm::vec3(-1.0f, -2.0f, 2.0f), glm::vec3(0.0f, 0.0f, 2.5f));
 
+		if (RECORDING_BENCHMARK) {
+			camera.setPerspectiveProjection(glm::radians(50.0f), this->renderer.getAspectRatio(), 0.1f, 100.0f);
+			GameObject::Map noObjects;
+			FrameInfo benchmarkInfo{ 0, 0.0f, VK_NULL_HANDLE, camera, globalDescriptorSet, noObjects, frameUniforms };
+			simpleRenderSystem.benchmarkRecording(benchmarkInfo, *this->recordingPool, { WIDTH, HEIGHT });
+		}
+
 		auto viewerObject = GameObject::createGameObject(); // store camera state
 		viewerObject.transform.translation.z = -2.5f;
 		KeyboardMovementController cameraController{};
 
+		FramePacer pacer{ this->device, this->renderer, this->config.pacing };
 		auto currentTime = std::chrono::high_resolution_clock::now();
 
 		uint32_t frameCount = 0;
-		while (!this->window.shouldClose()) {
-			glfwPollEvents();
+		float statsTimer = 0.0f;
+		float memoryLogTimer = 0.0f;
+		uint32_t framesRendered = 0;
+		while (this->window ? !this->window->shouldClose() : framesRendered < this->config.frameCount) {
+			pacer.beginFrame();	// with FramePacing::LowLatency this waits for the gpu before input is read
+			if (this->window)
+				glfwPollEvents();
 
 			auto newTime = std::chrono::high_resolution_clock::now();
 			float frameTime = std::chrono::duration<float, std::chrono::seconds::period>(newTime - currentTime).count();
 			currentTime = newTime;
 
 			frameTime = glm::min(frameTime, MAX_FRAME_TIME); // avoid really large skips if frames aren't coming in
+			if (!this->window)
+				frameTime = HEADLESS_FRAME_TIME;
+			bool logStats = (statsTimer += frameTime) >= 1.0f;	// benchmark scenes print once a second
+			if (logStats) statsTimer = 0.0f;
+			if (logStats)
+				this->device.allocator().checkBudget();
+			if (LATENCY_LOG && logStats) {
+				LatencyStats latency = pacer.takeStats();
+				std::cout << "Latency (" << this->renderer.getFramesInFlight() << " in flight, "
+					<< (pacer.getPacing() == FramePacing::LowLatency ? "low latency" : "throughput") << "): " << latency.frames << " frames, "
+					<< latency.averageMs << "ms average, " << latency.maxMs << "ms worst\n";
+			}
+			if (MEMORY_LOG_INTERVAL > 0.0f && (memoryLogTimer += frameTime) >= MEMORY_LOG_INTERVAL) {
+				memoryLogTimer = 0.0f;
+				this->device.allocator().logUsage();
+			}
 
-			cameraController.moveInPlaneXZ(this->window.getGFLWWindow(), frameTime, viewerObject);
+			if (this->window)
+				cameraController.moveInPlaneXZ(this->window->getGFLWWindow(), frameTime, viewerObject);
 			camera.setViewYXZ(viewerObject.transform.translation, viewerObject.transform.rotation);
 
 			float aspect = this->renderer.getAspectRatio();
-			camera.setPerspectiveProjection(glm::radians(50.0f), aspect, 0.1f, 10);
+			camera.setPerspectiveProjection(glm::radians(50.0f), aspect, 0.1f, LOD_BENCHMARK_SCENE || MESHLET_BENCHMARK_SCENE ? 100.0f : 10.0f);
+
+			this->modelLoader.update(this->gameObjects);	// swaps in models whose upload finished, submits the next batch
+			this->device.uploadBatcher().submit();			// any other copies recorded since last frame, ahead of the frame that uses them
 
 			if (auto commandBuffer = this->renderer.beginFrame()) {
 				int frameIndex = renderer.getFrameIndex();
@@ -172,28 +369,134 @@ namespace engine {
 					frameTime,
 					commandBuffer,
 					camera,
-					globalDescriptorSets[frameIndex],
-					gameObjects
+					globalDescriptorSet,
+					gameObjects,
+					frameUniforms
 				};
+				frameUniforms.beginFrame(frameIndex);	// beginFrame waited for this frame's previous use of its region
+				this->defragmenter.update(commandBuffer);	// first, everything after binds the moved buffers
 				// update
 				GlobalUniformBufferObject ubo{};
 				ubo.projection = camera.getProjection();
 				ubo.view = camera.getView();
 				ubo.inverseView = camera.getInverseView();
 				pointLightSystem.update(frameInfo, ubo);
-				uboBuffers[frameIndex]->writeToBuffer(&ubo);
-				uboBuffers[frameIndex]->flush();
+				frameInfo.globalUniformOffset = frameUniforms.push(ubo);
+				meshletRenderSystem.cull(frameInfo); // compute, has to be recorded outside the render pass
 
 				// render
-				this->renderer.beginSwapChainRenderPass(commandBuffer);
-				// order matters here (for transparency)
-				simpleRenderSystem.renderGameObjects(frameInfo); // solids first
-
-				pointLightSystem.render(frameInfo);
+				if (PARALLEL_RECORDING) {
+					this->renderer.beginSwapChainRenderPass(commandBuffer, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+					SecondaryRecording recording = this->renderer.getSecondaryRecording();
+					std::vector<VkCommandBuffer> secondaries = simpleRenderSystem.renderGameObjectsParallel(frameInfo, recording, *this->recordingPool); // solids first
+					frameInfo.commandBuffer = recording.begin(0);	// the rest on this thread, the subpass can't mix inline commands and secondaries
+					meshletRenderSystem.render(frameInfo);
+					pointLightSystem.render(frameInfo);
+					if (vkEndCommandBuffer(frameInfo.commandBuffer) != VK_SUCCESS)
+						throw std::runtime_error("failed to record secondary command buffer!");
+					secondaries.push_back(frameInfo.commandBuffer);
+					frameInfo.commandBuffer = commandBuffer;
+					vkCmdExecuteCommands(commandBuffer, static_cast<uint32_t>(secondaries.size()), secondaries.data());
+				}
+				else {
+					this->renderer.beginSwapChainRenderPass(commandBuffer);
+					// order matters here (for transparency)
+					simpleRenderSystem.renderGameObjects(frameInfo); // solids first
+					meshletRenderSystem.render(frameInfo);
+					pointLightSystem.render(frameInfo);
+				}
+				if (MESHLET_BENCHMARK_SCENE && logStats) {
+					const auto& stats = meshletRenderSystem.getStats();
+					uint32_t triangles = stats.trianglesVisible + stats.trianglesCulled;
+					std::cout << "Meshlets: " << stats.meshletsVisible << " drawn, " << stats.meshletsFrustumCulled << " frustum culled, "
+						<< stats.meshletsBackfaceCulled << " back-face culled. " << stats.trianglesCulled << " / " << triangles
+						<< " triangles rejected (" << 100.0 * stats.trianglesCulled / std::max<double>(1.0, triangles) << "%)\n";
+				}
+				if (LOD_BENCHMARK_SCENE && logStats) {
+					const auto& stats = simpleRenderSystem.getStats();
+					std::cout << "LOD: " << stats.objectsDrawn << " objects, " << stats.trianglesDrawn << " / " << stats.fullDetailTriangles
+						<< " triangles (" << 100.0 * stats.trianglesDrawn / std::max<double>(1.0, static_cast<double>(stats.fullDetailTriangles)) << "%)\n";
+				}
 				this->renderer.endSwapChainRenderPass(commandBuffer);
+				frameUniforms.flush();
 				this->renderer.endFrame();
+				framesRendered++;
 			}
+			pacer.endFrame();
+			if (this->config.frameCount > 0 && framesRendered >= this->config.frameCount)
+				break;
 		}
+		if (!this->config.output.empty()) {
+			if (framesRendered > 0) {
+				this->saveFrame(this->config.output);
+				if (!this->config.compare.empty())
+					compareFrames(this->config.output, this->config.compare);
+			}
+			else
+				std::cout << "No frame was rendered, not saving " << this->config.output << "\n";
+		}
+		if (this->config.headless)
+			this->logModelMemory();
 		vkDeviceWaitIdle(this->device.device());
 	}
+
+	auto FirstApp::saveFrame(const std::string& path) -> void {
+		OffscreenTarget* target = this->renderer.getOffscreenTarget();
+		VkExtent2D extent = target->getExtent();
+		std::vector<uint8_t> pixels = target->readPixels();
+
+		std::ofstream file{ path, std::ios::binary };
+		if (!file)
+			throw std::runtime_error("failed to open " + path);
+		file << "P6\n" << extent.width << " " << extent.height << "\n255\n";
+		for (size_t i = 0; i < pixels.size(); i += 4)
+			file.write(reinterpret_cast<const char*>(&pixels[i]), 3);	// rgba to rgb, the srgb bytes are what ppm expects
+		std::cout << "Saved frame " << extent.width << "x" << extent.height << " to " << path << "\n";
+	}
+	auto FirstApp::logModelMemory() const -> void {
+		std::unordered_set<const Model*> counted;	// registry hits share one model between objects
+		VkDeviceSize vertexBytes = 0, indexBytes = 0, wideIndexBytes = 0;
+		for (const auto& [id, obj] : this->gameObjects) {
+			if (!obj.model || !counted.insert(obj.model.get()).second) continue;
+			vertexBytes += obj.model->getVertexBufferSize();
+			indexBytes += obj.model->getIndexBufferSize();
+			wideIndexBytes += VkDeviceSize{ obj.model->getIndexCount() } * sizeof(uint32_t);
+		}
+		std::cout << "Model memory (" << (this->config.vertexFormat == VertexFormat::Packed ? "packed" : "full") << " vertices): "
+			<< counted.size() << " models, " << (vertexBytes >> 10) << "KB vertices, " << (indexBytes >> 10) << "KB indices ("
+			<< (wideIndexBytes >> 10) << "KB as 32 bit indices)\n";
+	}
+	// both binary ppm as saveFrame writes them
+	auto FirstApp::compareFrames(const std::string& path, const std::string& referencePath) -> void {
+		auto readPpm = [](const std::string& file, uint32_t& width, uint32_t& height) {
+			std::ifstream in{ file, std::ios::binary };
+			std::string magic;
+			uint32_t maxValue = 0;
+			if (!(in >> magic >> width >> height >> maxValue) || magic != "P6" || maxValue != 255)
+				throw std::runtime_error("failed to read " + file + ", not a binary 8 bit ppm!");
+			in.get();	// the single whitespace before the pixels
+			std::vector<uint8_t> pixels(size_t{ width } * height * 3);
+			if (!in.read(reinterpret_cast<char*>(pixels.data()), pixels.size()))
+				throw std::runtime_error("failed to read the pixels of " + file + "!");
+			return pixels;
+		};
+		uint32_t width, height, referenceWidth, referenceHeight;
+		std::vector<uint8_t> pixels = readPpm(path, width, height);
+		std::vector<uint8_t> reference = readPpm(referencePath, referenceWidth, referenceHeight);
+		if (width != referenceWidth || height != referenceHeight)
+			throw std::runtime_error("can't compare " + path + " with " + referencePath + ", the sizes differ");
+
+		size_t differing = 0;
+		int maxDifference = 0;
+		for (size_t i = 0; i < pixels.size(); i += 3) {
+			int difference = 0;
+			for (size_t c = 0; c < 3; c++)
+				difference = std::max(difference, std::abs(int{ pixels[i + c] } - int{ reference[i + c] }));
+			differing += difference > COMPARE_TOLERANCE;
+			maxDifference = std::max(maxDifference, difference);
+		}
+		std::cout << "Compared " << path << " with " << referencePath << ": " << differing << " of " << pixels.size() / 3
+			<< " pixels differ by more than " << COMPARE_TOLERANCE << ", largest channel difference " << maxDifference
+			<< (differing == 0 ? ", same image\n" : "\n");
+	}
 }
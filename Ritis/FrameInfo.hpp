@@ -2,6 +2,7 @@
 
 #include "Camera.hpp"
 #include "GameObject.hpp"
+#include "FrameUniformAllocator.hpp"
 
 #include <vulkan/vulkan.h>
 
@@ -29,5 +30,7 @@ namespace engine {
 		Camera& camera;
 		VkDescriptorSet globalDescriptorSet;
 		GameObject::Map& gameObjects;
+		FrameUniformAllocator& uniforms;	// for any other per frame constants a system wants
+		uint32_t globalUniformOffset = 0;	// dynamic offset of this frame's GlobalUniformBufferObject, pass it when binding globalDescriptorSet
 	};
 }
@@ -0,0 +1,145 @@
+#pragma once
+
+#include "Device.hpp"
+#include "Renderer.hpp"
+
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+#include <exception>
+#include <utility>
+
+namespace engine {
+	enum class FramePacing {
+		Throughput,		// input is sampled, then the cpu blocks in beginFrame when it's framesInFlight frames ahead of the gpu
+		LowLatency,		// the cpu blocks first and samples input once the frame slot is free, so the input is that much fresher
+	};
+
+	struct LatencyStats {
+		uint32_t frames = 0;
+		float averageMs = 0.0f;
+		float maxMs = 0.0f;
+	};
+
+	/*
+		Decides when the cpu starts a frame and measures how old the frame's input is when the gpu has finished rendering it.
+		that's input to photon minus presentation and scanout, which vulkan can't see without display timing extensions.
+		completion is timed by a thread waiting on the device's FrameTimeline, which every frame submission signals.
+		if that wait fails (a lost device), the thread stops and beginFrame rethrows the error on the frame thread.
+
+		usage:
+			pacer.beginFrame();		// before glfwPollEvents
+			...
+			pacer.endFrame();		// after renderer.endFrame
+			LatencyStats latency = pacer.takeStats();
+	*/
+	class FramePacer {
+		using Clock = std::chrono::steady_clock;
+		struct PendingFrame {
+			uint64_t value;				// FrameTimeline value its submission signals
+			Clock::time_point input;
+		};
+
+		Device& device;
+		Renderer& renderer;
+		FramePacing pacing;
+		Clock::time_point input;
+		uint64_t lastSubmitted;
+
+		std::deque<PendingFrame> pending;
+		LatencyStats stats{};
+		double latencySum = 0.0;
+		bool stopping = false;
+		std::exception_ptr error;	// from the waiter thread, rethrown by the next beginFrame
+		std::mutex mutex;
+		std::condition_variable condition;
+		std::thread waiter;
+
+		auto waitLoop() -> void;
+	public:
+		FramePacer(Device& device, Renderer& renderer, FramePacing pacing);
+		~FramePacer();
+
+		FramePacer(const FramePacer&) = delete;
+		FramePacer& operator=(const FramePacer&) = delete;
+
+		auto beginFrame() -> void;
+		auto endFrame() -> void;
+		auto takeStats() -> LatencyStats;	// since the last call
+		auto getPacing() const -> FramePacing { return this->pacing; }
+	};
+
+	FramePacer::FramePacer(Device& device, Renderer& renderer, FramePacing pacing) :
+		device{ device }, renderer{ renderer }, pacing{ pacing }, lastSubmitted{ device.frameTimeline().getSubmitted() }
+	{
+		this->waiter = std::thread{ [this] { this->waitLoop(); } };
+	}
+	FramePacer::~FramePacer() {
+		{
+			std::lock_guard<std::mutex> lock{ this->mutex };
+			this->stopping = true;
+		}
+		this->condition.notify_all();
+		if (this->waiter.joinable())
+			this->waiter.join();	// finishes the frames already submitted first, they all signal eventually
+	}
+
+	auto FramePacer::beginFrame() -> void {
+		{
+			std::lock_guard<std::mutex> lock{ this->mutex };
+			if (this->error)
+				std::rethrow_exception(std::exchange(this->error, nullptr));
+		}
+		if (this->pacing == FramePacing::LowLatency)
+			this->renderer.waitForFrameSlot();	// the wait beginFrame would do after simulating, moved in front of it
+		this->input = Clock::now();
+	}
+	auto FramePacer::endFrame() -> void {
+		uint64_t submitted = this->device.frameTimeline().getSubmitted();
+		if (submitted == this->lastSubmitted) return;	// nothing went to the gpu, the swap chain was recreated instead
+		this->lastSubmitted = submitted;
+		{
+			std::lock_guard<std::mutex> lock{ this->mutex };
+			this->pending.push_back({ submitted, this->input });
+		}
+		this->condition.notify_one();
+	}
+	auto FramePacer::takeStats() -> LatencyStats {
+		std::lock_guard<std::mutex> lock{ this->mutex };
+		LatencyStats taken = this->stats;
+		taken.averageMs = taken.frames > 0 ? static_cast<float>(this->latencySum / taken.frames) : 0.0f;
+		this->stats = {};
+		this->latencySum = 0.0;
+		return taken;
+	}
+
+	auto FramePacer::waitLoop() -> void {
+		while (true) {
+			PendingFrame frame;
+			{
+				std::unique_lock<std::mutex> lock{ this->mutex };
+				this->condition.wait(lock, [this] { return this->stopping || !this->pending.empty(); });
+				if (this->pending.empty()) return;
+				frame = this->pending.front();
+				this->pending.pop_front();
+			}
+			try {
+				this->device.frameTimeline().wait(frame.value);	// frames finish in submission order, so one at a time is exact
+			}
+			catch (...) {	// escaping the thread would terminate
+				std::lock_guard<std::mutex> lock{ this->mutex };
+				this->error = std::current_exception();
+				return;
+			}
+			float latency = std::chrono::duration<float, std::chrono::milliseconds::period>(Clock::now() - frame.input).count();
+
+			std::lock_guard<std::mutex> lock{ this->mutex };
+			this->stats.frames++;
+			this->stats.maxMs = std::max(this->stats.maxMs, latency);
+			this->latencySum += latency;
+		}
+	}
+}
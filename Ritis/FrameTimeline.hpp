@@ -0,0 +1,82 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <atomic>
+#include <cstdint>
+#include <stdexcept>
+
+namespace engine {
+	/*
+		One timeline semaphore counting submitted frames. the nth frame submission signals n, so "has frame n finished" is a
+		single counter read and waiting for a frame is a wait for value n, from any thread and on any queue.
+		owned by the device so the count carries on across swap chain recreation.
+
+		usage:
+			uint64_t frame = device.frameTimeline().getSubmitted();	// the last frame recorded so far
+			...
+			if (device.frameTimeline().isComplete(frame)) { ... }		// or wait(frame), or wait on getSemaphore() at value frame in a submission
+	*/
+	class FrameTimeline {
+		VkDevice device;
+		VkSemaphore semaphore;
+		std::atomic<uint64_t> submitted{ 0 };	// frames handed to the queue so far
+		std::atomic<uint64_t> completed{ 0 };	// cached read of the counter, a racing store can only leave it a little behind
+	public:
+		FrameTimeline(VkDevice device);
+		~FrameTimeline();
+
+		FrameTimeline(const FrameTimeline&) = delete;
+		FrameTimeline& operator=(const FrameTimeline&) = delete;
+
+		auto next() -> uint64_t;	// value for the submission of a new frame to signal, only the swap chain submits frames
+		auto getSemaphore() const -> VkSemaphore { return this->semaphore; }
+		auto getSubmitted() const -> uint64_t { return this->submitted.load(); }
+		auto getCompleted() -> uint64_t;
+		auto isComplete(uint64_t frame) -> bool;
+		auto wait(uint64_t frame) -> void;
+	};
+
+	FrameTimeline::FrameTimeline(VkDevice device) : device{ device } {
+		VkSemaphoreTypeCreateInfo typeInfo{};
+		typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+		typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+		typeInfo.initialValue = 0;
+		VkSemaphoreCreateInfo semaphoreInfo{};
+		semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+		semaphoreInfo.pNext = &typeInfo;
+		if (vkCreateSemaphore(this->device, &semaphoreInfo, nullptr, &this->semaphore) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create frame timeline semaphore!");
+		}
+	}
+	FrameTimeline::~FrameTimeline() {
+		vkDestroySemaphore(this->device, this->semaphore, nullptr);
+	}
+
+	auto FrameTimeline::next() -> uint64_t {
+		return ++this->submitted;
+	}
+	auto FrameTimeline::getCompleted() -> uint64_t {
+		uint64_t value = 0;
+		vkGetSemaphoreCounterValue(this->device, this->semaphore, &value);
+		this->completed.store(value);
+		return value;
+	}
+	auto FrameTimeline::isComplete(uint64_t frame) -> bool {
+		if (frame <= this->completed) return true;	// no call into the driver for frames already known to be done
+		return this->getCompleted() >= frame;
+	}
+	auto FrameTimeline::wait(uint64_t frame) -> void {
+		if (frame <= this->completed) return;
+		VkSemaphoreWaitInfo waitInfo{};
+		waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+		waitInfo.semaphoreCount = 1;
+		waitInfo.pSemaphores = &this->semaphore;
+		waitInfo.pValues = &frame;
+		if (vkWaitSemaphores(this->device, &waitInfo, UINT64_MAX) != VK_SUCCESS) {
+			throw std::runtime_error("failed to wait for frame timeline!");
+		}
+		if (frame > this->completed.load())
+			this->completed.store(frame);
+	}
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include "Device.hpp"
+#include "Buffer.hpp"
+#include "SwapChain.hpp"
+
+#include <memory>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+namespace engine {
+	constexpr const VkDeviceSize FRAME_UNIFORM_CAPACITY = 1 << 20;	// bytes of uniform data each frame can push
+
+	struct FrameUniform {
+		void* data = nullptr;		// write here, flushed by FrameUniformAllocator::flush
+		uint32_t offset = 0;		// the dynamic offset to bind with
+		VkDeviceSize size = 0;
+	};
+
+	/*
+		Bump allocator for per frame uniform data. one persistently mapped uniform buffer holds a region per frame in flight,
+		allocate() hands out aligned slices of the current frame's region and beginFrame() starts that region over,
+		so systems push whatever constants they need each frame without creating buffers or descriptor sets.
+
+		descriptors are written once with VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC over descriptorInfo(sizeof(T)) and
+		each allocation is selected when binding by passing its offset as the dynamic offset.
+		a region is only reused once the frame that last used it has finished, which the renderer's beginFrame already waits for.
+
+		usage:
+			uniforms.beginFrame(frameIndex);				// after renderer.beginFrame
+			uint32_t offset = uniforms.push(ubo);
+			vkCmdBindDescriptorSets(..., 1, &set, 1, &offset);
+			...
+			uniforms.flush();								// before renderer.endFrame
+	*/
+	class FrameUniformAllocator {
+		std::unique_ptr<Buffer> buffer;
+		VkDeviceSize alignment;
+		VkDeviceSize maxRange;
+		uint32_t frameCount;
+		uint32_t frameIndex = 0;
+		VkDeviceSize head = 0;			// bytes used in the current frame's region
+		VkDeviceSize peak = 0;			// most bytes any frame used
+	public:
+		FrameUniformAllocator(Device& device, VkDeviceSize frameCapacity = FRAME_UNIFORM_CAPACITY, uint32_t frameCount = SwapChain::DEFAULT_FRAMES_IN_FLIGHT);
+
+		FrameUniformAllocator(const FrameUniformAllocator&) = delete;
+		FrameUniformAllocator& operator=(const FrameUniformAllocator&) = delete;
+
+		auto beginFrame(uint32_t frameIndex) -> void;
+		auto allocate(VkDeviceSize size) -> FrameUniform;
+		template<typename T>
+		auto push(const T& value) -> uint32_t;			// copies value in, returns its dynamic offset
+		auto flush() -> void;							// makes this frame's writes visible to the device
+
+		auto descriptorInfo(VkDeviceSize range) const -> VkDescriptorBufferInfo;	// range = size of the uniform block the binding reads
+		auto getFrameCapacity() const -> VkDeviceSize { return this->buffer->getAlignmentSize(); }
+		auto getAlignment() const -> VkDeviceSize { return this->alignment; }
+		auto getUsed() const -> VkDeviceSize { return this->head; }
+		auto getPeak() const -> VkDeviceSize { return this->peak; }
+	};
+
+	FrameUniformAllocator::FrameUniformAllocator(Device& device, VkDeviceSize frameCapacity, uint32_t frameCount) :
+		maxRange{ device.properties.limits.maxUniformBufferRange },
+		frameCount{ frameCount }
+	{
+		// no coherent bit, slices are flushed instead, so they also have to start on a nonCoherentAtomSize boundary (both are powers of two)
+		const VkPhysicalDeviceLimits& limits = device.properties.limits;
+		this->alignment = std::max(limits.minUniformBufferOffsetAlignment, limits.nonCoherentAtomSize);
+		this->buffer = std::make_unique<Buffer>(
+			device,
+			frameCapacity,
+			frameCount,	// one region per frame in flight
+			VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+			this->alignment
+		);
+		this->buffer->map();
+	}
+
+	auto FrameUniformAllocator::beginFrame(uint32_t frameIndex) -> void {
+		assert(frameIndex < this->frameCount && "Frame index out of range");
+		this->frameIndex = frameIndex;
+		this->head = 0;
+	}
+	auto FrameUniformAllocator::allocate(VkDeviceSize size) -> FrameUniform {
+		VkDeviceSize alignedSize = Buffer::getAlignment(size, this->alignment);
+		if (this->head + alignedSize > this->buffer->getAlignmentSize())
+			throw std::runtime_error("frame uniform allocator out of space, raise FRAME_UNIFORM_CAPACITY!");
+
+		VkDeviceSize offset = this->frameIndex * this->buffer->getAlignmentSize() + this->head;
+		this->head += alignedSize;
+		this->peak = std::max(this->peak, this->head);
+		this->buffer->markDirty(alignedSize, offset);	// contiguous, flushed as one range
+
+		FrameUniform uniform{};
+		uniform.data = static_cast<char*>(this->buffer->getMappedMemory()) + offset;
+		uniform.offset = static_cast<uint32_t>(offset);
+		uniform.size = size;
+		return uniform;
+	}
+	template<typename T>
+	auto FrameUniformAllocator::push(const T& value) -> uint32_t {
+		FrameUniform uniform = this->allocate(sizeof(T));
+		std::memcpy(uniform.data, &value, sizeof(T));
+		return uniform.offset;
+	}
+	auto FrameUniformAllocator::flush() -> void {
+		this->buffer->flushDirty();
+	}
+
+	auto FrameUniformAllocator::descriptorInfo(VkDeviceSize range) const -> VkDescriptorBufferInfo {
+		assert(range <= this->maxRange && "Uniform block larger than maxUniformBufferRange");
+		return this->buffer->descriptorInfo(range, 0);
+	}
+}
@@ -0,0 +1,584 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <vector>
+#include <array>
+#include <memory>
+#include <mutex>
+#include <bit>
+#include <random>
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <algorithm>
+
+namespace engine {
+	constexpr const VkDeviceSize MEMORY_BLOCK_SIZE = 64ull << 20;	// device memory is reserved in blocks of this size, smaller on small heaps
+	constexpr const uint32_t MEMORY_MIN_ORDER_SHIFT = 8;			// smallest sub-allocation is 256 bytes, >= any nonCoherentAtomSize the spec allows
+
+	class MemoryBlock;
+
+	// what an allocation is used for, only for reporting
+	enum class MemoryCategory : uint32_t {
+		Vertex,
+		Index,
+		Uniform,
+		Storage,		// storage and indirect buffers
+		Staging,
+		Attachment,		// depth and color targets
+		Other,
+		Count
+	};
+	constexpr const char* MEMORY_CATEGORY_NAMES[] = { "vertex", "index", "uniform", "storage", "staging", "attachment", "other" };
+
+	/*
+		A piece of device memory handed out by MemoryAllocator. bind resources with memory + offset.
+		size is what was reserved, a power of two at least as large as the request, or the exact request for dedicated allocations.
+	*/
+	struct Allocation {
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		VkDeviceSize offset = 0;
+		VkDeviceSize size = 0;
+		VkDeviceSize requestedSize = 0;
+		void* mapped = nullptr;			// host visible memory stays mapped for its whole life, already points at offset
+		uint32_t memoryType = 0;
+		uint32_t order = 0;
+		MemoryBlock* block = nullptr;	// nullptr for dedicated allocations
+		MemoryCategory category = MemoryCategory::Other;
+
+		auto valid() const -> bool { return this->memory != VK_NULL_HANDLE; }
+		auto isDedicated() const -> bool { return this->block == nullptr; }
+	};
+
+	struct MemoryAllocatorStats {
+		uint64_t allocations = 0;			// live, sub-allocated + dedicated
+		uint64_t dedicatedAllocations = 0;
+		uint64_t blocks = 0;
+		uint64_t deviceAllocations = 0;		// vkAllocateMemory calls since startup
+		uint64_t totalAllocations = 0;		// allocate() calls since startup
+		VkDeviceSize bytesRequested = 0;	// sum of live requirement sizes
+		VkDeviceSize bytesUsed = 0;			// sum of live allocation sizes, the difference to bytesRequested is power of two rounding
+		VkDeviceSize bytesReserved = 0;		// device memory held in blocks and dedicated allocations
+	};
+
+	struct MemoryFragmentation {			// over blocks only, dedicated allocations can't fragment
+		uint64_t blocks = 0;
+		VkDeviceSize blockBytes = 0;
+		VkDeviceSize usedBytes = 0;
+		VkDeviceSize freeBytes = 0;
+		VkDeviceSize largestFree = 0;		// biggest allocation that fits without a new block
+		float fragmentation = 0.0f;			// 1 - largestFree / freeBytes, 0 when all free space is one node
+	};
+
+	struct MemoryCategoryUsage {
+		uint64_t allocations = 0;
+		VkDeviceSize bytes = 0;				// requested sizes
+	};
+	struct MemoryHeapUsage {
+		VkDeviceSize size = 0;
+		VkDeviceSize budget = 0;			// what the driver says this process can use before things start to slow down, size without VK_EXT_memory_budget
+		VkDeviceSize usage = 0;				// this process' usage as the driver sees it, reserved without VK_EXT_memory_budget
+		VkDeviceSize reserved = 0;			// held by this allocator
+		bool deviceLocal = false;
+	};
+	struct MemorySnapshot {
+		MemoryAllocatorStats totals{};
+		std::array<MemoryCategoryUsage, static_cast<size_t>(MemoryCategory::Count)> categories{};
+		std::vector<MemoryHeapUsage> heaps;
+		bool driverBudget = false;			// budget and usage come from VK_EXT_memory_budget
+	};
+
+	/*
+		Buddy allocator over one VkDeviceMemory.
+		the block is a complete binary tree of power of two nodes, smallest 1 << MEMORY_MIN_ORDER_SHIFT bytes.
+		longest[] holds, per node, 1 + the order of the largest free node below it (0 = nothing free), so finding a fit and
+		merging buddies back on release are both a walk along one root to leaf path.
+		every node is aligned to its own size, which covers any alignment up to the allocation size
+	*/
+	class MemoryBlock {
+		std::vector<uint8_t> longest;
+		uint32_t maxOrder;
+
+		auto mergeUp(uint32_t node, uint32_t order) -> void;
+	public:
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		void* mapped = nullptr;
+		uint64_t id = 0;				// never reused, unlike the address once the block is freed. 0 is no block
+		VkDeviceSize size;
+		VkDeviceSize used = 0;
+		uint32_t allocationCount = 0;
+
+		MemoryBlock(VkDeviceSize size);
+
+		auto allocate(uint32_t order, VkDeviceSize& offset) -> bool;
+		auto release(VkDeviceSize offset, uint32_t order) -> void;
+		auto largestFreeOrder() const -> int { return static_cast<int>(this->longest[0]) - 1; }	// -1 when full
+		auto empty() const -> bool { return this->allocationCount == 0; }
+	};
+
+	MemoryBlock::MemoryBlock(VkDeviceSize size) : size{ size } {
+		this->maxOrder = std::bit_width(size >> MEMORY_MIN_ORDER_SHIFT) - 1;
+		this->longest.resize((size_t{ 2 } << this->maxOrder) - 1);
+
+		// depth d holds 1 << d nodes of order maxOrder - d, all free
+		size_t node = 0;
+		for (uint32_t depth = 0; depth <= this->maxOrder; depth++)
+			for (size_t i = 0; i < (size_t{ 1 } << depth); i++)
+				this->longest[node++] = static_cast<uint8_t>(this->maxOrder - depth + 1);
+	}
+
+	auto MemoryBlock::allocate(uint32_t order, VkDeviceSize& offset) -> bool {
+		if (order > this->maxOrder || this->longest[0] <= order) return false;
+
+		uint32_t node = 0;
+		for (uint32_t nodeOrder = this->maxOrder; nodeOrder > order; nodeOrder--) {
+			// descend into the tighter of the two children that fit, keeps big nodes whole for big requests
+			uint32_t left = node * 2 + 1;
+			uint8_t l = this->longest[left], r = this->longest[left + 1];
+			node = (l > order && (r <= order || l <= r)) ? left : left + 1;
+		}
+		this->longest[node] = 0;
+		this->mergeUp(node, order);
+
+		uint32_t firstAtDepth = (1u << (this->maxOrder - order)) - 1;
+		offset = static_cast<VkDeviceSize>(node - firstAtDepth) << (order + MEMORY_MIN_ORDER_SHIFT);
+		this->used += VkDeviceSize{ 1 } << (order + MEMORY_MIN_ORDER_SHIFT);
+		this->allocationCount++;
+		return true;
+	}
+	auto MemoryBlock::release(VkDeviceSize offset, uint32_t order) -> void {
+		uint32_t firstAtDepth = (1u << (this->maxOrder - order)) - 1;
+		uint32_t node = static_cast<uint32_t>(offset >> (order + MEMORY_MIN_ORDER_SHIFT)) + firstAtDepth;
+		this->longest[node] = static_cast<uint8_t>(order + 1);
+		this->mergeUp(node, order);
+
+		this->used -= VkDeviceSize{ 1 } << (order + MEMORY_MIN_ORDER_SHIFT);
+		this->allocationCount--;
+	}
+	// recompute the parents of node, two whole free buddies become one free parent
+	auto MemoryBlock::mergeUp(uint32_t node, uint32_t order) -> void {
+		while (node > 0) {
+			node = (node - 1) / 2;
+			order++;
+			uint8_t l = this->longest[node * 2 + 1], r = this->longest[node * 2 + 2];
+			this->longest[node] = (l == order && r == order) ? static_cast<uint8_t>(order + 1) : std::max(l, r);
+		}
+	}
+
+	/*
+		Carves buffers and images out of large per memory type blocks instead of one vkAllocateMemory per resource,
+		which stays far below maxMemoryAllocationCount and skips a driver round trip for most allocations.
+		requests larger than half a block get their own dedicated VkDeviceMemory.
+
+		linear (buffers) and optimal (images) resources share blocks. buddy nodes are aligned to their size, so padding
+		image allocations up to bufferImageGranularity puts every image on pages of its own and no buffer can alias them.
+		host visible blocks are mapped once when created, Allocation::mapped points straight into them.
+		every allocation is counted under a MemoryCategory, snapshot() reports those next to the per heap budget
+		(from VK_EXT_memory_budget when the device has it) and checkBudget() warns once a heap crosses a fraction of its budget.
+		thread safe.
+
+		usage:
+			Allocation allocation = allocator.allocate(requirements, memoryType, false);
+			vkBindBufferMemory(device, buffer, allocation.memory, allocation.offset);
+			...
+			allocator.free(allocation);
+	*/
+	class MemoryAllocator {
+		struct MemoryPool {
+			std::vector<std::unique_ptr<MemoryBlock>> blocks;
+			VkDeviceSize blockSize = 0;
+		};
+
+		VkDevice device;
+		VkPhysicalDevice physicalDevice;
+		VkPhysicalDeviceMemoryProperties memoryProperties;
+		VkDeviceSize bufferImageGranularity;
+		bool memoryBudgetSupported;
+		std::vector<MemoryPool> pools;		// one per memory type
+		MemoryAllocatorStats stats{};
+		std::array<MemoryCategoryUsage, static_cast<size_t>(MemoryCategory::Count)> categories{};
+		std::vector<VkDeviceSize> heapReserved;
+		std::vector<bool> heapOverBudget;	// so crossing the threshold warns once, not every check
+		float budgetWarningFraction = 0.9f;
+		uint64_t nextBlockId = 1;
+		mutable std::mutex mutex;
+
+		auto allocateDeviceMemory(VkDeviceSize size, uint32_t memoryType, void** mapped) -> VkDeviceMemory;
+		auto freeDeviceMemory(VkDeviceMemory memory, VkDeviceSize size, uint32_t memoryType) -> void;
+		auto allocateDedicated(const VkMemoryRequirements& requirements, uint32_t memoryType) -> Allocation;
+		auto track(const Allocation& allocation, bool allocated) -> void;
+	public:
+		MemoryAllocator(VkDevice device, VkPhysicalDevice physicalDevice, const VkPhysicalDeviceProperties& properties, bool memoryBudgetSupported = false);
+		~MemoryAllocator();
+
+		MemoryAllocator(const MemoryAllocator&) = delete;
+		MemoryAllocator& operator=(const MemoryAllocator&) = delete;
+
+		auto findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const -> uint32_t;
+		auto allocate(
+			const VkMemoryRequirements& requirements, uint32_t memoryType, bool optimalTiling,
+			MemoryCategory category = MemoryCategory::Other, uint64_t excludeBlock = 0) -> Allocation;	// never placed in the block with id excludeBlock
+		auto free(Allocation& allocation) -> void;
+		auto getFragmentation() const -> MemoryFragmentation;
+		// id of the least occupied block at or under maxOccupancy whose contents fit in the free space of its pool's other blocks, 0 if none
+		auto findSparseBlock(float maxOccupancy, const std::vector<uint64_t>& skip = {}) const -> uint64_t;
+		auto hasBlock(uint64_t id) const -> bool;	// false once the block's memory was freed
+
+		auto getStats() const -> MemoryAllocatorStats;
+		auto printStats() const -> void;
+		auto snapshot() const -> MemorySnapshot;
+		auto logUsage() const -> void;			// one line, categories and heaps
+		auto checkBudget() -> bool;				// false (and a warning the first time) while a heap is over the warning fraction of its budget
+		auto setBudgetWarningFraction(float fraction) -> void {
+			std::lock_guard<std::mutex> lock{ this->mutex };
+			this->budgetWarningFraction = fraction;
+		}
+		auto benchmark(uint32_t bufferCount = 100000, uint32_t liveBuffers = 4096) -> void;
+	};
+
+	MemoryAllocator::MemoryAllocator(VkDevice device, VkPhysicalDevice physicalDevice, const VkPhysicalDeviceProperties& properties, bool memoryBudgetSupported) :
+		device{ device },
+		physicalDevice{ physicalDevice },
+		bufferImageGranularity{ properties.limits.bufferImageGranularity },
+		memoryBudgetSupported{ memoryBudgetSupported }
+	{
+		vkGetPhysicalDeviceMemoryProperties(physicalDevice, &this->memoryProperties);
+		this->heapReserved.resize(this->memoryProperties.memoryHeapCount, 0);
+		this->heapOverBudget.resize(this->memoryProperties.memoryHeapCount, false);
+		this->pools.resize(this->memoryProperties.memoryTypeCount);
+		for (uint32_t i = 0; i < this->memoryProperties.memoryTypeCount; i++) {
+			// small heaps (integrated gpus, the 256MB host visible device local window) get a block of at most an eighth of the heap
+			VkDeviceSize heapSize = this->memoryProperties.memoryHeaps[this->memoryProperties.memoryTypes[i].heapIndex].size;
+			VkDeviceSize blockSize = std::min(MEMORY_BLOCK_SIZE, std::bit_floor(std::max<VkDeviceSize>(heapSize / 8, 1)));
+			this->pools[i].blockSize = std::max(blockSize, VkDeviceSize{ 1 } << (MEMORY_MIN_ORDER_SHIFT + 4));
+		}
+	}
+	MemoryAllocator::~MemoryAllocator() {
+		if (this->stats.allocations > 0)
+			std::cout << "memory allocator destroyed with " << this->stats.allocations << " live allocations\n";
+		for (MemoryPool& pool : this->pools)
+			for (auto& block : pool.blocks)
+				vkFreeMemory(this->device, block->memory, nullptr);
+	}
+
+	auto MemoryAllocator::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const -> uint32_t {
+		for (uint32_t i = 0; i < this->memoryProperties.memoryTypeCount; i++) {
+			if ((typeFilter & (1 << i)) && (this->memoryProperties.memoryTypes[i].propertyFlags & properties) == properties)
+				return i;
+		}
+		throw std::runtime_error("failed to find suitable memory type!");
+	}
+
+	auto MemoryAllocator::allocate(
+		const VkMemoryRequirements& requirements, uint32_t memoryType, bool optimalTiling, MemoryCategory category, uint64_t excludeBlock) -> Allocation {
+		VkDeviceSize size = std::max(requirements.size, requirements.alignment);
+		if (optimalTiling)
+			size = std::max(size, this->bufferImageGranularity);
+		size = std::bit_ceil(std::max(size, VkDeviceSize{ 1 } << MEMORY_MIN_ORDER_SHIFT));
+
+		std::lock_guard<std::mutex> lock{ this->mutex };
+		this->stats.totalAllocations++;
+		MemoryPool& pool = this->pools[memoryType];
+		if (size > pool.blockSize / 2) {
+			Allocation allocation = this->allocateDedicated(requirements, memoryType);
+			allocation.category = category;
+			this->track(allocation, true);
+			return allocation;
+		}
+
+		Allocation allocation{};
+		allocation.memoryType = memoryType;
+		allocation.category = category;
+		allocation.order = std::bit_width(size >> MEMORY_MIN_ORDER_SHIFT) - 1;
+		allocation.size = size;
+		allocation.requestedSize = requirements.size;
+
+		for (auto& block : pool.blocks) {
+			if (block->id != excludeBlock && block->allocate(allocation.order, allocation.offset)) {
+				allocation.block = block.get();
+				break;
+			}
+		}
+		if (!allocation.block) {
+			auto block = std::make_unique<MemoryBlock>(pool.blockSize);
+			block->memory = this->allocateDeviceMemory(pool.blockSize, memoryType, &block->mapped);
+			block->id = this->nextBlockId++;
+			block->allocate(allocation.order, allocation.offset);
+			allocation.block = block.get();
+			pool.blocks.push_back(std::move(block));
+			this->stats.blocks++;
+		}
+
+		allocation.memory = allocation.block->memory;
+		if (allocation.block->mapped)
+			allocation.mapped = static_cast<char*>(allocation.block->mapped) + allocation.offset;
+
+		this->track(allocation, true);
+		return allocation;
+	}
+
+	auto MemoryAllocator::free(Allocation& allocation) -> void {
+		if (!allocation.valid()) return;
+
+		std::lock_guard<std::mutex> lock{ this->mutex };
+		this->track(allocation, false);
+
+		if (allocation.isDedicated()) {
+			this->freeDeviceMemory(allocation.memory, allocation.size, allocation.memoryType);
+			this->stats.dedicatedAllocations--;
+		}
+		else {
+			MemoryBlock* block = allocation.block;
+			block->release(allocation.offset, allocation.order);
+
+			// keep one empty block around per memory type so alloc / free churn doesn't hit the driver every time
+			MemoryPool& pool = this->pools[allocation.memoryType];
+			if (block->empty()) {
+				size_t emptyBlocks = std::count_if(pool.blocks.begin(), pool.blocks.end(), [](const auto& b) { return b->empty(); });
+				if (emptyBlocks > 1) {
+					auto found = std::find_if(pool.blocks.begin(), pool.blocks.end(), [&](const auto& b) { return b.get() == block; });
+					this->freeDeviceMemory(block->memory, block->size, allocation.memoryType);
+					pool.blocks.erase(found);
+					this->stats.blocks--;
+				}
+			}
+		}
+		allocation = {};
+	}
+
+	auto MemoryAllocator::getFragmentation() const -> MemoryFragmentation {
+		std::lock_guard<std::mutex> lock{ this->mutex };
+		MemoryFragmentation result{};
+		for (const MemoryPool& pool : this->pools) {
+			for (const auto& block : pool.blocks) {
+				result.blocks++;
+				result.blockBytes += block->size;
+				result.usedBytes += block->used;
+				if (block->largestFreeOrder() >= 0)
+					result.largestFree = std::max(result.largestFree, VkDeviceSize{ 1 } << (block->largestFreeOrder() + MEMORY_MIN_ORDER_SHIFT));
+			}
+		}
+		result.freeBytes = result.blockBytes - result.usedBytes;
+		if (result.freeBytes > 0)
+			result.fragmentation = 1.0f - static_cast<float>(static_cast<double>(result.largestFree) / result.freeBytes);
+		return result;
+	}
+	auto MemoryAllocator::findSparseBlock(float maxOccupancy, const std::vector<uint64_t>& skip) const -> uint64_t {
+		std::lock_guard<std::mutex> lock{ this->mutex };
+		uint64_t sparsest = 0;
+		float sparsestOccupancy = maxOccupancy;
+		for (const MemoryPool& pool : this->pools) {
+			if (pool.blocks.size() < 2) continue;
+			VkDeviceSize poolFree = 0;
+			for (const auto& block : pool.blocks)
+				poolFree += block->size - block->used;
+
+			for (const auto& block : pool.blocks) {
+				if (block->empty() || std::find(skip.begin(), skip.end(), block->id) != skip.end()) continue;
+				float occupancy = static_cast<float>(static_cast<double>(block->used) / block->size);
+				bool fitsElsewhere = poolFree - (block->size - block->used) >= block->used;	// moving it out must not just fill a new block
+				if (occupancy <= sparsestOccupancy && fitsElsewhere) {
+					sparsest = block->id;
+					sparsestOccupancy = occupancy;
+				}
+			}
+		}
+		return sparsest;
+	}
+	auto MemoryAllocator::hasBlock(uint64_t id) const -> bool {
+		std::lock_guard<std::mutex> lock{ this->mutex };
+		for (const MemoryPool& pool : this->pools)
+			for (const auto& block : pool.blocks)
+				if (block->id == id) return true;
+		return false;
+	}
+
+	auto MemoryAllocator::getStats() const -> MemoryAllocatorStats {
+		std::lock_guard<std::mutex> lock{ this->mutex };
+		return this->stats;
+	}
+	auto MemoryAllocator::printStats() const -> void {
+		MemoryAllocatorStats s = this->getStats();
+		std::cout << "gpu memory: " << s.allocations << " allocations (" << s.dedicatedAllocations << " dedicated) in "
+			<< s.blocks << " blocks, " << (s.bytesRequested >> 10) << " KB requested, " << (s.bytesUsed >> 10) << " KB used, "
+			<< (s.bytesReserved >> 10) << " KB reserved, " << s.deviceAllocations << " vkAllocateMemory calls for "
+			<< s.totalAllocations << " allocations\n";
+	}
+
+	auto MemoryAllocator::snapshot() const -> MemorySnapshot {
+		MemorySnapshot snapshot{};
+		VkPhysicalDeviceMemoryBudgetPropertiesEXT budget{};
+		budget.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+		if (this->memoryBudgetSupported) {	// changes as other processes allocate, so queried every time
+			VkPhysicalDeviceMemoryProperties2 properties{};
+			properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+			properties.pNext = &budget;
+			vkGetPhysicalDeviceMemoryProperties2(this->physicalDevice, &properties);
+			snapshot.driverBudget = true;
+		}
+
+		std::lock_guard<std::mutex> lock{ this->mutex };
+		snapshot.totals = this->stats;
+		snapshot.categories = this->categories;
+		for (uint32_t i = 0; i < this->memoryProperties.memoryHeapCount; i++) {
+			MemoryHeapUsage heap{};
+			heap.size = this->memoryProperties.memoryHeaps[i].size;
+			heap.reserved = this->heapReserved[i];
+			heap.deviceLocal = this->memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT;
+			heap.budget = snapshot.driverBudget ? budget.heapBudget[i] : heap.size;
+			heap.usage = snapshot.driverBudget ? budget.heapUsage[i] : heap.reserved;
+			snapshot.heaps.push_back(heap);
+		}
+		return snapshot;
+	}
+	auto MemoryAllocator::logUsage() const -> void {
+		MemorySnapshot snapshot = this->snapshot();
+		std::cout << "gpu memory:";
+		for (size_t i = 0; i < snapshot.categories.size(); i++) {
+			if (snapshot.categories[i].allocations > 0)
+				std::cout << " " << MEMORY_CATEGORY_NAMES[i] << " " << (snapshot.categories[i].bytes >> 10) << "KB (" << snapshot.categories[i].allocations << ")";
+		}
+		std::cout << " |";
+		for (size_t i = 0; i < snapshot.heaps.size(); i++) {
+			const MemoryHeapUsage& heap = snapshot.heaps[i];
+			std::cout << " heap " << i << (heap.deviceLocal ? " (device)" : " (host)") << " " << (heap.usage >> 20) << "/" << (heap.budget >> 20) << "MB";
+		}
+		std::cout << (snapshot.driverBudget ? "\n" : " (no VK_EXT_memory_budget, usage is this allocator's)\n");
+	}
+	auto MemoryAllocator::checkBudget() -> bool {
+		MemorySnapshot snapshot = this->snapshot();	// takes the mutex itself
+		std::lock_guard<std::mutex> lock{ this->mutex };	// heapOverBudget and budgetWarningFraction are shared with other threads
+		bool withinBudget = true;
+		for (size_t i = 0; i < snapshot.heaps.size(); i++) {
+			const MemoryHeapUsage& heap = snapshot.heaps[i];
+			bool over = heap.budget > 0 && heap.usage > static_cast<VkDeviceSize>(heap.budget * static_cast<double>(this->budgetWarningFraction));
+			if (over && !this->heapOverBudget[i]) {
+				std::cout << "warning: gpu memory heap " << i << " at " << (heap.usage >> 20) << "MB of a " << (heap.budget >> 20)
+					<< "MB budget (warning at " << static_cast<int>(this->budgetWarningFraction * 100.0f) << "%), expect allocations to start failing or paging\n";
+			}
+			this->heapOverBudget[i] = over;
+			withinBudget &= !over;
+		}
+		return withinBudget;
+	}
+
+	// caller holds the mutex
+	auto MemoryAllocator::allocateDeviceMemory(VkDeviceSize size, uint32_t memoryType, void** mapped) -> VkDeviceMemory {
+		VkMemoryAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		allocInfo.allocationSize = size;
+		allocInfo.memoryTypeIndex = memoryType;
+
+		VkDeviceMemory memory;
+		if (vkAllocateMemory(this->device, &allocInfo, nullptr, &memory) != VK_SUCCESS)
+			throw std::runtime_error("failed to allocate device memory!");
+
+		*mapped = nullptr;
+		if (this->memoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+			if (vkMapMemory(this->device, memory, 0, VK_WHOLE_SIZE, 0, mapped) != VK_SUCCESS) {
+				vkFreeMemory(this->device, memory, nullptr);
+				throw std::runtime_error("failed to map device memory!");
+			}
+		}
+
+		this->stats.deviceAllocations++;
+		this->stats.bytesReserved += size;
+		this->heapReserved[this->memoryProperties.memoryTypes[memoryType].heapIndex] += size;
+		return memory;
+	}
+	// caller holds the mutex, vkFreeMemory unmaps implicitly
+	auto MemoryAllocator::freeDeviceMemory(VkDeviceMemory memory, VkDeviceSize size, uint32_t memoryType) -> void {
+		vkFreeMemory(this->device, memory, nullptr);
+		this->stats.bytesReserved -= size;
+		this->heapReserved[this->memoryProperties.memoryTypes[memoryType].heapIndex] -= size;
+	}
+	// caller holds the mutex
+	auto MemoryAllocator::track(const Allocation& allocation, bool allocated) -> void {
+		MemoryCategoryUsage& category = this->categories[static_cast<size_t>(allocation.category)];
+		if (allocated) {
+			this->stats.allocations++;
+			this->stats.bytesRequested += allocation.requestedSize;
+			this->stats.bytesUsed += allocation.size;
+			category.allocations++;
+			category.bytes += allocation.requestedSize;
+		}
+		else {
+			this->stats.allocations--;
+			this->stats.bytesRequested -= allocation.requestedSize;
+			this->stats.bytesUsed -= allocation.size;
+			category.allocations--;
+			category.bytes -= allocation.requestedSize;
+		}
+	}
+	// caller holds the mutex
+	auto MemoryAllocator::allocateDedicated(const VkMemoryRequirements& requirements, uint32_t memoryType) -> Allocation {
+		Allocation allocation{};
+		allocation.memoryType = memoryType;
+		allocation.size = requirements.size;
+		allocation.requestedSize = requirements.size;
+		allocation.memory = this->allocateDeviceMemory(requirements.size, memoryType, &allocation.mapped);
+		this->stats.dedicatedAllocations++;
+		return allocation;
+	}
+
+	/*
+		Stress test, creates bufferCount vertex buffers of random size (256B - 256KB) and frees them in random order,
+		keeping at most liveBuffers alive at once. prints the time per create + free pair and the allocator stats at the peak
+	*/
+	auto MemoryAllocator::benchmark(uint32_t bufferCount, uint32_t liveBuffers) -> void {
+		struct LiveBuffer {
+			VkBuffer buffer;
+			Allocation allocation;
+		};
+		std::vector<LiveBuffer> live{};
+		live.reserve(liveBuffers);
+		std::mt19937 random{ 1234 };
+		std::uniform_int_distribution<uint32_t> sizeShift{ 8, 18 };
+		MemoryAllocatorStats peak{};
+
+		auto destroy = [&](size_t i) {
+			vkDestroyBuffer(this->device, live[i].buffer, nullptr);
+			this->free(live[i].allocation);
+			live[i] = live.back();
+			live.pop_back();
+		};
+
+		auto start = std::chrono::high_resolution_clock::now();
+		for (uint32_t i = 0; i < bufferCount; i++) {
+			if (live.size() == liveBuffers)
+				destroy(random() % live.size());
+
+			VkDeviceSize size = VkDeviceSize{ 1 } << sizeShift(random);
+			size += random() % size;	// not a power of two, exercises the rounding
+
+			VkBufferCreateInfo bufferInfo{};
+			bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+			bufferInfo.size = size;
+			bufferInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+			bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+			LiveBuffer entry{};
+			if (vkCreateBuffer(this->device, &bufferInfo, nullptr, &entry.buffer) != VK_SUCCESS)
+				throw std::runtime_error("failed to create benchmark buffer!");
+
+			VkMemoryRequirements requirements;
+			vkGetBufferMemoryRequirements(this->device, entry.buffer, &requirements);
+			entry.allocation = this->allocate(requirements, this->findMemoryType(requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT), false, MemoryCategory::Vertex);
+			vkBindBufferMemory(this->device, entry.buffer, entry.allocation.memory, entry.allocation.offset);
+			live.push_back(entry);
+
+			if (live.size() == liveBuffers && peak.allocations == 0)
+				peak = this->getStats();
+		}
+		while (!live.empty())
+			destroy(live.size() - 1);
+		auto end = std::chrono::high_resolution_clock::now();
+
+		double ms = std::chrono::duration<double, std::chrono::milliseconds::period>(end - start).count();
+		std::cout << "allocator benchmark: " << bufferCount << " buffers created and freed in " << ms << " ms ("
+			<< ms * 1000.0 / bufferCount << " us per buffer), peak " << peak.allocations << " live in " << peak.blocks << " blocks, "
+			<< (peak.bytesRequested >> 10) << " KB requested / " << (peak.bytesReserved >> 10) << " KB reserved\n";
+		this->printStats();
+	}
+}
@@ -0,0 +1,634 @@
+#pragma once
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+
+#include "DedupTable.hpp"
+
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+
+namespace engine {
+	/*
+		Index/vertex reordering passes for indexed triangle lists, run after import:
+		1) optimizeVertexCache - reorder triangles so recently transformed vertices get reused (Forsyth, "Linear-Speed Vertex Cache Optimisation")
+		2) optimizeOverdraw - split the cache friendly order into clusters and sort them so outward facing ones draw first (Sander et al, "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw")
+		3) optimizeVertexFetch - renumber vertices in the order the indices first use them, so vertex fetches walk memory forwards
+		simplifyMesh builds lower detail index lists over the same vertices for LODs (edge collapse with quadric error metrics, Garland & Heckbert).
+		buildMeshlets splits an index list into small clusters with bounds the gpu can cull before rasterizing.
+		analyzeVertexCache gives ACMR (transformed vertices per triangle, 0.5 is ideal for a regular grid, 3 is worst)
+		and ATVR (transformed vertices per unique vertex, 1 is ideal) for a simulated FIFO cache.
+	*/
+	struct VertexCacheStats {
+		float acmr = 0.0f;		// average cache miss ratio, misses / triangles
+		float atvr = 0.0f;		// average transformed vertex ratio, misses / referenced vertices
+	};
+
+	constexpr uint32_t VERTEX_CACHE_ANALYZE_SIZE = 16;	// FIFO size used for stats and overdraw clustering, about what current hardware behaves like
+	constexpr uint32_t VERTEX_CACHE_OPTIMIZE_SIZE = 32;	// LRU size the Forsyth scoring assumes
+
+	// FIFO cache simulation using timestamps, a vertex is cached if it was added in the last cacheSize misses
+	class VertexCacheSimulator {
+		std::vector<uint32_t> timestamps;
+		uint32_t timestamp;
+		uint32_t cacheSize;
+	public:
+		VertexCacheSimulator(size_t vertexCount, uint32_t cacheSize) :
+			timestamps(vertexCount, 0), timestamp{ cacheSize + 1 }, cacheSize{ cacheSize } {}
+
+		auto access(uint32_t vertex) -> bool {	// true on a miss
+			if (this->timestamp - this->timestamps[vertex] > this->cacheSize) {
+				this->timestamps[vertex] = this->timestamp++;
+				return true;
+			}
+			return false;
+		}
+		auto reset() -> void { this->timestamp += this->cacheSize + 1; }
+	};
+
+	auto analyzeVertexCache(const std::vector<uint32_t>& indices, size_t vertexCount, uint32_t cacheSize = VERTEX_CACHE_ANALYZE_SIZE) -> VertexCacheStats {
+		VertexCacheStats stats{};
+		if (indices.size() < 3) return stats;	// no triangles, both ratios would divide by zero
+
+		VertexCacheSimulator cache{ vertexCount, cacheSize };
+		std::vector<bool> referenced(vertexCount, false);
+		size_t misses = 0, uniqueCount = 0;
+		for (uint32_t index : indices) {
+			misses += cache.access(index);
+			if (!referenced[index]) {
+				referenced[index] = true;
+				uniqueCount++;
+			}
+		}
+		stats.acmr = static_cast<float>(misses) / static_cast<float>(indices.size() / 3);
+		stats.atvr = static_cast<float>(misses) / static_cast<float>(uniqueCount);
+		return stats;
+	}
+
+	// Forsyth vertex score: recently used vertices score high, the last triangle's slightly less, and low valence vertices get a boost so they get finished off
+	static auto forsythVertexScore(int cachePosition, uint32_t remainingTriangles) -> float {
+		if (remainingTriangles == 0) return -1.0f;	// no triangles left to emit using it
+
+		float score = 0.0f;
+		if (cachePosition >= 0) {
+			if (cachePosition < 3)
+				score = 0.75f;
+			else
+				score = std::pow(1.0f - static_cast<float>(cachePosition - 3) / (VERTEX_CACHE_OPTIMIZE_SIZE - 3), 1.5f);
+		}
+		return score + 2.0f / std::sqrt(static_cast<float>(remainingTriangles));
+	}
+
+	auto optimizeVertexCache(std::vector<uint32_t>& indices, size_t vertexCount) -> void {
+		const size_t triangleCount = indices.size() / 3;
+		if (triangleCount == 0) return;
+
+		// vertex -> triangle adjacency (compressed, offsets into one array). remaining[v] counts triangles not yet emitted
+		std::vector<uint32_t> remaining(vertexCount, 0);
+		for (uint32_t index : indices)
+			remaining[index]++;
+		std::vector<uint32_t> offsets(vertexCount + 1, 0);
+		for (size_t v = 0; v < vertexCount; v++)
+			offsets[v + 1] = offsets[v] + remaining[v];
+		std::vector<uint32_t> adjacency(indices.size());
+		{
+			std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+			for (size_t i = 0; i < indices.size(); i++)
+				adjacency[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+		}
+
+		std::vector<int> cachePosition(vertexCount, -1);
+		std::vector<float> vertexScore(vertexCount);
+		for (size_t v = 0; v < vertexCount; v++)
+			vertexScore[v] = forsythVertexScore(-1, remaining[v]);
+		std::vector<float> triangleScore(triangleCount);
+		for (size_t t = 0; t < triangleCount; t++)
+			triangleScore[t] = vertexScore[indices[3 * t]] + vertexScore[indices[3 * t + 1]] + vertexScore[indices[3 * t + 2]];
+
+		std::vector<bool> emitted(triangleCount, false);
+		std::vector<uint32_t> result;
+		result.reserve(indices.size());
+		std::vector<uint32_t> cache, nextCache;
+		cache.reserve(VERTEX_CACHE_OPTIMIZE_SIZE + 3);
+		nextCache.reserve(VERTEX_CACHE_OPTIMIZE_SIZE + 3);
+
+		size_t cursor = 0;	// next candidate when the cache has no triangles left, keeps restarts linear instead of scanning every triangle
+		int64_t best = 0;
+		while (best >= 0) {
+			const uint32_t* triangle = &indices[3 * best];
+			result.insert(result.end(), triangle, triangle + 3);
+			emitted[best] = true;
+
+			for (int k = 0; k < 3; k++) {	// drop the triangle from its vertices' adjacency
+				uint32_t v = triangle[k];
+				uint32_t* begin = &adjacency[offsets[v]];
+				uint32_t* end = begin + remaining[v];
+				*std::find(begin, end, static_cast<uint32_t>(best)) = *(end - 1);
+				remaining[v]--;
+			}
+
+			// new LRU order: this triangle's vertices first, then the old cache
+			nextCache.assign(triangle, triangle + 3);
+			for (uint32_t v : cache) {
+				if (v != triangle[0] && v != triangle[1] && v != triangle[2])
+					nextCache.push_back(v);
+			}
+			for (size_t i = VERTEX_CACHE_OPTIMIZE_SIZE; i < nextCache.size(); i++)
+				cachePosition[nextCache[i]] = -1;	// evicted
+			nextCache.resize(std::min<size_t>(nextCache.size(), VERTEX_CACHE_OPTIMIZE_SIZE));
+			std::swap(cache, nextCache);
+
+			// rescore every vertex whose cache position changed (including the evicted ones) and the triangles around them
+			for (size_t i = 0; i < cache.size(); i++)
+				cachePosition[cache[i]] = static_cast<int>(i);
+			for (uint32_t v : nextCache)
+				vertexScore[v] = forsythVertexScore(cachePosition[v], remaining[v]);
+			for (uint32_t v : cache)
+				vertexScore[v] = forsythVertexScore(cachePosition[v], remaining[v]);
+
+			best = -1;
+			float bestScore = -1.0f;
+			for (uint32_t v : cache) {
+				for (uint32_t a = offsets[v]; a < offsets[v] + remaining[v]; a++) {
+					uint32_t t = adjacency[a];
+					triangleScore[t] = vertexScore[indices[3 * t]] + vertexScore[indices[3 * t + 1]] + vertexScore[indices[3 * t + 2]];
+					if (triangleScore[t] > bestScore) {
+						bestScore = triangleScore[t];
+						best = t;
+					}
+				}
+			}
+
+			if (best < 0) {	// cache is exhausted, restart from the next triangle not emitted yet
+				while (cursor < triangleCount && emitted[cursor])
+					cursor++;
+				if (cursor < triangleCount)
+					best = static_cast<int64_t>(cursor);
+			}
+		}
+		indices.swap(result);
+	}
+
+	/*
+		Splits the (cache optimized) triangle order into clusters and sorts the clusters so the ones facing away from the mesh center draw first,
+		those are the most likely to occlude the rest. clusters start where the cache restarted (all 3 vertices missed), and get split further
+		once their running ACMR is within threshold of the cluster's, so the cache efficiency lost is at most about threshold (1.05 = 5% worse ACMR).
+		V needs a glm::vec3 position member.
+	*/
+	template <typename V>
+	auto optimizeOverdraw(std::vector<uint32_t>& indices, const std::vector<V>& vertices, float threshold = 1.05f) -> void {
+		const size_t triangleCount = indices.size() / 3;
+		if (triangleCount == 0) return;
+
+		VertexCacheSimulator cache{ vertices.size(), VERTEX_CACHE_ANALYZE_SIZE };
+		auto triangleMisses = [&](size_t t) {
+			return cache.access(indices[3 * t]) + cache.access(indices[3 * t + 1]) + cache.access(indices[3 * t + 2]);
+		};
+
+		std::vector<size_t> hardBoundaries;
+		for (size_t t = 0; t < triangleCount; t++) {
+			if (triangleMisses(t) == 3)
+				hardBoundaries.push_back(t);
+		}
+		hardBoundaries.push_back(triangleCount);	// hardBoundaries[0] is always 0, the first triangle misses everything
+
+		std::vector<size_t> clusters;	// start triangle of each cluster, plus triangleCount at the end
+		for (size_t h = 0; h + 1 < hardBoundaries.size(); h++) {
+			size_t start = hardBoundaries[h], end = hardBoundaries[h + 1];
+
+			cache.reset();
+			size_t clusterMisses = 0;
+			for (size_t t = start; t < end; t++)
+				clusterMisses += triangleMisses(t);
+			const float clusterThreshold = threshold * static_cast<float>(clusterMisses) / static_cast<float>(end - start);
+
+			cache.reset();
+			clusters.push_back(start);
+			size_t runningMisses = 0, runningTriangles = 0;
+			for (size_t t = start; t < end; t++) {
+				runningMisses += triangleMisses(t);
+				runningTriangles++;
+				if (t + 1 < end && static_cast<float>(runningMisses) / runningTriangles <= clusterThreshold) {
+					clusters.push_back(t + 1);
+					cache.reset();
+					runningMisses = runningTriangles = 0;
+				}
+			}
+		}
+		clusters.push_back(triangleCount);
+
+		glm::vec3 meshCenter{ 0.0f };
+		float meshArea = 0.0f;
+		std::vector<float> sortKeys(clusters.size() - 1);
+		std::vector<glm::vec3> clusterCenters(sortKeys.size()), clusterNormals(sortKeys.size());
+		for (size_t c = 0; c + 1 < clusters.size(); c++) {	// area weighted center and summed (area weighted) normal of each cluster
+			glm::vec3 center{ 0.0f }, normal{ 0.0f };
+			float area = 0.0f;
+			for (size_t t = clusters[c]; t < clusters[c + 1]; t++) {
+				const glm::vec3& p0 = vertices[indices[3 * t]].position;
+				const glm::vec3& p1 = vertices[indices[3 * t + 1]].position;
+				const glm::vec3& p2 = vertices[indices[3 * t + 2]].position;
+				glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+				float triangleArea = glm::length(n);
+				center += (p0 + p1 + p2) * (triangleArea / 3.0f);
+				normal += n;
+				area += triangleArea;
+			}
+			meshCenter += center;
+			meshArea += area;
+			clusterCenters[c] = area > 0.0f ? center / area : vertices[indices[3 * clusters[c]]].position;
+			clusterNormals[c] = normal;
+		}
+		if (meshArea > 0.0f)
+			meshCenter /= meshArea;
+		for (size_t c = 0; c < sortKeys.size(); c++) {
+			float normalLength = glm::length(clusterNormals[c]);
+			sortKeys[c] = normalLength > 0.0f ? glm::dot(clusterCenters[c] - meshCenter, clusterNormals[c] / normalLength) : 0.0f;
+		}
+
+		std::vector<size_t> order(sortKeys.size());
+		for (size_t c = 0; c < order.size(); c++)
+			order[c] = c;
+		std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return sortKeys[a] > sortKeys[b]; });	// stable so the output is deterministic
+
+		std::vector<uint32_t> result;
+		result.reserve(indices.size());
+		for (size_t c : order)
+			result.insert(result.end(), indices.begin() + 3 * clusters[c], indices.begin() + 3 * clusters[c + 1]);
+		indices.swap(result);
+	}
+
+	// renumbers vertices in first use order and drops unreferenced ones
+	template <typename V>
+	auto optimizeVertexFetch(std::vector<V>& vertices, std::vector<uint32_t>& indices) -> void {
+		constexpr uint32_t UNUSED = ~0u;
+		std::vector<uint32_t> remap(vertices.size(), UNUSED);
+		std::vector<V> result;
+		result.reserve(vertices.size());
+		for (uint32_t& index : indices) {
+			if (remap[index] == UNUSED) {
+				remap[index] = static_cast<uint32_t>(result.size());
+				result.push_back(vertices[index]);
+			}
+			index = remap[index];
+		}
+		vertices.swap(result);
+	}
+
+	// plane quadric (Garland & Heckbert), symmetric 4x4 stored as its 10 unique terms. weight is the summed triangle area
+	struct Quadric {
+		double a2 = 0, ab = 0, ac = 0, ad = 0;
+		double b2 = 0, bc = 0, bd = 0;
+		double c2 = 0, cd = 0;
+		double d2 = 0;
+		double weight = 0;
+
+		static auto fromPlane(glm::vec3 normal, float distance, double weight) -> Quadric {	// plane: dot(normal, p) + distance = 0, normal unit length
+			double a = normal.x, b = normal.y, c = normal.z, d = distance;
+			return { a * a * weight, a * b * weight, a * c * weight, a * d * weight, b * b * weight, b * c * weight, b * d * weight, c * c * weight, c * d * weight, d * d * weight, weight };
+		}
+		auto operator+=(const Quadric& other) -> Quadric& {
+			a2 += other.a2; ab += other.ab; ac += other.ac; ad += other.ad;
+			b2 += other.b2; bc += other.bc; bd += other.bd;
+			c2 += other.c2; cd += other.cd;
+			d2 += other.d2;
+			weight += other.weight;
+			return *this;
+		}
+		auto error(glm::vec3 p) const -> double {	// area weighted mean squared distance from p to the planes
+			double x = p.x, y = p.y, z = p.z;
+			double e = a2 * x * x + b2 * y * y + c2 * z * z
+				+ 2.0 * (ab * x * y + ac * x * z + bc * y * z)
+				+ 2.0 * (ad * x + bd * y + cd * z)
+				+ d2;
+			return this->weight > 0.0 ? std::max(e, 0.0) / this->weight : 0.0;
+		}
+	};
+
+	/*
+		Halfedge collapse simplification: a vertex is merged into one of its neighbours (which doesn't move), so the result only indexes
+		existing vertices and can share the vertex buffer with the full detail mesh.
+		Vertices on borders, non-manifold edges and attribute seams (several vertices at one position, ie split normals/uvs) are locked,
+		so silhouettes and uv layouts hold together. Collapses are done cheapest first in passes until the index count reaches
+		targetIndexCount or no collapse below maxError (object space distance) is left. resultError gets the largest error used.
+		V needs a glm::vec3 position member.
+	*/
+	template <typename V>
+	auto simplifyMesh(const std::vector<V>& vertices, const std::vector<uint32_t>& indices, size_t targetIndexCount, float maxError, float* resultError = nullptr) -> std::vector<uint32_t> {
+		const size_t vertexCount = vertices.size();
+		if (resultError) *resultError = 0.0f;
+
+		// vertices sharing a position (seams) get one position id
+		std::vector<glm::vec3> positions;
+		std::vector<uint32_t> positionIds(vertexCount);
+		{
+			DedupTable<glm::vec3> positionTable{ positions, vertexCount };
+			for (size_t v = 0; v < vertexCount; v++)
+				positionIds[v] = positionTable.insert(vertices[v].position);
+		}
+		std::vector<uint32_t> verticesAtPosition(positions.size(), 0);
+		for (size_t v = 0; v < vertexCount; v++)
+			verticesAtPosition[positionIds[v]]++;
+
+		// lock positions on borders/non-manifold edges (edges not used by exactly 2 triangles)
+		std::vector<bool> locked(positions.size(), false);
+		{
+			std::vector<uint64_t> edges;
+			edges.reserve(indices.size());
+			for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+				for (int k = 0; k < 3; k++) {
+					uint64_t a = positionIds[indices[i + k]], b = positionIds[indices[i + (k + 1) % 3]];
+					edges.push_back(a < b ? (a << 32) | b : (b << 32) | a);
+				}
+			}
+			std::sort(edges.begin(), edges.end());
+			for (size_t e = 0; e < edges.size();) {
+				size_t run = e;
+				while (run < edges.size() && edges[run] == edges[e])
+					run++;
+				if (run - e != 2) {
+					locked[edges[e] >> 32] = true;
+					locked[edges[e] & 0xffffffff] = true;
+				}
+				e = run;
+			}
+		}
+		for (size_t p = 0; p < positions.size(); p++) {
+			if (verticesAtPosition[p] > 1)
+				locked[p] = true;
+		}
+
+		std::vector<Quadric> quadrics(positions.size());
+		for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+			glm::vec3 p0 = vertices[indices[i]].position, p1 = vertices[indices[i + 1]].position, p2 = vertices[indices[i + 2]].position;
+			glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+			float area = glm::length(normal);
+			if (area <= 0.0f) continue;
+			normal /= area;
+			Quadric q = Quadric::fromPlane(normal, -glm::dot(normal, p0), area);
+			quadrics[positionIds[indices[i]]] += q;
+			quadrics[positionIds[indices[i + 1]]] += q;
+			quadrics[positionIds[indices[i + 2]]] += q;
+		}
+
+		struct Collapse {
+			uint32_t from;
+			uint32_t to;
+			double cost;
+		};
+
+		const double maxCost = static_cast<double>(maxError) * maxError;
+		double largestCost = 0.0;
+		std::vector<uint32_t> result = indices;
+		std::vector<Collapse> collapses;
+		std::vector<uint32_t> collapseTarget(vertexCount);
+		std::vector<bool> touched(vertexCount);
+		std::vector<uint32_t> triangleOffsets(vertexCount + 1), triangleRefs;
+
+		while (result.size() > targetIndexCount) {
+			// candidate collapses along every edge of the current triangles, in both directions
+			collapses.clear();
+			for (size_t i = 0; i < result.size(); i += 3) {
+				for (int k = 0; k < 3; k++) {
+					uint32_t from = result[i + k], to = result[i + (k + 1) % 3];
+					for (int direction = 0; direction < 2; direction++, std::swap(from, to)) {
+						if (locked[positionIds[from]]) continue;
+						Quadric q = quadrics[positionIds[from]];
+						q += quadrics[positionIds[to]];
+						double cost = q.error(vertices[to].position);
+						if (cost <= maxCost)
+							collapses.push_back({ from, to, cost });
+					}
+				}
+			}
+			if (collapses.empty()) break;
+			std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) {
+				return a.cost < b.cost || (a.cost == b.cost && (a.from < b.from || (a.from == b.from && a.to < b.to)));	// tie break keeps the output deterministic
+			});
+
+			// vertex -> triangle adjacency of the current triangles
+			std::fill(triangleOffsets.begin(), triangleOffsets.end(), 0);
+			for (uint32_t index : result)
+				triangleOffsets[index + 1]++;
+			for (size_t v = 0; v < vertexCount; v++)
+				triangleOffsets[v + 1] += triangleOffsets[v];
+			triangleRefs.resize(result.size());
+			{
+				std::vector<uint32_t> fill(triangleOffsets.begin(), triangleOffsets.end() - 1);
+				for (size_t i = 0; i < result.size(); i++)
+					triangleRefs[fill[result[i]]++] = static_cast<uint32_t>(i / 3);
+			}
+
+			for (size_t v = 0; v < vertexCount; v++)
+				collapseTarget[v] = static_cast<uint32_t>(v);
+			std::fill(touched.begin(), touched.end(), false);
+
+			size_t triangleCount = result.size() / 3;
+			size_t collapsed = 0;
+			for (const auto& collapse : collapses) {
+				if (triangleCount * 3 <= targetIndexCount) break;
+				if (touched[collapse.from] || touched[collapse.to]) continue;	// one collapse per neighbourhood per pass, keeps the flip test valid
+
+				// reject collapses that flip (or nearly flip) a remaining triangle around from
+				bool flips = false;
+				uint32_t removed = 0;
+				const glm::vec3& target = vertices[collapse.to].position;
+				for (uint32_t r = triangleOffsets[collapse.from]; r < triangleOffsets[collapse.from + 1] && !flips; r++) {
+					const uint32_t* triangle = &result[3 * triangleRefs[r]];
+					int corner = triangle[0] == collapse.from ? 0 : (triangle[1] == collapse.from ? 1 : 2);
+					uint32_t b = triangle[(corner + 1) % 3], c = triangle[(corner + 2) % 3];
+					if (positionIds[b] == positionIds[collapse.to] || positionIds[c] == positionIds[collapse.to]) {
+						removed++;	// becomes degenerate and is dropped
+						continue;
+					}
+					const glm::vec3& pb = vertices[b].position;
+					const glm::vec3& pc = vertices[c].position;
+					glm::vec3 before = glm::cross(pb - vertices[collapse.from].position, pc - vertices[collapse.from].position);
+					glm::vec3 after = glm::cross(pb - target, pc - target);
+					flips = glm::dot(before, after) <= 0.25f * glm::length(before) * glm::length(after);
+				}
+				if (flips) continue;
+
+				collapseTarget[collapse.from] = collapse.to;
+				for (uint32_t r = triangleOffsets[collapse.from]; r < triangleOffsets[collapse.from + 1]; r++) {
+					const uint32_t* triangle = &result[3 * triangleRefs[r]];
+					touched[triangle[0]] = touched[triangle[1]] = touched[triangle[2]] = true;
+				}
+				quadrics[positionIds[collapse.to]] += quadrics[positionIds[collapse.from]];
+				largestCost = std::max(largestCost, collapse.cost);
+				triangleCount -= removed;
+				collapsed++;
+			}
+			if (collapsed == 0) break;
+
+			// apply, dropping triangles that collapsed to a line or point
+			size_t write = 0;
+			for (size_t i = 0; i < result.size(); i += 3) {
+				uint32_t a = collapseTarget[result[i]], b = collapseTarget[result[i + 1]], c = collapseTarget[result[i + 2]];
+				if (positionIds[a] == positionIds[b] || positionIds[b] == positionIds[c] || positionIds[a] == positionIds[c])
+					continue;
+				result[write++] = a;
+				result[write++] = b;
+				result[write++] = c;
+			}
+			result.resize(write);
+		}
+
+		if (resultError) *resultError = static_cast<float>(std::sqrt(largestCost));
+		return result;
+	}
+
+	constexpr uint32_t MESHLET_MAX_VERTICES = 64;	// cluster size limits, in line with what mesh shading hardware prefers
+	constexpr uint32_t MESHLET_MAX_TRIANGLES = 124;
+
+	/*
+		A contiguous range of an index buffer with culling bounds, laid out for a std430 buffer (see meshletCull.comp).
+		the normal cone is stored for the apex-free test from meshoptimizer, a cluster faces away from the camera when
+		dot(center - camera, cone.xyz) >= cone.w * length(center - camera) + radius
+	*/
+	struct Meshlet {
+		glm::vec4 sphere;		// xyz center, w radius, object space
+		glm::vec4 cone;			// xyz average facing, w sin of the widest normal's angle from it. 1 never culls
+		uint32_t firstIndex;
+		uint32_t indexCount;
+		uint32_t padding[2];
+	};
+	static_assert(sizeof(Meshlet) == 48, "Meshlet must match the std430 struct in meshletCull.comp");
+
+	/*
+		Bounding sphere and normal cone for triangles [firstIndex, firstIndex + indexCount).
+		face normals come from the winding but are flipped to agree with the vertex normals, so the cone points outwards whichever
+		winding the obj used. cones wider than ~84 degrees (or clusters without usable normals) get cutoff 1 and are never back-face culled
+	*/
+	template <typename V>
+	auto computeMeshletBounds(const std::vector<V>& vertices, const std::vector<uint32_t>& indices, uint32_t firstIndex, uint32_t indexCount) -> Meshlet {
+		Meshlet meshlet{};
+		meshlet.firstIndex = firstIndex;
+		meshlet.indexCount = indexCount;
+
+		glm::vec3 boundsMin = vertices[indices[firstIndex]].position;
+		glm::vec3 boundsMax = boundsMin;
+		for (uint32_t i = firstIndex; i < firstIndex + indexCount; i++) {
+			boundsMin = glm::min(boundsMin, vertices[indices[i]].position);
+			boundsMax = glm::max(boundsMax, vertices[indices[i]].position);
+		}
+		glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+		float radius = 0.0f;
+		for (uint32_t i = firstIndex; i < firstIndex + indexCount; i++)
+			radius = std::max(radius, glm::length(vertices[indices[i]].position - center));
+		meshlet.sphere = glm::vec4{ center, radius };
+
+		std::vector<glm::vec3> normals;
+		normals.reserve(indexCount / 3);
+		glm::vec3 axis{ 0.0f };
+		for (uint32_t i = firstIndex; i + 2 < firstIndex + indexCount; i += 3) {
+			const V& a = vertices[indices[i]];
+			const V& b = vertices[indices[i + 1]];
+			const V& c = vertices[indices[i + 2]];
+			glm::vec3 normal = glm::cross(b.position - a.position, c.position - a.position);
+			float length = glm::length(normal);
+			if (length == 0.0f) continue;	// degenerate, says nothing about facing
+			normal /= length;
+			if (glm::dot(normal, a.normal + b.normal + c.normal) < 0.0f)
+				normal = -normal;
+			normals.push_back(normal);
+			axis += normal;
+		}
+
+		meshlet.cone = glm::vec4{ 0.0f, 0.0f, 0.0f, 1.0f };
+		float axisLength = glm::length(axis);
+		if (normals.empty() || axisLength < 1e-6f) return meshlet;
+		axis /= axisLength;
+
+		float minDot = 1.0f;
+		for (const auto& normal : normals)
+			minDot = std::min(minDot, glm::dot(axis, normal));
+		if (minDot <= 0.1f) return meshlet;
+
+		// widening the normal cone by 90 degrees gives the cone of view directions that see every triangle's back, cos(a + 90) = -sin(a)
+		meshlet.cone = glm::vec4{ axis, std::sqrt(1.0f - minDot * minDot) };
+		return meshlet;
+	}
+
+	/*
+		Greedily cuts the index list into meshlets in its existing order, starting a new one whenever the next triangle would pass
+		maxVertices unique vertices or maxTriangles triangles. the index list isn't changed, so meshlets are plain ranges of the index buffer.
+		run it after optimizeVertexCache: the cache friendly order is also spatially coherent, which keeps the clusters (and their bounds) tight.
+		V needs glm::vec3 position and normal members.
+	*/
+	template <typename V>
+	auto buildMeshlets(
+		const std::vector<V>& vertices,
+		const std::vector<uint32_t>& indices,
+		uint32_t maxVertices = MESHLET_MAX_VERTICES,
+		uint32_t maxTriangles = MESHLET_MAX_TRIANGLES
+	) -> std::vector<Meshlet> {
+		std::vector<Meshlet> meshlets;
+		if (indices.empty()) return meshlets;
+		meshlets.reserve(indices.size() / 3 / maxTriangles + 1);
+
+		std::vector<uint32_t> lastMeshlet(vertices.size(), ~0u);	// which meshlet last counted the vertex, saves clearing a set per meshlet
+		uint32_t current = 0;
+		uint32_t first = 0;
+		uint32_t uniqueVertices = 0;
+
+		auto newVertices = [&](uint32_t a, uint32_t b, uint32_t c) -> uint32_t {
+			return (lastMeshlet[a] != current)
+				+ (lastMeshlet[b] != current && b != a)
+				+ (lastMeshlet[c] != current && c != a && c != b);
+		};
+
+		for (uint32_t i = 0; i + 2 < indices.size(); i += 3) {
+			uint32_t a = indices[i], b = indices[i + 1], c = indices[i + 2];
+			uint32_t added = newVertices(a, b, c);
+			if (i > first && (uniqueVertices + added > maxVertices || (i - first) / 3 >= maxTriangles)) {
+				meshlets.push_back(computeMeshletBounds(vertices, indices, first, i - first));
+				current++;
+				first = i;
+				uniqueVertices = 0;
+				added = newVertices(a, b, c);
+			}
+			lastMeshlet[a] = lastMeshlet[b] = lastMeshlet[c] = current;
+			uniqueVertices += added;
+		}
+		meshlets.push_back(computeMeshletBounds(vertices, indices, first, static_cast<uint32_t>(indices.size()) - first));
+		return meshlets;
+	}
+
+	/*
+		True when every edge is shared by exactly two triangles, comparing positions so uv and normal seams don't open the mesh.
+		only a closed mesh hides the back of its triangles, so meshlet cone culling is only safe on those.
+		V needs a glm::vec3 position member.
+	*/
+	template <typename V>
+	auto isClosedMesh(const std::vector<V>& vertices, const std::vector<uint32_t>& indices) -> bool {
+		if (indices.empty()) return false;
+		std::vector<glm::vec3> positions;
+		std::vector<uint32_t> positionIds(vertices.size());
+		{
+			DedupTable<glm::vec3> positionTable{ positions, vertices.size() };
+			for (size_t v = 0; v < vertices.size(); v++)
+				positionIds[v] = positionTable.insert(vertices[v].position);
+		}
+
+		std::vector<uint64_t> edges;
+		edges.reserve(indices.size());
+		for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+			for (int k = 0; k < 3; k++) {
+				uint64_t a = positionIds[indices[i + k]], b = positionIds[indices[i + (k + 1) % 3]];
+				edges.push_back(a < b ? (a << 32) | b : (b << 32) | a);
+			}
+		}
+		std::sort(edges.begin(), edges.end());
+		for (size_t i = 0; i < edges.size();) {
+			size_t run = 1;
+			while (i + run < edges.size() && edges[i + run] == edges[i]) run++;
+			if (run != 2) return false;	// a border, or more than two triangles on one edge
+			i += run;
+		}
+		return true;
+	}
+}
\ No newline at end of file
@@ -3,10 +3,14 @@
 #include "Device.hpp"
 #include "Buffer.hpp"
 #include "Utils.hpp"
+#include "DedupTable.hpp"
+#include "ThreadPool.hpp"
+#include "MeshOptimizer.hpp"
 
 #define GLM_FORCE_RADIANS					// functions expect radians, not degrees
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE			// Depth buffer values will range from 0 to 1, not -1 to 1
 #include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
 
 #define TINYOBJLOADER_IMPLEMENTATION
 #include <tiny_obj_loader.h>
@@ -18,20 +22,74 @@
 #include <memory>
 #include <iostream>
 #include <unordered_map>
+#include <fstream>
+#include <filesystem>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <thread>
+#include <atomic>
 
 namespace engine {
+	enum class VertexFormat {
+		Full,		// Model::Vertex, 44 bytes of floats
+		Packed		// Model::PackedVertex, 20 bytes. needs the simpleShaderPacked.vert pipeline
+	};
+
+	// how Model::createModelFromFile processes a mesh after parsing
+	struct ModelImportOptions {
+		bool optimize = false;				// run Builder::optimize after parsing. slower import, faster draws on dense meshes
+		VertexFormat vertexFormat = VertexFormat::Full;	// layout uploaded to the gpu. the mesh cache always holds full vertices, so this doesn't affect it
+
+		uint32_t lodLevels = 0;				// simplified levels generated after full detail, each aiming for half the previous triangle count
+		float lodMaxError = 0.05f;			// stop adding levels once the accumulated simplification error passes this fraction of the mesh radius
+
+		bool meshlets = false;				// split full detail into Meshlets for MeshletRenderSystem. quick to build, so redone on every load instead of cached
+
+		auto cacheKey() const -> uint32_t;	// stored in the mesh cache so caches built with other options are ignored
+	};
+
+	/*
+		Collects the uploads of any number of Models. their copies are recorded into Device::uploadBatcher() either way,
+		with a batch the constructor returns without waiting and whoever made the batch submits and waits on ticket
+	*/
+	struct ModelUploadBatch {
+		uint64_t ticket = 0;				// UploadBatcher ticket covering every copy so far
+		VkDeviceSize stagedSize = 0;
+	};
+
 	/*
 		Take vertex data from cpu, allocate memory and copy data over to device gpu
 	*/
 	class Model {
+		static inline std::atomic<uint64_t> nextId{ 0 };
+		const uint64_t id = nextId++;			// never reused, unlike the address once a model is destroyed
 		Device& device;
+		ModelUploadBatch* upload = nullptr;		// only set while the constructor runs
+		uint64_t uploadTicket = 0;				// UploadBatcher ticket of the last copy
 
 		std::unique_ptr<Buffer> vertexBuffer;
 		uint32_t vertexCount;
+		VertexFormat vertexFormat;
+		glm::mat4 dequantizeMatrix{ 1.0f };		// maps packed unorm positions back into the mesh bounds, identity for full vertices
 		
 		bool hasIndexBuffer = false;			// optional index buffer support. just leave input builder's indices member empty if not desired
 		std::unique_ptr<Buffer> indexBuffer;	// this allows the vertex buffer to only contain unique vertices (and any associated data, like color) // index buffers list indices of vertices in the vertex buffer
 		uint32_t indexCount;					// and avoids copying vertex data to form each triangle
+		struct LodRange {
+			uint32_t firstIndex;
+			uint32_t indexCount;
+			float error;						// object space simplification error, 0 for full detail
+		};
+		std::vector<LodRange> lods;				// every level lives in the one index buffer, level 0 is full detail
+		glm::vec3 boundingSphereCenter{};		// object space, from the builder's bounds
+		float boundingSphereRadius = 0.0f;
+		VkIndexType indexType = VK_INDEX_TYPE_UINT32;	// UINT16 whenever every vertex fits in 16 bits, halves index memory
+
+		std::unique_ptr<Buffer> meshletBuffer;	// storage buffer of Meshlet, ranges of full detail in the index buffer
+		uint32_t meshletCount = 0;
+		bool closed = false;					// no open borders, so back facing meshlets are hidden and can be cone culled
 
 		/*
 		 v1 ______ v2/v4
@@ -54,7 +112,7 @@ namespace engine {
 			glm::vec3 color;
 			glm::vec3 normal{};
 			glm::vec2 uv{};
-			
+
 			static auto getBindingDescriptions() -> std::vector<VkVertexInputBindingDescription>;
 			static auto getAttributeDescriptions() -> std::vector<VkVertexInputAttributeDescription>;
 
@@ -65,28 +123,91 @@ namespace engine {
 					&& this->uv == other.uv;
 			}
 		};
+		static_assert(sizeof(Vertex) == 44, "Vertex must stay tightly packed, DedupTable and the mesh cache use its raw bytes");
+
+		/*
+			Quantized vertex for bandwidth bound scenes, 20 bytes instead of 44:
+			position	R16G16B16A16_UNORM	0-1 within the mesh bounds, the renderer folds getDequantizeMatrix() into the model matrix (w unused)
+			normal		R16G16_SNORM		octahedral encoding, decoded in simpleShaderPacked.vert
+			color		R8G8B8A8_UNORM		alpha unused
+			uv			R16G16_SFLOAT
+		*/
+		struct PackedVertex {
+			uint16_t position[4];
+			uint32_t normal;
+			uint32_t color;
+			uint32_t uv;
+
+			static auto pack(const Vertex& vertex, glm::vec3 boundsMin, glm::vec3 boundsMax) -> PackedVertex;
+			static auto getBindingDescriptions() -> std::vector<VkVertexInputBindingDescription>;
+			static auto getAttributeDescriptions() -> std::vector<VkVertexInputAttributeDescription>;
+		};
+		static_assert(sizeof(PackedVertex) == 20, "PackedVertex must stay 20 bytes, the attribute offsets assume it");
 
 		struct Builder {
 			std::vector<Vertex> vertices{};
 			std::vector<uint32_t> indices{};
+			glm::vec3 boundsMin{};				// object space axis-aligned bounds of vertices
+			glm::vec3 boundsMax{};
 
+			auto importModel(const std::string& filepath, const ModelImportOptions& options = {}, ThreadPool* pool = nullptr) -> void;	// everything createModelFromFile does before the upload, no vulkan calls
 			auto loadModel(const std::string& filepath) -> void;
+			auto loadModelParallel(const std::string& filepath, ThreadPool& pool) -> void;	// same output as loadModel, parsed in chunks across the pool
+			auto loadCache(const std::string& cachePath, const std::string& sourcePath, uint32_t importKey = 0) -> bool;
+			auto writeCache(const std::string& cachePath, const std::string& sourcePath, uint32_t importKey = 0) const -> void;
+			auto computeBounds() -> void;
+			auto optimize() -> void;			// reorders indices/vertices for the gpu, see MeshOptimizer.hpp
+			auto generateLods(uint32_t levelCount, float maxError) -> void;	// maxError relative to the bounds radius
+			auto buildMeshlets(uint32_t maxVertices = MESHLET_MAX_VERTICES, uint32_t maxTriangles = MESHLET_MAX_TRIANGLES) -> void;	// over indices (full detail)
+			auto subdivide(uint32_t levels) -> void;	// splits every triangle into 4 per level without changing the shape, for stress testing
+
+			static auto benchmarkDedup(const std::string& filepath, uint32_t subdivideLevels = 4) -> void;	// DedupTable vs std::unordered_map over the obj's corners
+			static auto checkParallelImport(const std::string& filepath) -> void;	// loadModelParallel against loadModel, throws unless byte identical
+
+			struct LodLevel {
+				std::vector<uint32_t> indices;
+				float error;					// accumulated object space error from full detail
+			};
+			std::vector<LodLevel> lods{};		// simplified index lists over the same vertices, coarsest last. indices stays full detail
+			std::vector<Meshlet> meshlets{};	// clusters of indices with culling bounds, empty unless buildMeshlets ran
+			bool closed = false;				// set by buildMeshlets, see isClosedMesh
 		};
 
-		Model(Device& device, const Model::Builder& builder);
+		Model(Device& device, const Model::Builder& builder, VertexFormat vertexFormat = VertexFormat::Full, ModelUploadBatch* upload = nullptr);	// without a batch, uploads finish before this returns
 		~Model();
 
 		Model(const Model&) = delete;
 		Model& operator=(const Model&) = delete;
 
-		static auto createModelFromFile(Device& device, const std::string& filepath) -> std::unique_ptr<Model>;
+		static auto createModelFromFile(Device& device, const std::string& filepath, const ModelImportOptions& options = {}) -> std::unique_ptr<Model>;	// waits for the upload, frame thread only
 
 		auto bind(VkCommandBuffer commandBuffer) -> void;
-		auto draw(VkCommandBuffer commandBuffer) -> void;
+		auto draw(VkCommandBuffer commandBuffer, uint32_t lod = 0) -> void;
+
+		auto getId() const -> uint64_t { return this->id; }
+		auto getVertexFormat() const -> VertexFormat { return this->vertexFormat; }
+		auto getIndexType() const -> VkIndexType { return this->indexType; }
+		auto getIndexCount() const -> uint32_t { return this->hasIndexBuffer ? this->indexCount : 0; }	// every lod
+		auto getVertexBufferSize() const -> VkDeviceSize { return this->vertexBuffer->getBufferSize(); }
+		auto getIndexBufferSize() const -> VkDeviceSize { return this->hasIndexBuffer ? this->indexBuffer->getBufferSize() : 0; }
+		auto getLodCount() const -> uint32_t { return static_cast<uint32_t>(this->lods.size()); }	// 0 without an index buffer
+		auto getLodError(uint32_t lod) const -> float { return this->lods[lod].error; }
+		auto getTriangleCount(uint32_t lod = 0) const -> uint32_t { return this->lods.empty() ? this->vertexCount / 3 : this->lods[lod].indexCount / 3; }
+		auto getBoundingSphereCenter() const -> glm::vec3 { return this->boundingSphereCenter; }
+		auto getBoundingSphereRadius() const -> float { return this->boundingSphereRadius; }
+		auto getDequantizeMatrix() const -> const glm::mat4& { return this->dequantizeMatrix; }
+		auto hasMeshlets() const -> bool { return this->meshletCount > 0; }
+		auto getMeshletCount() const -> uint32_t { return this->meshletCount; }
+		auto isClosed() const -> bool { return this->closed; }
+		auto getMeshletBuffer() const -> Buffer& { return *this->meshletBuffer; }
 
 	private:
-		auto createVertexBuffers(const std::vector<Vertex>& vertices) -> void;
-		auto createIndexBuffers(const std::vector<uint32_t>& indices) -> void;
+		template <typename V>
+		auto createVertexBuffers(const std::vector<V>& vertices) -> void;
+		template <typename I>
+		auto createIndexBuffers(const std::vector<I>& indices) -> void;
+		auto createMeshletBuffer(const std::vector<Meshlet>& meshlets) -> void;
+		auto copyFromStaging(const void* data, Buffer& destination, VkDeviceSize size) -> void;
 	};
 }
 
@@ -102,77 +223,169 @@ namespace std { // p sure this is undefined behavior
 }
 
 namespace engine {
-	Model::Model(Device& d, const Model::Builder& builder) :
-		device{ d }
+	/*
+		Binary mesh cache written next to the source obj (ie, models/smooth_vase.obj.mesh)
+		layout: MeshCacheHeader | Vertex[vertexCount] | uint32_t[indexCount] | MeshCacheLod[lodCount] | each lod's uint32_t[indexCount]
+		the source file's size and last write time are stored so an edited obj invalidates the cache.
+		bump MESH_CACHE_VERSION whenever Vertex or the header changes.
+	*/
+	constexpr uint32_t MESH_CACHE_MAGIC = 0x48534d52; // "RMSH"
+	constexpr uint32_t MESH_CACHE_VERSION = 3;
+
+	constexpr uintmax_t PARALLEL_IMPORT_MIN_SIZE = 8 * 1024 * 1024;	// objs at least this big are parsed across a thread pool
+	constexpr size_t PARALLEL_IMPORT_THREADS = 0;						// 0 = one per core, set lower to measure scaling
+	constexpr size_t IMPORT_CORNERS_PER_VERTEX = 4;	// typical face corners per unique vertex (~6 on smooth meshes, fewer with seams), sizes the dedup tables
+
+	struct MeshCacheHeader {
+		uint32_t magic;
+		uint32_t version;
+		uint32_t vertexSize;
+		uint32_t vertexCount;
+		uint32_t indexCount;
+		uint32_t importKey;	// ModelImportOptions::cacheKey the cache was built with
+		uint64_t sourceSize;
+		int64_t sourceWriteTime;
+		glm::vec3 boundsMin;
+		glm::vec3 boundsMax;
+		uint32_t lodCount;
+		uint32_t padding;
+	};
+	struct MeshCacheLod {
+		uint32_t indexCount;
+		float error;
+	};
+
+	auto ModelImportOptions::cacheKey() const -> uint32_t {
+		struct {
+			uint32_t optimize;
+			uint32_t lodLevels;
+			float lodMaxError;
+		} key{ this->optimize ? 1u : 0u, this->lodLevels, this->lodLevels > 0 ? this->lodMaxError : 0.0f };
+		return static_cast<uint32_t>(hashBytes(&key, sizeof(key)));
+	}
+
+	Model::Model(Device& d, const Model::Builder& builder, VertexFormat vertexFormat, ModelUploadBatch* upload) :
+		device{ d }, upload{ upload }, vertexFormat{ vertexFormat }
 	{
-		this->createVertexBuffers(builder.vertices);
-		this->createIndexBuffers(builder.indices);
+		if (vertexFormat == VertexFormat::Packed) {
+			std::vector<PackedVertex> packed;
+			packed.reserve(builder.vertices.size());
+			for (const auto& vertex : builder.vertices)
+				packed.push_back(PackedVertex::pack(vertex, builder.boundsMin, builder.boundsMax));
+
+			// unorm 0-1 -> boundsMin + t * extent, as a scale then translate applied before the model matrix
+			glm::vec3 extent = builder.boundsMax - builder.boundsMin;
+			this->dequantizeMatrix = glm::mat4{
+				glm::vec4{ extent.x, 0.0f, 0.0f, 0.0f },
+				glm::vec4{ 0.0f, extent.y, 0.0f, 0.0f },
+				glm::vec4{ 0.0f, 0.0f, extent.z, 0.0f },
+				glm::vec4{ builder.boundsMin, 1.0f }
+			};
+			this->createVertexBuffers(packed);
+
+			size_t fullSize = sizeof(Vertex) * builder.vertices.size();
+			size_t packedSize = sizeof(PackedVertex) * packed.size();
+			std::cout << "Packed vertices: " << fullSize / 1024 << "KB -> " << packedSize / 1024 << "KB (saved " << (fullSize - packedSize) / 1024 << "KB)\n";
+		}
+		else {
+			this->createVertexBuffers(builder.vertices);
+		}
+
+		// lods are appended after full detail in one index buffer, draw picks a range
+		std::vector<uint32_t> allIndices = builder.indices;
+		if (!builder.indices.empty()) {
+			this->lods.push_back({ 0, static_cast<uint32_t>(builder.indices.size()), 0.0f });
+			for (const auto& lod : builder.lods) {
+				this->lods.push_back({ static_cast<uint32_t>(allIndices.size()), static_cast<uint32_t>(lod.indices.size()), lod.error });
+				allIndices.insert(allIndices.end(), lod.indices.begin(), lod.indices.end());
+			}
+		}
+		this->boundingSphereCenter = (builder.boundsMin + builder.boundsMax) * 0.5f;
+		this->boundingSphereRadius = glm::length(builder.boundsMax - builder.boundsMin) * 0.5f;
+
+		if (this->vertexCount <= 65536) {	// 16 bit indices address vertices 0-65535 (primitive restart is off, so 0xffff is a normal index)
+			std::vector<uint16_t> shortIndices(allIndices.begin(), allIndices.end());
+			this->createIndexBuffers(shortIndices);
+		}
+		else {
+			this->createIndexBuffers(allIndices);
+		}
+		this->createMeshletBuffer(builder.meshlets);
+		this->closed = builder.closed;
+
+		if (this->upload == nullptr)
+			this->device.uploadBatcher().wait(this->uploadTicket);
+		this->upload = nullptr;
 	}
 	Model::~Model() {}
 
-	auto Model::createModelFromFile(Device& device, const std::string& filepath) -> std::unique_ptr<Model> {
+	auto Model::createModelFromFile(Device& device, const std::string& filepath, const ModelImportOptions& options) -> std::unique_ptr<Model> {
 		Builder builder{};
-		builder.loadModel(filepath);
-		std::cout << "Vertex count: " << builder.vertices.size() << "\n";
-		return std::make_unique<Model>(device, builder);
+		builder.importModel(filepath, options);
+		return std::make_unique<Model>(device, builder, options.vertexFormat);
 	}
 
-	auto Model::createVertexBuffers(const std::vector<Vertex>& vertices) -> void {
+	template <typename V>
+	auto Model::createVertexBuffers(const std::vector<V>& vertices) -> void {
 		this->vertexCount = static_cast<uint32_t>(vertices.size());
 		assert(this->vertexCount >= 3 && "Vertex count must be at least 3");
 		VkDeviceSize bufferSize = sizeof(vertices[0]) * this->vertexCount;
 		uint32_t vertexSize = sizeof(vertices[0]);
 
-		Buffer stagingBuffer{
-			this->device,
-			vertexSize,
-			this->vertexCount,
-			VK_BUFFER_USAGE_TRANSFER_SRC_BIT,			// buffer will be used as a source location for a memory transfer on device
-			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT			// host = CPU (device = GPU), so cpu accessible. Needed to write from cpu. host changes affect device side. 
-		};
-
-		stagingBuffer.map(); // map stagingBufferMemory to void* data 
-		stagingBuffer.writeToBuffer((void*)vertices.data()); // vertices written to host memory. coherent bit flushed changes
-		// end mapping (happens during cleanup), now do internal transfer to device only memory for faster operation (as it doesnt need to check if things have been written to it)
-
 		this->vertexBuffer = std::make_unique<Buffer>(
 			this->device,
 			vertexSize,
 			this->vertexCount,
-			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,	// buffer will be used to hold vertex buffer data and be a destination from a staging buffer
+			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,	// buffer will be used to hold vertex buffer data and be a destination from a staging buffer, source when defragmenting
 			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT // optimized device only memory
 		);
 
-		this->device.copyBuffer(stagingBuffer.getBuffer(), this->vertexBuffer->getBuffer(), bufferSize); // copy host & device side staging buffer into device only vertex buffer
-		// cleanup buffers
+		this->copyFromStaging(vertices.data(), *this->vertexBuffer, bufferSize); // written to host visible staging memory, then copied into device only vertex buffer
+		this->vertexBuffer->setMovable(this->uploadTicket);
 	}
-	auto Model::createIndexBuffers(const std::vector<uint32_t>& indices) -> void {	// similar to vertex buffer
+	template <typename I>
+	auto Model::createIndexBuffers(const std::vector<I>& indices) -> void {	// similar to vertex buffer
+		static_assert(sizeof(I) == 2 || sizeof(I) == 4, "index buffers are uint16_t or uint32_t");
 		this->indexCount = static_cast<uint32_t>(indices.size());
+		this->indexType = sizeof(I) == 2 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
 		this->hasIndexBuffer = this->indexCount > 0;
 		if (!this->hasIndexBuffer) return;											// can early return
 		VkDeviceSize bufferSize = sizeof(indices[0]) * this->indexCount;
 		uint32_t indexSize = sizeof(indices[0]);
 
-		Buffer stagingBuffer{
+		this->indexBuffer = std::make_unique<Buffer>(
 			this->device,
 			indexSize,
 			this->indexCount,
-			VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		};
+			VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT, // index buffer but also destination for staging buffer copy, source when defragmenting
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT // optimized device only memory
+		);
 
-		stagingBuffer.map();
-		stagingBuffer.writeToBuffer((void*) indices.data());
+		this->copyFromStaging(indices.data(), *this->indexBuffer, bufferSize);
+		this->indexBuffer->setMovable(this->uploadTicket);
+	}
+	auto Model::createMeshletBuffer(const std::vector<Meshlet>& meshlets) -> void {	// same staging copy, read by meshletCull.comp
+		this->meshletCount = static_cast<uint32_t>(meshlets.size());
+		if (this->meshletCount == 0) return;
+		assert(this->hasIndexBuffer && "Meshlets are ranges of the index buffer");
 
-		this->indexBuffer = std::make_unique<Buffer>(
+		this->meshletBuffer = std::make_unique<Buffer>(
 			this->device,
-			indexSize,
-			this->indexCount,
-			VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, // index buffer but also destination for staging buffer copy
-			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT // optimized device only memory
+			sizeof(Meshlet),
+			this->meshletCount,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
 		);
 
-		this->device.copyBuffer(stagingBuffer.getBuffer(), this->indexBuffer->getBuffer(), bufferSize);
+		this->copyFromStaging(meshlets.data(), *this->meshletBuffer, sizeof(Meshlet) * this->meshletCount);
+	}
+	// staged and recorded into the device's upload batch, the caller decides when to wait on the returned ticket
+	auto Model::copyFromStaging(const void* data, Buffer& destination, VkDeviceSize size) -> void {
+		this->uploadTicket = this->device.uploadBatcher().upload(data, size, destination.getBuffer());
+		if (this->upload) {
+			this->upload->ticket = this->uploadTicket;
+			this->upload->stagedSize += size;
+		}
 	}
 
 	auto Model::bind(VkCommandBuffer commandBuffer) -> void {
@@ -187,16 +400,17 @@ namespace engine {
 		);
 
 		if (this->hasIndexBuffer) {
-			vkCmdBindIndexBuffer(commandBuffer, this->indexBuffer->getBuffer(), 0, VK_INDEX_TYPE_UINT32); // could use different int type here to save space or make room for more vertices
+			vkCmdBindIndexBuffer(commandBuffer, this->indexBuffer->getBuffer(), 0, this->indexType); // type has to match what createIndexBuffers stored
 		}
 	}
-	auto Model::draw(VkCommandBuffer commandBuffer) -> void {
+	auto Model::draw(VkCommandBuffer commandBuffer, uint32_t lod) -> void {
 		if (this->hasIndexBuffer) {
+			const LodRange& range = this->lods[std::min<size_t>(lod, this->lods.size() - 1)];
 			vkCmdDrawIndexed(
 				commandBuffer,
-				this->indexCount,
+				range.indexCount,
 				1,
-				0,
+				range.firstIndex,		// first index, levels share the vertex buffer so vertex offset stays 0
 				0,
 				0
 			);
@@ -249,6 +463,145 @@ namespace engine {
 		return attributeDescriptions;
 	}
 
+	auto Model::PackedVertex::pack(const Vertex& vertex, glm::vec3 boundsMin, glm::vec3 boundsMax) -> PackedVertex {
+		PackedVertex packed{};
+
+		glm::vec3 extent = boundsMax - boundsMin;
+		for (int i = 0; i < 3; i++) {	// flat axes (ie, a floor quad's y) have no extent, everything sits at boundsMin
+			float t = extent[i] > 0.0f ? (vertex.position[i] - boundsMin[i]) / extent[i] : 0.0f;
+			packed.position[i] = static_cast<uint16_t>(std::round(glm::clamp(t, 0.0f, 1.0f) * 65535.0f));
+		}
+		packed.position[3] = 0;
+
+		// octahedral: project onto the |x|+|y|+|z| = 1 octahedron, fold the bottom half over the top, keep xy
+		float l1 = std::abs(vertex.normal.x) + std::abs(vertex.normal.y) + std::abs(vertex.normal.z);
+		glm::vec2 octahedral{ 0.0f };
+		if (l1 > 0.0f) {
+			octahedral = glm::vec2{ vertex.normal.x, vertex.normal.y } / l1;
+			if (vertex.normal.z < 0.0f) {
+				octahedral = glm::vec2{
+					(1.0f - std::abs(octahedral.y)) * (octahedral.x >= 0.0f ? 1.0f : -1.0f),
+					(1.0f - std::abs(octahedral.x)) * (octahedral.y >= 0.0f ? 1.0f : -1.0f)
+				};
+			}
+		}
+		packed.normal = glm::packSnorm2x16(octahedral);
+		packed.color = glm::packUnorm4x8(glm::vec4{ vertex.color, 1.0f });
+		packed.uv = glm::packHalf2x16(vertex.uv);
+		return packed;
+	}
+	auto Model::PackedVertex::getBindingDescriptions() -> std::vector<VkVertexInputBindingDescription> {
+		std::vector<VkVertexInputBindingDescription> bindingDescriptions(1);
+		bindingDescriptions[0].binding = 0;
+		bindingDescriptions[0].stride = sizeof(PackedVertex);
+		bindingDescriptions[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+		return bindingDescriptions;
+	}
+	auto Model::PackedVertex::getAttributeDescriptions() -> std::vector<VkVertexInputAttributeDescription> {
+		std::vector<VkVertexInputAttributeDescription> attributeDescriptions{};	// same locations as Vertex, only the formats change
+
+		attributeDescriptions.push_back({	// position
+			0,
+			0,
+			VK_FORMAT_R16G16B16A16_UNORM,	// 3 component 16 bit formats are rarely supported for vertex input, so 4 with w unused
+			offsetof(PackedVertex, position)
+		});
+		attributeDescriptions.push_back({	// color
+			1,
+			0,
+			VK_FORMAT_R8G8B8A8_UNORM,
+			offsetof(PackedVertex, color)
+		});
+		attributeDescriptions.push_back({	// normal
+			2,
+			0,
+			VK_FORMAT_R16G16_SNORM,
+			offsetof(PackedVertex, normal)
+		});
+		attributeDescriptions.push_back({	// uv
+			3,
+			0,
+			VK_FORMAT_R16G16_SFLOAT,
+			offsetof(PackedVertex, uv)
+		});
+		return attributeDescriptions;
+	}
+
+	// builds one vertex from an obj face corner. shared by the serial and parallel import so both produce identical bytes
+	static auto objVertex(const tinyobj::attrib_t& attrib, const tinyobj::index_t& index) -> Model::Vertex {
+		Model::Vertex vertex{};
+		if (index.vertex_index >= 0) {
+			vertex.position = {
+				attrib.vertices[3 * index.vertex_index + 0],
+				attrib.vertices[3 * index.vertex_index + 1],
+				attrib.vertices[3 * index.vertex_index + 2]
+			};
+			vertex.color = {
+				attrib.colors[3 * index.vertex_index + 0],
+				attrib.colors[3 * index.vertex_index + 1],
+				attrib.colors[3 * index.vertex_index + 2]
+			};
+		}
+		if (index.normal_index >= 0) {
+			vertex.normal = {
+				attrib.normals[3 * index.normal_index + 0],
+				attrib.normals[3 * index.normal_index + 1],
+				attrib.normals[3 * index.normal_index + 2]
+			};
+		}
+		if (index.texcoord_index >= 0) {
+			vertex.uv = {
+				attrib.texcoords[2 * index.texcoord_index + 0],
+				attrib.texcoords[2 * index.texcoord_index + 1]
+			};
+		}
+		return vertex;
+	}
+
+	/*
+		Mesh cache if it's current, otherwise parse (across pool, or a temporary pool, when the obj is large), post-process and refresh the cache.
+		only touches the builder and files, so it can run on a worker thread. parallelFor on the caller's own pool is fine from inside one of its jobs
+	*/
+	auto Model::Builder::importModel(const std::string& filepath, const ModelImportOptions& options, ThreadPool* pool) -> void {
+		const std::string cachePath = filepath + ".mesh";
+
+		auto startTime = std::chrono::high_resolution_clock::now();
+		bool fromCache = this->loadCache(cachePath, filepath, options.cacheKey());
+		if (!fromCache) {							// missing or stale cache, parse the obj and refresh the cache for next launch
+			std::error_code ec;
+			uintmax_t sourceSize = std::filesystem::file_size(filepath, ec);
+			if (!ec && sourceSize >= PARALLEL_IMPORT_MIN_SIZE) {
+				if (pool != nullptr) {
+					this->loadModelParallel(filepath, *pool);
+				}
+				else {
+					ThreadPool importPool{ PARALLEL_IMPORT_THREADS };
+					this->loadModelParallel(filepath, importPool);
+				}
+			}
+			else {
+				this->loadModel(filepath);
+			}
+			if (options.optimize)
+				this->optimize();
+			if (options.lodLevels > 0)
+				this->generateLods(options.lodLevels, options.lodMaxError);
+			try {
+				this->writeCache(cachePath, filepath, options.cacheKey());
+			}
+			catch (const std::exception& e) {		// a read only models folder shouldn't stop loading
+				std::cerr << "Failed to write mesh cache " << cachePath << ": " << e.what() << "\n";
+			}
+		}
+		if (options.meshlets)
+			this->buildMeshlets();
+		float loadTime = std::chrono::duration<float, std::chrono::milliseconds::period>(
+			std::chrono::high_resolution_clock::now() - startTime
+		).count();
+
+		std::cout << "Loaded " << filepath << (fromCache ? " (cache)" : " (obj)") << " in " << loadTime << "ms\n";
+		std::cout << "Vertex count: " << this->vertices.size() << "\n";
+	}
 	auto Model::Builder::loadModel(const std::string& filepath) -> void {
 		tinyobj::attrib_t attrib;
 		std::vector<tinyobj::shape_t> shapes;
@@ -260,42 +613,538 @@ namespace engine {
 
 		this->vertices.clear();
 		this->indices.clear();
+		this->lods.clear();
+		this->meshlets.clear();
+
+		size_t cornerCount = 0;
+		for (const auto& shape : shapes)
+			cornerCount += shape.mesh.indices.size();
+		this->indices.reserve(cornerCount);
 
-		std::unordered_map<Vertex, uint32_t> uniqueVertices{};
+		DedupTable<Vertex> uniqueVertices{ this->vertices, cornerCount / IMPORT_CORNERS_PER_VERTEX }; // grows if the mesh has more seams than typical
 		for (const auto& shape : shapes) {
-			for (const auto& index : shape.mesh.indices) {
-				Vertex vertex{};
-				if (index.vertex_index >= 0) {
-					vertex.position = {
-						attrib.vertices[3 * index.vertex_index + 0],
-						attrib.vertices[3 * index.vertex_index + 1],
-						attrib.vertices[3 * index.vertex_index + 2]
-					};
-					vertex.color = {
-						attrib.colors[3 * index.vertex_index + 0],
-						attrib.colors[3 * index.vertex_index + 1],
-						attrib.colors[3 * index.vertex_index + 2]
-					};
+			for (const auto& index : shape.mesh.indices)
+				this->indices.push_back(uniqueVertices.insert(objVertex(attrib, index))); // appends to vertices if unseen
+		}
+		this->computeBounds();
+	}
+
+	/*
+		One slice of an obj file for the parallel import. attrib and corners hold what the slice's lines define,
+		vertices/indices are the slice's own deduplicated vertices and remap maps those into the final vertex array
+	*/
+	struct ObjImportChunk {
+		tinyobj::attrib_t attrib;
+		std::vector<tinyobj::index_t> corners;
+		std::vector<Model::Vertex> vertices;
+		std::vector<uint32_t> indices;
+		std::vector<uint32_t> remap;
+		size_t positionOffset = 0;
+		size_t normalOffset = 0;
+		size_t texcoordOffset = 0;
+		size_t cornerOffset = 0;
+		bool supported = true;
+	};
+
+	// one face corner (v, v/vt, v//vn or v/vt/vn), mirrors tinyobj's parseTriple. false for anything but positive absolute indices
+	static auto parseObjCorner(const char** token, tinyobj::index_t& index) -> bool {
+		auto parseInt = [token]() {
+			int value = std::atoi(*token);
+			*token += std::strcspn(*token, "/ \t\r");
+			return value;
+		};
+
+		int v = parseInt();
+		if (v <= 0) return false;				// relative (negative) indices depend on everything parsed before this chunk
+		index.vertex_index = v - 1;
+		if ((*token)[0] != '/') return true;	// v
+		(*token)++;
+
+		if ((*token)[0] == '/') {				// v//vn
+			(*token)++;
+			int vn = parseInt();
+			if (vn <= 0) return false;
+			index.normal_index = vn - 1;
+			return true;
+		}
+
+		int vt = parseInt();
+		if (vt <= 0) return false;
+		index.texcoord_index = vt - 1;
+		if ((*token)[0] != '/') return true;	// v/vt
+		(*token)++;
+
+		int vn = parseInt();					// v/vt/vn
+		if (vn <= 0) return false;
+		index.normal_index = vn - 1;
+		return true;
+	}
+
+	/*
+		Parses the lines in [begin, end), which has to start at a line start and end after a newline (or at the file's null terminator).
+		Lines are null terminated in place so tinyobj's own parseReal can be used, that keeps every float bit identical to LoadObj.
+		Returns false if the chunk uses something only tinyobj handles (polygons that need triangulating, relative indices)
+	*/
+	static auto parseObjChunk(char* begin, char* end, ObjImportChunk& chunk) -> bool {
+		auto isSpace = [](char c) { return c == ' ' || c == '\t'; };
+
+		char* line = begin;
+		while (line < end) {
+			char* lineEnd = line;
+			while (lineEnd < end && *lineEnd != '\n' && *lineEnd != '\r')	// tinyobj treats \n, \r\n and a lone \r as line breaks
+				lineEnd++;
+			*lineEnd = '\0';
+			const char* token = line + std::strspn(line, " \t");
+			line = lineEnd + 1;
+
+			if (token[0] == 'v' && isSpace(token[1])) {		// v x y z [r g b]
+				token += 2;
+				tinyobj::real_t x = tinyobj::parseReal(&token);
+				tinyobj::real_t y = tinyobj::parseReal(&token);
+				tinyobj::real_t z = tinyobj::parseReal(&token);
+				tinyobj::real_t r, g, b;
+				bool hasColor = tinyobj::parseReal(&token, &r) && tinyobj::parseReal(&token, &g) && tinyobj::parseReal(&token, &b);
+				if (!hasColor)
+					r = g = b = 1.0f;						// LoadObj's default vertex color
+				chunk.attrib.vertices.insert(chunk.attrib.vertices.end(), { x, y, z });
+				chunk.attrib.colors.insert(chunk.attrib.colors.end(), { r, g, b });
+			}
+			else if (token[0] == 'v' && token[1] == 'n' && isSpace(token[2])) {
+				token += 3;
+				tinyobj::real_t x = tinyobj::parseReal(&token);
+				tinyobj::real_t y = tinyobj::parseReal(&token);
+				tinyobj::real_t z = tinyobj::parseReal(&token);
+				chunk.attrib.normals.insert(chunk.attrib.normals.end(), { x, y, z });
+			}
+			else if (token[0] == 'v' && token[1] == 't' && isSpace(token[2])) {
+				token += 3;
+				tinyobj::real_t u = tinyobj::parseReal(&token);
+				tinyobj::real_t v = tinyobj::parseReal(&token);
+				chunk.attrib.texcoords.insert(chunk.attrib.texcoords.end(), { u, v });
+			}
+			else if (token[0] == 'f' && isSpace(token[1])) {
+				token += 2;
+				token += std::strspn(token, " \t");
+				int cornerCount = 0;
+				while (token[0] != '\0') {
+					tinyobj::index_t index{};
+					index.vertex_index = index.normal_index = index.texcoord_index = -1;
+					if (!parseObjCorner(&token, index) || ++cornerCount > 3)
+						return false;
+					chunk.corners.push_back(index);
+					token += std::strspn(token, " \t\r");
 				}
-				if (index.normal_index >= 0) {
-					vertex.normal = {
-						attrib.normals[3 * index.normal_index + 0],
-						attrib.normals[3 * index.normal_index + 1],
-						attrib.normals[3 * index.normal_index + 2]
-					};
+				if (cornerCount != 3) return false;
+			}
+			// everything else (groups, materials, lines, comments) doesn't affect the vertex/index output
+		}
+		return true;
+	}
+
+	/*
+		Parallel version of loadModel for large triangulated objs:
+		1) the file is split at line boundaries and each chunk is parsed on the pool
+		2) chunk attributes are concatenated so face indices resolve like in LoadObj
+		3) each chunk deduplicates its own corners with a local table
+		4) chunk vertices are merged into the final array in chunk order, then chunk indices are remapped in parallel
+		since every chunk's unique vertices are in first seen order, merging in chunk order assigns the same index to every
+		vertex as one serial pass over all corners would, so vertices and indices are byte identical to loadModel.
+		Falls back to loadModel if the file needs triangulation or uses relative indices.
+	*/
+	auto Model::Builder::loadModelParallel(const std::string& filepath, ThreadPool& pool) -> void {
+		using Clock = std::chrono::high_resolution_clock;
+		auto milliseconds = [](Clock::time_point start, Clock::time_point end) {
+			return std::chrono::duration<float, std::chrono::milliseconds::period>(end - start).count();
+		};
+		auto startTime = Clock::now();
+
+		std::vector<char> text;
+		{
+			std::ifstream file{ filepath, std::ios::binary | std::ios::ate };
+			if (!file.is_open())
+				throw std::runtime_error("failed to open " + filepath);
+			size_t fileSize = static_cast<size_t>(file.tellg());
+			text.resize(fileSize + 1);	// + null terminator so the last line is a valid c string
+			file.seekg(0);
+			if (!file.read(text.data(), fileSize))
+				throw std::runtime_error("failed to read " + filepath);
+			text[fileSize] = '\0';
+		}
+		const size_t size = text.size() - 1;
+
+		// a few chunks per thread so faces bunched at the end of the file still spread out. min 1mb so small files don't split too finely
+		const size_t chunkTarget = std::max<size_t>(size / (pool.getThreadCount() * 4), 1 << 20);
+		std::vector<size_t> bounds{ 0 };
+		while (bounds.back() < size) {
+			size_t next = std::min(bounds.back() + chunkTarget, size);
+			const char* newline = static_cast<const char*>(std::memchr(text.data() + next, '\n', size - next));
+			bounds.push_back(newline ? static_cast<size_t>(newline - text.data()) + 1 : size);
+		}
+
+		std::vector<ObjImportChunk> chunks(bounds.size() - 1);
+		pool.parallelFor(chunks.size(), [&](size_t i) {
+			chunks[i].supported = parseObjChunk(text.data() + bounds[i], text.data() + bounds[i + 1], chunks[i]);
+		});
+		text = {};
+		for (const auto& chunk : chunks) {
+			if (!chunk.supported) {
+				std::cout << "Parallel import can't handle " << filepath << " (polygons or relative indices), using tinyobj\n";
+				this->loadModel(filepath);
+				return;
+			}
+		}
+		auto parseTime = Clock::now();
+
+		tinyobj::attrib_t attrib;
+		size_t positionCount = 0, normalCount = 0, texcoordCount = 0, cornerCount = 0;
+		for (auto& chunk : chunks) {
+			chunk.positionOffset = positionCount;
+			chunk.normalOffset = normalCount;
+			chunk.texcoordOffset = texcoordCount;
+			chunk.cornerOffset = cornerCount;
+			positionCount += chunk.attrib.vertices.size();
+			normalCount += chunk.attrib.normals.size();
+			texcoordCount += chunk.attrib.texcoords.size();
+			cornerCount += chunk.corners.size();
+		}
+		attrib.vertices.resize(positionCount);
+		attrib.colors.resize(positionCount);
+		attrib.normals.resize(normalCount);
+		attrib.texcoords.resize(texcoordCount);
+		pool.parallelFor(chunks.size(), [&](size_t i) {
+			auto& chunk = chunks[i];
+			std::copy(chunk.attrib.vertices.begin(), chunk.attrib.vertices.end(), attrib.vertices.begin() + chunk.positionOffset);
+			std::copy(chunk.attrib.colors.begin(), chunk.attrib.colors.end(), attrib.colors.begin() + chunk.positionOffset);
+			std::copy(chunk.attrib.normals.begin(), chunk.attrib.normals.end(), attrib.normals.begin() + chunk.normalOffset);
+			std::copy(chunk.attrib.texcoords.begin(), chunk.attrib.texcoords.end(), attrib.texcoords.begin() + chunk.texcoordOffset);
+			chunk.attrib = {};
+		});
+
+		pool.parallelFor(chunks.size(), [&](size_t i) {
+			auto inRange = [](int index, size_t stride, size_t size) {
+				return index < 0 || static_cast<size_t>(index) * stride < size;
+			};
+			auto& chunk = chunks[i];
+			chunk.indices.reserve(chunk.corners.size());
+			DedupTable<Vertex> uniqueVertices{ chunk.vertices, chunk.corners.size() / IMPORT_CORNERS_PER_VERTEX };
+			for (const auto& index : chunk.corners) {
+				if (
+					!inRange(index.vertex_index, 3, positionCount) ||
+					!inRange(index.normal_index, 3, normalCount) ||
+					!inRange(index.texcoord_index, 2, texcoordCount)
+				) {
+					throw std::runtime_error("face index out of range in " + filepath);
 				}
-				if (index.texcoord_index >= 0) {
-					vertex.uv = {
-						attrib.texcoords[2 * index.texcoord_index + 0],
-						attrib.texcoords[2 * index.texcoord_index + 1]
-					};
+				chunk.indices.push_back(uniqueVertices.insert(objVertex(attrib, index)));
+			}
+			chunk.corners = {};
+		});
+		auto dedupTime = Clock::now();
+
+		size_t chunkVertexCount = 0;
+		for (const auto& chunk : chunks)
+			chunkVertexCount += chunk.vertices.size();
+
+		this->vertices.clear();
+		this->lods.clear();
+		this->meshlets.clear();
+		DedupTable<Vertex> uniqueVertices{ this->vertices, chunkVertexCount };	// only serial step, one insert per chunk-unique vertex
+		for (auto& chunk : chunks) {
+			chunk.remap.resize(chunk.vertices.size());
+			for (size_t v = 0; v < chunk.vertices.size(); v++)
+				chunk.remap[v] = uniqueVertices.insert(chunk.vertices[v]);
+			chunk.vertices = {};
+		}
+
+		this->indices.resize(cornerCount);
+		pool.parallelFor(chunks.size(), [&](size_t i) {
+			const auto& chunk = chunks[i];
+			for (size_t c = 0; c < chunk.indices.size(); c++)
+				this->indices[chunk.cornerOffset + c] = chunk.remap[chunk.indices[c]];
+		});
+		this->computeBounds();
+		auto endTime = Clock::now();
+
+		std::cout << "Parallel import: " << pool.getThreadCount() << " threads, " << chunks.size() << " chunks, "
+			<< "parse " << milliseconds(startTime, parseTime) << "ms, "
+			<< "dedup " << milliseconds(parseTime, dedupTime) << "ms, "
+			<< "merge " << milliseconds(dedupTime, endTime) << "ms\n";
+
+	}
+	auto Model::Builder::computeBounds() -> void {
+		if (this->vertices.empty()) {
+			this->boundsMin = this->boundsMax = glm::vec3{ 0.0f };
+			return;
+		}
+		this->boundsMin = this->boundsMax = this->vertices[0].position;
+		for (const auto& vertex : this->vertices) {
+			this->boundsMin = glm::min(this->boundsMin, vertex.position);
+			this->boundsMax = glm::max(this->boundsMax, vertex.position);
+		}
+	}
+
+	auto Model::Builder::optimize() -> void {
+		VertexCacheStats before = analyzeVertexCache(this->indices, this->vertices.size());
+		optimizeVertexCache(this->indices, this->vertices.size());	// order matters: overdraw clusters come from the cache friendly order
+		optimizeOverdraw(this->indices, this->vertices);
+		optimizeVertexFetch(this->vertices, this->indices);		// last, it only renumbers and keeps the triangle order
+		VertexCacheStats after = analyzeVertexCache(this->indices, this->vertices.size());
+
+		std::cout << "Vertex cache (fifo " << VERTEX_CACHE_ANALYZE_SIZE << "): "
+			<< "ACMR " << before.acmr << " -> " << after.acmr << ", "
+			<< "ATVR " << before.atvr << " -> " << after.atvr << "\n";
+	}
+
+	auto Model::Builder::generateLods(uint32_t levelCount, float maxError) -> void {
+		const float radius = glm::length(this->boundsMax - this->boundsMin) * 0.5f;
+		this->lods.clear();
+
+		float error = 0.0f;
+		for (uint32_t level = 0; level < levelCount; level++) {
+			const float remainingError = maxError * radius - error;
+			if (remainingError <= 0.0f) break;
+			const std::vector<uint32_t>& previous = this->lods.empty() ? this->indices : this->lods.back().indices;
+			size_t target = previous.size() / 6 * 3;	// half the triangles
+			float levelError;
+			std::vector<uint32_t> simplified = simplifyMesh(this->vertices, previous, target, remainingError, &levelError);
+			if (simplified.empty() || simplified.size() * 10 > previous.size() * 9) break;	// under 10% fewer triangles, the error bound (or locked seams) stopped it
+
+			error += levelError;	// each level simplifies the previous one, so errors add up
+			optimizeVertexCache(simplified, this->vertices.size());
+			this->lods.push_back({ std::move(simplified), error });
+		}
+
+		std::cout << "LODs: " << this->indices.size() / 3;
+		for (const auto& lod : this->lods)
+			std::cout << " -> " << lod.indices.size() / 3;
+		std::cout << " triangles\n";
+	}
+
+	auto Model::Builder::buildMeshlets(uint32_t maxVertices, uint32_t maxTriangles) -> void {
+		this->meshlets = engine::buildMeshlets(this->vertices, this->indices, maxVertices, maxTriangles);
+		this->closed = isClosedMesh(this->vertices, this->indices);
+
+		uint32_t coneCount = 0;
+		for (const auto& meshlet : this->meshlets)
+			coneCount += meshlet.cone.w < 1.0f;
+		std::cout << "Meshlets: " << this->meshlets.size() << " for " << this->indices.size() / 3 << " triangles, "
+			<< coneCount << " with a usable normal cone" << (this->closed ? "\n" : ", open mesh so they're not cone culled\n");
+	}
+
+	auto Model::Builder::subdivide(uint32_t levels) -> void {
+		this->lods.clear();		// they index the old triangles
+		this->meshlets.clear();
+		for (uint32_t level = 0; level < levels; level++) {
+			// one midpoint vertex per edge, shared by the two triangles on it. vertices split at seams get separate (coincident) midpoints
+			std::vector<uint64_t> edges;
+			DedupTable<uint64_t> edgeTable{ edges, this->indices.size() };
+			const uint32_t baseVertex = static_cast<uint32_t>(this->vertices.size());
+			auto midpoint = [&](uint32_t a, uint32_t b) -> uint32_t {
+				uint64_t key = (static_cast<uint64_t>(std::min(a, b)) << 32) | std::max(a, b);
+				size_t before = edges.size();
+				uint32_t edge = edgeTable.insert(key);
+				if (edges.size() != before) {
+					const Vertex& va = this->vertices[a];
+					const Vertex& vb = this->vertices[b];
+					Vertex vertex{};
+					vertex.position = (va.position + vb.position) * 0.5f;
+					vertex.color = (va.color + vb.color) * 0.5f;
+					vertex.normal = va.normal + vb.normal;
+					float length = glm::length(vertex.normal);
+					vertex.normal = length > 0.0f ? vertex.normal / length : va.normal;
+					vertex.uv = (va.uv + vb.uv) * 0.5f;
+					this->vertices.push_back(vertex);
 				}
+				return baseVertex + edge;
+			};
+
+			std::vector<uint32_t> subdivided;
+			subdivided.reserve(this->indices.size() * 4);
+			for (size_t i = 0; i + 2 < this->indices.size(); i += 3) {
+				uint32_t a = this->indices[i], b = this->indices[i + 1], c = this->indices[i + 2];
+				uint32_t ab = midpoint(a, b), bc = midpoint(b, c), ca = midpoint(c, a);
+				uint32_t triangles[] = { a, ab, ca,  ab, b, bc,  ca, bc, c,  ab, bc, ca };	// same winding as the parent
+				subdivided.insert(subdivided.end(), std::begin(triangles), std::end(triangles));
+			}
+			this->indices = std::move(subdivided);
+		}
+	}
+
+	// imports the file through tinyobj and through the chunked parser and holds the parallel path to its promise of byte identical output
+	auto Model::Builder::checkParallelImport(const std::string& filepath) -> void {
+		ThreadPool pool{};
+		Builder parallel{};
+		parallel.loadModelParallel(filepath, pool);
+		Builder serial{};
+		serial.loadModel(filepath);
+		if (
+			serial.vertices.size() != parallel.vertices.size() ||
+			std::memcmp(serial.vertices.data(), parallel.vertices.data(), sizeof(Vertex) * parallel.vertices.size()) != 0 ||
+			serial.indices != parallel.indices
+		) {
+			throw std::runtime_error("parallel import of " + filepath + " doesn't match the serial import");
+		}
+		std::cout << "Parallel import of " << filepath << " matches the serial import byte for byte\n";
+	}
+
+	/*
+		Replays the corner stream an obj import deduplicates (every face corner's full vertex, subdivided so it's large enough to time)
+		through the old std::unordered_map count/operator[] loop and through DedupTable, and logs time and table memory for each
+	*/
+	auto Model::Builder::benchmarkDedup(const std::string& filepath, uint32_t subdivideLevels) -> void {
+		using Clock = std::chrono::high_resolution_clock;
+		auto milliseconds = [](Clock::time_point start, Clock::time_point end) {
+			return std::chrono::duration<float, std::chrono::milliseconds::period>(end - start).count();
+		};
+
+		Builder source{};
+		source.loadModel(filepath);
+		source.subdivide(subdivideLevels);
+		std::vector<Vertex> corners;
+		corners.reserve(source.indices.size());
+		for (uint32_t index : source.indices)
+			corners.push_back(source.vertices[index]);
+
+		std::vector<Vertex> mapVertices;
+		std::vector<uint32_t> mapIndices;
+		mapIndices.reserve(corners.size());
+		auto mapStart = Clock::now();
+		{
+			std::unordered_map<Vertex, uint32_t> uniqueVertices{};
+			for (const auto& vertex : corners) {
 				if (uniqueVertices.count(vertex) == 0) {
-					uniqueVertices[vertex] = static_cast<uint32_t>(this->vertices.size());
-					this->vertices.push_back(vertex);
+					uniqueVertices[vertex] = static_cast<uint32_t>(mapVertices.size());
+					mapVertices.push_back(vertex);
 				}
-				this->indices.push_back(uniqueVertices[vertex]);
+				mapIndices.push_back(uniqueVertices[vertex]);
+			}
+		}
+		auto mapEnd = Clock::now();
+
+		auto runTable = [&](const char* name, size_t expectedCount) {
+			std::vector<Vertex> tableVertices;
+			std::vector<uint32_t> tableIndices;
+			tableIndices.reserve(corners.size());
+			auto start = Clock::now();
+			DedupTable<Vertex> uniqueVertices{ tableVertices, expectedCount };
+			for (const auto& vertex : corners)
+				tableIndices.push_back(uniqueVertices.insert(vertex));
+			auto end = Clock::now();
+			if (tableVertices.size() != mapVertices.size() || tableIndices != mapIndices)	// both assign indices in first seen order
+				throw std::runtime_error("dedup benchmark: DedupTable and std::unordered_map disagree");
+			std::cout << "  DedupTable, " << name << ": " << milliseconds(start, end) << "ms, "
+				<< uniqueVertices.memoryUsage() / 1024 << "KB of slots\n";
+		};
+
+		std::cout << "dedup benchmark, " << filepath << " subdivided " << subdivideLevels << "x: " << corners.size() << " corners, "
+			<< mapVertices.size() << " unique vertices (" << static_cast<float>(corners.size()) / std::max<size_t>(1, mapVertices.size()) << " corners per vertex)\n";
+		std::cout << "  std::unordered_map: " << milliseconds(mapStart, mapEnd) << "ms\n";
+		runTable("unsized", 0);
+		runTable("sized from corners / IMPORT_CORNERS_PER_VERTEX", corners.size() / IMPORT_CORNERS_PER_VERTEX);
+	}
+
+	// source file size and modification time, used to detect a stale cache
+	static auto meshCacheSourceStamp(const std::string& sourcePath, uint64_t& size, int64_t& writeTime) -> bool {
+		std::error_code ec;
+		size = static_cast<uint64_t>(std::filesystem::file_size(sourcePath, ec));
+		if (ec) return false;
+		writeTime = static_cast<int64_t>(std::filesystem::last_write_time(sourcePath, ec).time_since_epoch().count());
+		return !ec;
+	}
+
+	/*
+		Fills vertices, indices and bounds from a mesh cache. returns false (and leaves the builder empty)
+		if the cache is missing, from another version, older than the source obj, or its counts don't add up to its size
+	*/
+	auto Model::Builder::loadCache(const std::string& cachePath, const std::string& sourcePath, uint32_t importKey) -> bool {
+		std::ifstream file{ cachePath, std::ios::binary };
+		if (!file.is_open()) return false;
+		std::error_code ec;
+		const uint64_t cacheSize = static_cast<uint64_t>(std::filesystem::file_size(cachePath, ec));
+		if (ec) return false;
+
+		uint64_t sourceSize;
+		int64_t sourceWriteTime;
+		if (!meshCacheSourceStamp(sourcePath, sourceSize, sourceWriteTime)) return false;
+
+		MeshCacheHeader header{};
+		if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))) return false;
+		if (
+			header.magic != MESH_CACHE_MAGIC ||
+			header.version != MESH_CACHE_VERSION ||
+			header.vertexSize != sizeof(Vertex) ||
+			header.importKey != importKey ||
+			header.sourceSize != sourceSize ||
+			header.sourceWriteTime != sourceWriteTime
+		) {
+			return false;
+		}
+		// the counts size the allocations below, so a corrupt or truncated cache must not get past here
+		uint64_t expectedSize = sizeof(MeshCacheHeader) +
+			static_cast<uint64_t>(sizeof(Vertex)) * header.vertexCount +
+			static_cast<uint64_t>(sizeof(uint32_t)) * header.indexCount +
+			static_cast<uint64_t>(sizeof(MeshCacheLod)) * header.lodCount;
+		if (expectedSize > cacheSize) return false;
+
+		this->vertices.resize(header.vertexCount);
+		this->indices.resize(header.indexCount);
+		bool complete = // single read per array straight into the builder's storage, no parsing or dedup
+			file.read(reinterpret_cast<char*>(this->vertices.data()), sizeof(Vertex) * header.vertexCount) &&
+			file.read(reinterpret_cast<char*>(this->indices.data()), sizeof(uint32_t) * header.indexCount);
+		std::vector<MeshCacheLod> lodTable(header.lodCount);
+		complete = complete && file.read(reinterpret_cast<char*>(lodTable.data()), sizeof(MeshCacheLod) * header.lodCount);
+		for (uint32_t i = 0; i < header.lodCount && complete; i++)
+			expectedSize += static_cast<uint64_t>(sizeof(uint32_t)) * lodTable[i].indexCount;
+		complete = complete && expectedSize == cacheSize;
+		this->lods.resize(header.lodCount);
+		for (uint32_t i = 0; i < header.lodCount && complete; i++) {
+			this->lods[i].error = lodTable[i].error;
+			this->lods[i].indices.resize(lodTable[i].indexCount);
+			complete = static_cast<bool>(file.read(reinterpret_cast<char*>(this->lods[i].indices.data()), sizeof(uint32_t) * lodTable[i].indexCount));
+		}
+		if (!complete) {	// truncated or corrupt file
+			this->vertices.clear();
+			this->indices.clear();
+			this->lods.clear();
+			return false;
+		}
+		this->boundsMin = header.boundsMin;
+		this->boundsMax = header.boundsMax;
+		this->meshlets.clear();	// not cached, rebuilt from the loaded indices if wanted
+		return true;
+	}
+	auto Model::Builder::writeCache(const std::string& cachePath, const std::string& sourcePath, uint32_t importKey) const -> void {
+		MeshCacheHeader header{};
+		header.magic = MESH_CACHE_MAGIC;
+		header.version = MESH_CACHE_VERSION;
+		header.importKey = importKey;
+		header.vertexSize = sizeof(Vertex);
+		header.vertexCount = static_cast<uint32_t>(this->vertices.size());
+		header.indexCount = static_cast<uint32_t>(this->indices.size());
+		header.boundsMin = this->boundsMin;
+		header.boundsMax = this->boundsMax;
+		header.lodCount = static_cast<uint32_t>(this->lods.size());
+		if (!meshCacheSourceStamp(sourcePath, header.sourceSize, header.sourceWriteTime))
+			throw std::runtime_error("failed to stat " + sourcePath);
+
+		// write then rename, so an interrupted write never leaves a half cache behind. per thread name so concurrent imports don't share the file
+		const std::string tempPath = cachePath + ".tmp" + std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id()) & 0xffff);
+		{
+			std::ofstream file{ tempPath, std::ios::binary | std::ios::trunc };
+			if (!file.is_open())
+				throw std::runtime_error("failed to open " + tempPath);
+			file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			file.write(reinterpret_cast<const char*>(this->vertices.data()), sizeof(Vertex) * this->vertices.size());
+			file.write(reinterpret_cast<const char*>(this->indices.data()), sizeof(uint32_t) * this->indices.size());
+			for (const auto& lod : this->lods) {
+				MeshCacheLod entry{ static_cast<uint32_t>(lod.indices.size()), lod.error };
+				file.write(reinterpret_cast<const char*>(&entry), sizeof(entry));
 			}
+			for (const auto& lod : this->lods)
+				file.write(reinterpret_cast<const char*>(lod.indices.data()), sizeof(uint32_t) * lod.indices.size());
+			if (!file)
+				throw std::runtime_error("failed to write " + tempPath);
 		}
+		std::filesystem::rename(tempPath, cachePath);
 	}
 }
@@ -0,0 +1,259 @@
+#pragma once
+
+#include "Device.hpp"
+#include "Model.hpp"
+#include "GameObject.hpp"
+#include "ThreadPool.hpp"
+#include "ModelRegistry.hpp"
+
+#include <memory>
+#include <vector>
+#include <string>
+#include <future>
+#include <atomic>
+#include <exception>
+#include <stdexcept>
+#include <iostream>
+#include <chrono>
+
+namespace engine {
+	constexpr VkDeviceSize MODEL_UPLOAD_BUDGET = 32 * 1024 * 1024;	// staged bytes per update() before the rest waits a frame (always at least one model)
+
+	/*
+		Result of ModelLoader::load. get() is nullptr until the model's buffers are on the gpu, then the model for good.
+		cheap to copy, all copies see the same load
+	*/
+	class ModelHandle {
+		struct State {
+			std::string filepath;
+			std::shared_ptr<Model> model;	// written by the loader's thread before ready is set
+			std::exception_ptr error;
+			std::atomic<bool> ready{ false };
+		};
+		std::shared_ptr<State> state;
+
+		friend class ModelLoader;
+	public:
+		auto valid() const -> bool { return this->state != nullptr; }
+		auto isReady() const -> bool { return this->state->ready.load(std::memory_order_acquire); }	// uploaded, or failed
+		auto failed() const -> bool { return this->isReady() && this->state->error != nullptr; }
+		auto get() const -> std::shared_ptr<Model>;		// nullptr until ready, rethrows the import error if it failed
+		auto getFilepath() const -> const std::string& { return this->state->filepath; }
+	};
+
+	/*
+		Loads models without stalling the frame loop:
+		1) load() queues Model::Builder::importModel on the pool (cache read or obj parse, optimize, lods... no vulkan)
+		2) update(), once a frame on the main thread, creates the models whose import finished, their buffer copies go into
+		   the device's UploadBatcher which is submitted right after. at most MODEL_UPLOAD_BUDGET bytes are staged per frame
+		3) later update() calls poll the batch tickets, the models become ready once their copies completed, and are swapped into the game objects
+		   registered with bindWhenReady. until then those objects keep whatever model they had (a placeholder, or nullptr to stay hidden)
+		with a ModelRegistry, loads of a file that is already loaded (or loading) share that model instead of importing it again
+
+		usage:
+			ModelLoader loader{ device };
+			auto vase = GameObject::createGameObject();
+			loader.bindWhenReady(vase.getId(), loader.load("models/smooth_vase.obj"));
+			...
+			loader.update(gameObjects);	// every frame, outside any command buffer recording on the graphics queue
+	*/
+	class ModelLoader {
+		Device& device;
+		ThreadPool pool;
+		VkDeviceSize uploadBudget;
+		ModelRegistry* registry;
+
+		struct Request {
+			std::shared_ptr<ModelHandle::State> state;
+			std::string registryKey;				// empty without a registry
+			VertexFormat vertexFormat;
+			std::future<Model::Builder> builder;
+		};
+		struct Submission {
+			ModelUploadBatch batch;
+			std::vector<std::pair<Request, std::shared_ptr<Model>>> models;
+		};
+		struct SharedLoad {							// waiting on a registry load started elsewhere
+			std::shared_ptr<ModelHandle::State> state;
+			ModelRegistry::ModelFuture model;
+		};
+		struct Binding {
+			GameObject::id_t objectId;
+			ModelHandle handle;
+		};
+		std::vector<Request> importing;
+		std::vector<Submission> uploading;
+		std::vector<SharedLoad> sharing;
+		std::vector<Binding> bindings;
+
+		auto completeUploads(bool wait) -> void;
+		auto completeSharedLoads(bool wait) -> void;
+		auto finish(ModelHandle::State& state, std::shared_ptr<Model> model, std::exception_ptr error) -> void;
+		auto startUploads(bool wait) -> void;
+		auto applyBindings(GameObject::Map& gameObjects) -> void;
+	public:
+		ModelLoader(Device& device, ModelRegistry* registry = nullptr, size_t threadCount = 0, VkDeviceSize uploadBudget = MODEL_UPLOAD_BUDGET);	// 0 threads = one per core
+		~ModelLoader();
+
+		ModelLoader(const ModelLoader&) = delete;
+		ModelLoader& operator=(const ModelLoader&) = delete;
+
+		auto load(const std::string& filepath, const ModelImportOptions& options = {}) -> ModelHandle;
+		auto bindWhenReady(GameObject::id_t objectId, ModelHandle handle) -> void;	// sets the object's model once ready, skipped if the object is gone by then
+
+		auto update(GameObject::Map& gameObjects) -> void;
+		auto waitIdle(GameObject::Map& gameObjects) -> void;	// blocks until every queued load is ready and bound, for loading screens
+		auto getPendingCount() const -> size_t {	// 0 once every load is uploaded and bound
+			return this->importing.size() + this->uploading.size() + this->sharing.size() + this->bindings.size();
+		}
+	};
+
+	auto ModelHandle::get() const -> std::shared_ptr<Model> {
+		if (!this->isReady()) return nullptr;
+		if (this->state->error)
+			std::rethrow_exception(this->state->error);
+		return this->state->model;
+	}
+
+	ModelLoader::ModelLoader(Device& device, ModelRegistry* registry, size_t threadCount, VkDeviceSize uploadBudget) :
+		device{ device }, pool{ threadCount }, uploadBudget{ uploadBudget }, registry{ registry }
+	{}
+	ModelLoader::~ModelLoader() {
+		for (auto& request : this->importing) {	// let running imports finish, their results are dropped
+			if (request.builder.valid())
+				request.builder.wait();
+			if (this->registry && !request.registryKey.empty())	// anyone sharing this load would wait forever otherwise
+				this->registry->fail(request.registryKey, std::make_exception_ptr(std::runtime_error("model loader destroyed")));
+		}
+		this->completeUploads(true);
+	}
+
+	auto ModelLoader::load(const std::string& filepath, const ModelImportOptions& options) -> ModelHandle {
+		ModelHandle handle{};
+		handle.state = std::make_shared<ModelHandle::State>();
+		handle.state->filepath = filepath;
+
+		std::string registryKey;
+		if (this->registry) {
+			registryKey = ModelRegistry::makeKey(filepath, options);
+			ModelRegistry::Reservation reservation = this->registry->reserve(registryKey);
+			if (reservation.model) {
+				this->finish(*handle.state, std::move(reservation.model), nullptr);
+				return handle;
+			}
+			if (reservation.pending.valid()) {
+				this->sharing.push_back({ handle.state, std::move(reservation.pending) });
+				return handle;
+			}
+		}
+
+		ThreadPool* importPool = &this->pool;	// large objs are split across the same workers
+		auto builder = this->pool.submit([filepath, options, importPool] {
+			Model::Builder builder{};
+			builder.importModel(filepath, options, importPool);
+			return builder;
+		});
+		this->importing.push_back({ handle.state, std::move(registryKey), options.vertexFormat, std::move(builder) });
+		return handle;
+	}
+	auto ModelLoader::bindWhenReady(GameObject::id_t objectId, ModelHandle handle) -> void {
+		assert(handle.valid() && "Cannot bind an empty model handle");
+		this->bindings.push_back({ objectId, std::move(handle) });
+	}
+
+	auto ModelLoader::update(GameObject::Map& gameObjects) -> void {
+		this->completeUploads(false);
+		this->completeSharedLoads(false);
+		this->startUploads(false);
+		this->applyBindings(gameObjects);
+	}
+	auto ModelLoader::waitIdle(GameObject::Map& gameObjects) -> void {
+		while (!this->importing.empty())
+			this->startUploads(true);
+		this->completeUploads(true);
+		this->completeSharedLoads(true);
+		this->applyBindings(gameObjects);
+	}
+
+	// creates models for finished imports until the upload budget is used up, all in one submission
+	auto ModelLoader::startUploads(bool wait) -> void {
+		Submission submission{};
+		for (size_t i = 0; i < this->importing.size();) {
+			Request& request = this->importing[i];
+			if (!wait && request.builder.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+				i++;
+				continue;
+			}
+
+			try {
+				Model::Builder builder = request.builder.get();
+				auto model = std::make_shared<Model>(this->device, builder, request.vertexFormat, &submission.batch);
+				submission.models.emplace_back(std::move(request), std::move(model));
+			}
+			catch (...) {	// import failed, the handle reports it
+				std::cerr << "Failed to load " << request.state->filepath << "\n";
+				if (this->registry && !request.registryKey.empty())
+					this->registry->fail(request.registryKey, std::current_exception());
+				this->finish(*request.state, nullptr, std::current_exception());
+			}
+			this->importing.erase(this->importing.begin() + i);
+			if (submission.batch.stagedSize >= this->uploadBudget) break;
+		}
+		if (submission.models.empty()) return;
+
+		this->device.uploadBatcher().submit();	// the batch may hold other copies too, the ticket is the same
+		this->uploading.push_back(std::move(submission));
+	}
+	auto ModelLoader::completeUploads(bool wait) -> void {
+		for (size_t i = 0; i < this->uploading.size();) {
+			Submission& submission = this->uploading[i];
+			if (wait)
+				this->device.uploadBatcher().wait(submission.batch.ticket);
+			else if (!this->device.uploadBatcher().isComplete(submission.batch.ticket)) {
+				i++;
+				continue;
+			}
+
+			for (auto& [request, model] : submission.models) {
+				if (this->registry && !request.registryKey.empty())
+					this->registry->complete(request.registryKey, model);
+				this->finish(*request.state, std::move(model), nullptr);
+			}
+			this->uploading.erase(this->uploading.begin() + i);
+		}
+	}
+	auto ModelLoader::completeSharedLoads(bool wait) -> void {
+		for (size_t i = 0; i < this->sharing.size();) {
+			SharedLoad& load = this->sharing[i];
+			if (!wait && load.model.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+				i++;
+				continue;
+			}
+			try {
+				this->finish(*load.state, load.model.get(), nullptr);
+			}
+			catch (...) {
+				this->finish(*load.state, nullptr, std::current_exception());
+			}
+			this->sharing.erase(this->sharing.begin() + i);
+		}
+	}
+	auto ModelLoader::finish(ModelHandle::State& state, std::shared_ptr<Model> model, std::exception_ptr error) -> void {
+		state.model = std::move(model);
+		state.error = error;
+		state.ready.store(true, std::memory_order_release);
+	}
+	auto ModelLoader::applyBindings(GameObject::Map& gameObjects) -> void {
+		for (size_t i = 0; i < this->bindings.size();) {
+			Binding& binding = this->bindings[i];
+			if (!binding.handle.isReady()) {
+				i++;
+				continue;
+			}
+			auto object = gameObjects.find(binding.objectId);
+			if (object != gameObjects.end() && !binding.handle.failed())
+				object->second.model = binding.handle.state->model;
+			this->bindings.erase(this->bindings.begin() + i);
+		}
+	}
+}
@@ -0,0 +1,182 @@
+#pragma once
+
+#include "Device.hpp"
+#include "Model.hpp"
+#include "DedupTable.hpp"
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <mutex>
+#include <future>
+#include <exception>
+#include <filesystem>
+#include <cassert>
+#include <cstdio>
+
+namespace engine {
+	struct ModelRegistryStats {
+		uint64_t hits = 0;			// served a live model, or joined a load already in flight
+		uint64_t misses = 0;		// had to import
+		uint64_t expired = 0;		// entries dropped after every user released the model
+		size_t liveModels = 0;
+	};
+
+	/*
+		Shares Models between everything that asks for the same file with the same import options.
+		entries only hold weak references, so a mesh is freed once the last GameObject using it lets go, and loads it again on the next request.
+		reserve, complete, fail and getStats are thread safe. a key being loaded on one thread makes other requests for it wait for
+		(or poll) that load instead of importing the file again.
+		load() uploads and waits for the upload like Model::createModelFromFile, which submits to the device queues, so it only runs on
+		the thread that submits frames. loader threads go through ModelLoader, which imports off thread and uploads on the frame thread.
+
+		usage:
+			ModelRegistry registry{};
+			obj.model = registry.load(device, "models/smooth_vase.obj");	// parsed and uploaded once, however many objects ask
+		or pass it to ModelLoader to share async loads the same way
+	*/
+	class ModelRegistry {
+	public:
+		using ModelFuture = std::shared_future<std::shared_ptr<Model>>;
+		using ModelPromise = std::promise<std::shared_ptr<Model>>;
+
+		struct Reservation {				// exactly one member is set
+			std::shared_ptr<Model> model;	// hit, already loaded
+			ModelFuture pending;			// hit, someone else is loading it
+			std::shared_ptr<ModelPromise> promise;	// miss, the caller loads it and must call complete() or fail()
+		};
+
+		ModelRegistry() = default;
+		ModelRegistry(const ModelRegistry&) = delete;
+		ModelRegistry& operator=(const ModelRegistry&) = delete;
+
+		static auto makeKey(const std::string& filepath, const ModelImportOptions& options) -> std::string;
+
+		auto reserve(const std::string& key) -> Reservation;
+		auto complete(const std::string& key, const std::shared_ptr<Model>& model) -> void;
+		auto fail(const std::string& key, std::exception_ptr error) -> void;
+
+		auto load(Device& device, const std::string& filepath, const ModelImportOptions& options = {}) -> std::shared_ptr<Model>;	// blocking, frame thread only
+		auto getStats() const -> ModelRegistryStats;
+
+	private:
+		struct Entry {
+			std::weak_ptr<Model> model;
+			ModelFuture pending;					// valid while a load is in flight
+			std::shared_ptr<ModelPromise> promise;
+		};
+
+		mutable std::mutex mutex;
+		std::unordered_map<std::string, Entry> entries;
+		ModelRegistryStats stats{};
+		size_t sweepThreshold = 64;				// entry count that triggers dropping expired entries, doubles with the live set
+
+		auto sweepExpired() -> void;
+	};
+
+	// canonical path so "models/../models/vase.obj" and "models/vase.obj" match, plus everything in the options that changes the Model
+	auto ModelRegistry::makeKey(const std::string& filepath, const ModelImportOptions& options) -> std::string {
+		std::error_code ec;
+		std::filesystem::path canonical = std::filesystem::weakly_canonical(filepath, ec);
+		struct {
+			uint32_t importKey;
+			uint32_t vertexFormat;
+			uint32_t meshlets;
+		} key{ options.cacheKey(), static_cast<uint32_t>(options.vertexFormat), options.meshlets ? 1u : 0u };
+
+		char suffix[20];
+		std::snprintf(suffix, sizeof(suffix), "|%016llx", static_cast<unsigned long long>(hashBytes(&key, sizeof(key))));
+		return (ec ? filepath : canonical.generic_string()) + suffix;
+	}
+
+	auto ModelRegistry::reserve(const std::string& key) -> Reservation {
+		std::lock_guard<std::mutex> lock{ this->mutex };
+		Entry& entry = this->entries[key];
+
+		Reservation reservation{};
+		if ((reservation.model = entry.model.lock())) {
+			this->stats.hits++;
+			return reservation;
+		}
+		if (entry.pending.valid()) {
+			this->stats.hits++;
+			reservation.pending = entry.pending;
+			return reservation;
+		}
+
+		this->stats.misses++;
+		entry.promise = std::make_shared<ModelPromise>();
+		entry.pending = entry.promise->get_future().share();
+		reservation.promise = entry.promise;
+		if (this->entries.size() >= this->sweepThreshold)
+			this->sweepExpired();
+		return reservation;
+	}
+	auto ModelRegistry::complete(const std::string& key, const std::shared_ptr<Model>& model) -> void {
+		std::shared_ptr<ModelPromise> promise;
+		{
+			std::lock_guard<std::mutex> lock{ this->mutex };
+			Entry& entry = this->entries[key];
+			entry.model = model;
+			entry.pending = {};
+			promise = std::move(entry.promise);
+		}
+		if (promise)
+			promise->set_value(model);	// outside the lock, waiters may call back in
+	}
+	auto ModelRegistry::fail(const std::string& key, std::exception_ptr error) -> void {
+		std::shared_ptr<ModelPromise> promise;
+		{
+			std::lock_guard<std::mutex> lock{ this->mutex };
+			auto found = this->entries.find(key);
+			if (found == this->entries.end()) return;
+			promise = std::move(found->second.promise);
+			this->entries.erase(found);		// the next request tries again
+		}
+		if (promise)
+			promise->set_exception(error);
+	}
+
+	auto ModelRegistry::load(Device& device, const std::string& filepath, const ModelImportOptions& options) -> std::shared_ptr<Model> {
+		assert(device.uploadBatcher().onQueueThread() && "ModelRegistry::load waits on uploads, use ModelLoader from other threads");
+		const std::string key = makeKey(filepath, options);
+		Reservation reservation = this->reserve(key);
+		if (reservation.model)
+			return reservation.model;
+		if (reservation.pending.valid())
+			return reservation.pending.get();	// rethrows if that load failed
+
+		try {
+			std::shared_ptr<Model> model = Model::createModelFromFile(device, filepath, options);
+			this->complete(key, model);
+			return model;
+		}
+		catch (...) {
+			this->fail(key, std::current_exception());
+			throw;
+		}
+	}
+
+	auto ModelRegistry::getStats() const -> ModelRegistryStats {
+		std::lock_guard<std::mutex> lock{ this->mutex };
+		ModelRegistryStats result = this->stats;
+		result.liveModels = 0;
+		for (const auto& [key, entry] : this->entries)
+			result.liveModels += !entry.model.expired();
+		return result;
+	}
+
+	// caller holds the mutex
+	auto ModelRegistry::sweepExpired() -> void {
+		for (auto it = this->entries.begin(); it != this->entries.end();) {
+			if (it->second.model.expired() && !it->second.pending.valid()) {
+				it = this->entries.erase(it);
+				this->stats.expired++;
+			}
+			else {
+				it++;
+			}
+		}
+		this->sweepThreshold = std::max<size_t>(64, this->entries.size() * 2);
+	}
+}
@@ -0,0 +1,268 @@
+#pragma once
+
+#include "Device.hpp"
+#include "Buffer.hpp"
+#include "SwapChain.hpp"
+
+#include <vector>
+#include <array>
+#include <cstring>
+#include <stdexcept>
+
+namespace engine {
+	/*
+		Stands in for the SwapChain when rendering headless. every frame in flight gets its own device local color and depth image,
+		so there is nothing to acquire or present: the frame slot is the image index and a frame is done once its FrameTimeline
+		value has signaled. the color image ends the render pass in TRANSFER_SRC_OPTIMAL for readPixels.
+		mirrors the parts of SwapChain the Renderer uses, so render systems built on getRenderPass() work on either unchanged
+	*/
+	class OffscreenTarget {
+		Device& device;
+		VkExtent2D extent;
+		uint32_t framesInFlight;
+		VkFormat colorFormat = VK_FORMAT_R8G8B8A8_SRGB;	// same color space as the swap chain's B8G8R8A8_SRGB, byte order easier to save
+		VkFormat depthFormat;
+		VkRenderPass renderPass;
+
+		std::vector<VkImage> colorImages;
+		std::vector<Allocation> colorMemory;
+		std::vector<VkImageView> colorViews;
+		std::vector<VkImage> depthImages;
+		std::vector<Allocation> depthMemory;
+		std::vector<VkImageView> depthViews;
+		std::vector<VkFramebuffer> framebuffers;
+
+		std::vector<uint64_t> frameValues;	// FrameTimeline value of each slot's last submission
+		uint32_t currentFrame = 0;
+		uint32_t lastFrame = 0;				// slot of the latest submission
+
+		auto createRenderPass() -> void;
+		auto createImages() -> void;
+		auto createImage(VkFormat, VkImageUsageFlags, VkImageAspectFlags, VkImage&, Allocation&, VkImageView&, VkMemoryPropertyFlags preferred) -> void;
+	public:
+		OffscreenTarget(Device& device, VkExtent2D extent, uint32_t framesInFlight = SwapChain::DEFAULT_FRAMES_IN_FLIGHT);
+		~OffscreenTarget();
+
+		OffscreenTarget(const OffscreenTarget&) = delete;
+		OffscreenTarget& operator=(const OffscreenTarget&) = delete;
+
+		auto getRenderPass() const -> VkRenderPass { return this->renderPass; }
+		auto getFrameBuffer(uint32_t index) const -> VkFramebuffer { return this->framebuffers[index]; }
+		auto getExtent() const -> VkExtent2D { return this->extent; }
+		auto getColorFormat() const -> VkFormat { return this->colorFormat; }
+		auto getFramesInFlight() const -> uint32_t { return this->framesInFlight; }
+		auto extentAspectRatio() const -> float { return static_cast<float>(this->extent.width) / static_cast<float>(this->extent.height); }
+
+		auto waitForFrameSlot() -> void;
+		auto acquireNextImage(uint32_t* imageIndex) -> VkResult;	// the current frame slot, once it's free
+		auto submitCommandBuffers(const VkCommandBuffer* buffers, uint32_t* imageIndex, uint32_t bufferCount = 1) -> VkResult;
+		auto readPixels() -> std::vector<uint8_t>;	// RGBA8 rows of the latest submitted frame, waits for it. throws if none was
+		auto hasRendered() const -> bool { return this->frameValues[this->lastFrame] != 0; }
+	};
+
+	OffscreenTarget::OffscreenTarget(Device& device, VkExtent2D extent, uint32_t framesInFlight) :
+		device{ device }, extent{ extent }, framesInFlight{ framesInFlight }
+	{
+		if (framesInFlight < 1 || framesInFlight > SwapChain::MAX_FRAMES_IN_FLIGHT)
+			throw std::runtime_error("frames in flight must be between 1 and MAX_FRAMES_IN_FLIGHT!");
+		this->depthFormat = device.findSupportedFormat(
+			{ VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT },
+			VK_IMAGE_TILING_OPTIMAL,
+			VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT);
+		this->frameValues.resize(framesInFlight, 0);
+		this->createRenderPass();
+		this->createImages();
+		std::cout << "offscreen target: " << framesInFlight << " x " << extent.width << "x" << extent.height << std::endl;
+	}
+	OffscreenTarget::~OffscreenTarget() {
+		for (uint32_t i = 0; i < this->framesInFlight; i++) {
+			vkDestroyFramebuffer(this->device.device(), this->framebuffers[i], nullptr);
+			vkDestroyImageView(this->device.device(), this->colorViews[i], nullptr);
+			vkDestroyImage(this->device.device(), this->colorImages[i], nullptr);
+			this->device.allocator().free(this->colorMemory[i]);
+			vkDestroyImageView(this->device.device(), this->depthViews[i], nullptr);
+			vkDestroyImage(this->device.device(), this->depthImages[i], nullptr);
+			this->device.allocator().free(this->depthMemory[i]);
+		}
+		vkDestroyRenderPass(this->device.device(), this->renderPass, nullptr);
+	}
+
+	auto OffscreenTarget::createRenderPass() -> void {
+		VkAttachmentDescription colorAttachment{};
+		colorAttachment.format = this->colorFormat;
+		colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+		colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+		colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+		colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		colorAttachment.finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;	// instead of PRESENT_SRC_KHR, ready to copy out
+
+		VkAttachmentDescription depthAttachment{};	// same as the swap chain's, the render passes stay compatible but for the color format
+		depthAttachment.format = this->depthFormat;
+		depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+		depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+		depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+		VkAttachmentReference colorAttachmentRef{ 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+		VkAttachmentReference depthAttachmentRef{ 1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL };
+
+		VkSubpassDescription subpass{};
+		subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+		subpass.colorAttachmentCount = 1;
+		subpass.pColorAttachments = &colorAttachmentRef;
+		subpass.pDepthStencilAttachment = &depthAttachmentRef;
+
+		std::array<VkSubpassDependency, 2> dependencies{};
+		dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;	// after earlier frames, and readPixels' copy, are done with the images
+		dependencies[0].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT;
+		dependencies[0].srcAccessMask = 0;
+		dependencies[0].dstSubpass = 0;
+		dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+		dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+		dependencies[1].srcSubpass = 0;						// color writes visible to copies submitted later
+		dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+		dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+		dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+		dependencies[1].dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+		dependencies[1].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+		std::array<VkAttachmentDescription, 2> attachments = { colorAttachment, depthAttachment };
+		VkRenderPassCreateInfo renderPassInfo{};
+		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+		renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+		renderPassInfo.pAttachments = attachments.data();
+		renderPassInfo.subpassCount = 1;
+		renderPassInfo.pSubpasses = &subpass;
+		renderPassInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
+		renderPassInfo.pDependencies = dependencies.data();
+		if (vkCreateRenderPass(this->device.device(), &renderPassInfo, nullptr, &this->renderPass) != VK_SUCCESS)
+			throw std::runtime_error("failed to create offscreen render pass!");
+	}
+	auto OffscreenTarget::createImage(
+		VkFormat format, VkImageUsageFlags usage, VkImageAspectFlags aspect,
+		VkImage& image, Allocation& memory, VkImageView& view, VkMemoryPropertyFlags preferred) -> void
+	{
+		VkImageCreateInfo imageInfo{};
+		imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		imageInfo.imageType = VK_IMAGE_TYPE_2D;
+		imageInfo.extent = { this->extent.width, this->extent.height, 1 };
+		imageInfo.mipLevels = 1;
+		imageInfo.arrayLayers = 1;
+		imageInfo.format = format;
+		imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+		imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		imageInfo.usage = usage;
+		imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+		imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		this->device.createImageWithInfo(imageInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image, memory, preferred);
+
+		VkImageViewCreateInfo viewInfo{};
+		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		viewInfo.image = image;
+		viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		viewInfo.format = format;
+		viewInfo.subresourceRange = { aspect, 0, 1, 0, 1 };
+		if (vkCreateImageView(this->device.device(), &viewInfo, nullptr, &view) != VK_SUCCESS)
+			throw std::runtime_error("failed to create offscreen image view!");
+	}
+	auto OffscreenTarget::createImages() -> void {
+		this->colorImages.resize(this->framesInFlight);
+		this->colorMemory.resize(this->framesInFlight);
+		this->colorViews.resize(this->framesInFlight);
+		this->depthImages.resize(this->framesInFlight);
+		this->depthMemory.resize(this->framesInFlight);
+		this->depthViews.resize(this->framesInFlight);
+		this->framebuffers.resize(this->framesInFlight);
+
+		for (uint32_t i = 0; i < this->framesInFlight; i++) {
+			this->createImage(
+				this->colorFormat, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_IMAGE_ASPECT_COLOR_BIT,
+				this->colorImages[i], this->colorMemory[i], this->colorViews[i], 0);
+			this->createImage(	// transient like the swap chain's depth
+				this->depthFormat, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT, VK_IMAGE_ASPECT_DEPTH_BIT,
+				this->depthImages[i], this->depthMemory[i], this->depthViews[i], VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT);
+
+			std::array<VkImageView, 2> attachments = { this->colorViews[i], this->depthViews[i] };
+			VkFramebufferCreateInfo framebufferInfo{};
+			framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+			framebufferInfo.renderPass = this->renderPass;
+			framebufferInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+			framebufferInfo.pAttachments = attachments.data();
+			framebufferInfo.width = this->extent.width;
+			framebufferInfo.height = this->extent.height;
+			framebufferInfo.layers = 1;
+			if (vkCreateFramebuffer(this->device.device(), &framebufferInfo, nullptr, &this->framebuffers[i]) != VK_SUCCESS)
+				throw std::runtime_error("failed to create offscreen framebuffer!");
+		}
+	}
+
+	auto OffscreenTarget::waitForFrameSlot() -> void {
+		this->device.frameTimeline().wait(this->frameValues[this->currentFrame]);
+	}
+	auto OffscreenTarget::acquireNextImage(uint32_t* imageIndex) -> VkResult {
+		this->waitForFrameSlot();
+		*imageIndex = this->currentFrame;
+		return VK_SUCCESS;
+	}
+	auto OffscreenTarget::submitCommandBuffers(const VkCommandBuffer* buffers, uint32_t* imageIndex, uint32_t bufferCount) -> VkResult {
+		FrameTimeline& timeline = this->device.frameTimeline();
+		uint64_t frameValue = timeline.next();
+		this->frameValues[this->currentFrame] = frameValue;
+
+		VkTimelineSemaphoreSubmitInfo timelineInfo{};
+		timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+		timelineInfo.signalSemaphoreValueCount = 1;
+		timelineInfo.pSignalSemaphoreValues = &frameValue;
+
+		VkSemaphore semaphore = timeline.getSemaphore();
+		VkSubmitInfo submitInfo{};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.pNext = &timelineInfo;
+		submitInfo.commandBufferCount = bufferCount;
+		submitInfo.pCommandBuffers = buffers;
+		submitInfo.signalSemaphoreCount = 1;
+		submitInfo.pSignalSemaphores = &semaphore;
+		if (vkQueueSubmit(this->device.graphicsQueue(), 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
+			throw std::runtime_error("failed to submit offscreen command buffer!");
+
+		this->lastFrame = this->currentFrame;
+		this->currentFrame = (this->currentFrame + 1) % this->framesInFlight;
+		return VK_SUCCESS;
+	}
+	auto OffscreenTarget::readPixels() -> std::vector<uint8_t> {
+		if (!this->hasRendered())	// the color images are still UNDEFINED
+			throw std::runtime_error("failed to read pixels, no frame was rendered!");
+		VkDeviceSize size = VkDeviceSize{ this->extent.width } * this->extent.height * 4;
+		Buffer readback{
+			this->device,
+			size,
+			1,
+			VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+		};
+		readback.map();
+
+		this->device.frameTimeline().wait(this->frameValues[this->lastFrame]);
+		VkCommandBuffer commandBuffer = this->device.beginSingleTimeCommands();
+		VkBufferImageCopy region{};
+		region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+		region.imageExtent = { this->extent.width, this->extent.height, 1 };
+		vkCmdCopyImageToBuffer(commandBuffer, this->colorImages[this->lastFrame], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, readback.getBuffer(), 1, &region);
+
+		VkMemoryBarrier barrier{};	// device writes made visible to the host's read
+		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+		this->device.endSingleTimeCommands(commandBuffer);
+
+		std::vector<uint8_t> pixels(size);
+		std::memcpy(pixels.data(), readback.getMappedMemory(), size);
+		return pixels;
+	}
+}
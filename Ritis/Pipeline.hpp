@@ -41,6 +41,8 @@ namespace engine {
 		static auto readFile(const std::string& filepath) -> std::vector<char>;
 		auto createGraphicsPipeline(const std::string& vertFilepath, const std::string& fragFilepath, const PipelineConfigInfo& config) -> void;
 		auto createShaderModule(const std::vector<char>& code, VkShaderModule* shaderModule) -> void;
+
+		friend class ComputePipeline;
 	public:
 		Pipeline(Device& device, const std::string& vertFilepath, const std::string& fragFilepath, const PipelineConfigInfo& config);
 		~Pipeline();
@@ -52,6 +54,23 @@ namespace engine {
 		static auto enableAlphaBlending(PipelineConfigInfo& configInfo) -> void;
 	};
 
+	/*
+		Single compute shader stage, no fixed function state to configure.
+		the layout is owned by the caller, same as PipelineConfigInfo::pipelineLayout
+	*/
+	class ComputePipeline {
+		Device& device;
+		VkPipeline computePipeline;
+		VkShaderModule shaderModule;
+	public:
+		ComputePipeline(Device& device, const std::string& shaderFilepath, VkPipelineLayout pipelineLayout);
+		~ComputePipeline();
+		ComputePipeline(const ComputePipeline&) = delete;
+		ComputePipeline& operator=(const ComputePipeline&) = delete;
+
+		auto bind(VkCommandBuffer commandBuffer) -> void;
+	};
+
 	Pipeline::Pipeline(
 		Device& device,
 		const std::string& vertFilepath,
@@ -272,4 +291,40 @@ namespace engine {
 		configInfo.colorBlendAttachement.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
 		configInfo.colorBlendAttachement.alphaBlendOp = VK_BLEND_OP_ADD; // additive alpha blending
 	}
-}
+
+	ComputePipeline::ComputePipeline(Device& device, const std::string& shaderFilepath, VkPipelineLayout pipelineLayout) : device{ device } {
+		assert(pipelineLayout != VK_NULL_HANDLE && "Cannot create compute pipeline:: no pipelineLayout provided");
+		auto code = Pipeline::readFile(shaderFilepath);
+
+		VkShaderModuleCreateInfo moduleInfo{};
+		moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+		moduleInfo.codeSize = code.size();
+		moduleInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
+		if (vkCreateShaderModule(this->device.device(), &moduleInfo, nullptr, &this->shaderModule) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create shader module.");
+		}
+
+		VkComputePipelineCreateInfo pipelineInfo{};
+		pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+		pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+		pipelineInfo.stage.module = this->shaderModule;
+		pipelineInfo.stage.pName = "main";
+		pipelineInfo.layout = pipelineLayout;
+		pipelineInfo.basePipelineIndex = -1;
+		pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+
+		if (vkCreateComputePipelines(this->device.device(), VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &this->computePipeline) != VK_SUCCESS) {
+			vkDestroyShaderModule(this->device.device(), this->shaderModule, nullptr);
+			throw std::runtime_error("failed to create compute pipeline");
+		}
+	}
+	ComputePipeline::~ComputePipeline() {
+		vkDestroyShaderModule(this->device.device(), this->shaderModule, nullptr);
+		vkDestroyPipeline(this->device.device(), this->computePipeline, nullptr);
+	}
+
+	auto ComputePipeline::bind(VkCommandBuffer commandBuffer) -> void {
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, this->computePipeline);
+	}
+}
\ No newline at end of file
@@ -3,6 +3,8 @@
 #include "Device.hpp"
 #include "SwapChain.hpp"
 #include "Window.hpp"
+#include "SecondaryCommandPools.hpp"
+#include "OffscreenTarget.hpp"
 
 #include <vector>
 #include <memory>
@@ -13,12 +15,29 @@
 namespace engine {
 	/*
 		In charge of managing swapchain and commandbuffers
+		without a window (headless) it renders into an OffscreenTarget instead, everything else works the same
 	*/
 	class Renderer {
-		Window& window;
+		/*
+			Every frame in flight records from its own transient pool, reset as a whole with vkResetCommandPool once the frame's
+			fence has signaled instead of every command buffer resetting itself on begin
+		*/
+		struct FrameCommandPool {
+			VkCommandPool pool = VK_NULL_HANDLE;
+			std::array<std::vector<VkCommandBuffer>, 2> transient;	// by VkCommandBufferLevel, handed out again after each reset
+			std::array<size_t, 2> transientUsed{};
+			std::vector<VkCommandBuffer> pendingPrimaries;			// transient primaries to submit with the frame
+		};
+
+		Window* window;
 		Device& device;
+		uint32_t framesInFlight;
 		std::unique_ptr<SwapChain> swapChain;
+		std::unique_ptr<OffscreenTarget> offscreen;	// instead of swapChain when headless
+		VkExtent2D offscreenExtent;
+		std::vector<FrameCommandPool> framePools;
 		std::vector<VkCommandBuffer> commandBuffers;
+		SecondaryCommandPools secondaryPools;	// for systems recording the render pass from several threads
 
 		uint32_t currentImageIndex{ 0 };
 		int currentFrameIndex{ 0 };
@@ -27,8 +46,10 @@ namespace engine {
 		auto createCommandBuffers() -> void;
 		auto freeCommandBuffers() -> void;
 		auto recreateSwapChain() -> void;
+		auto getCurrentFrameBuffer() const -> VkFramebuffer;
 	public:
-		Renderer(Window& window, Device& device);
+		// window nullptr renders headless at offscreenExtent, the device has to be headless too
+		Renderer(Window* window, Device& device, uint32_t framesInFlight = SwapChain::DEFAULT_FRAMES_IN_FLIGHT, VkExtent2D offscreenExtent = { 800, 600 });
 		~Renderer();
 
 		Renderer(const Renderer&) = delete;
@@ -39,17 +60,24 @@ namespace engine {
 			return this->currentFrameIndex;
 		}
 
+		auto getFramesInFlight() const -> uint32_t { return this->framesInFlight; }	// frame indices are below this, size per frame resources with it
+
+		auto waitForFrameSlot() -> void;	// blocks until beginFrame won't have to, to sample input as late as possible
 		auto beginFrame() -> VkCommandBuffer;
 		auto endFrame() -> void;
-		auto beginSwapChainRenderPass(VkCommandBuffer commandBuffer) -> void;
+		auto beginSwapChainRenderPass(VkCommandBuffer commandBuffer, VkSubpassContents contents = VK_SUBPASS_CONTENTS_INLINE) -> void;
 		auto endSwapChainRenderPass(VkCommandBuffer commandBuffer) -> void;
 
 		auto getSwapChainRenderPass() const -> VkRenderPass {
-			return this->swapChain->getRenderPass();
+			return this->offscreen ? this->offscreen->getRenderPass() : this->swapChain->getRenderPass();
 		}
 		auto getAspectRatio() const -> float {
-			return this->swapChain->extentAspectRatio();
+			return this->offscreen ? this->offscreen->extentAspectRatio() : this->swapChain->extentAspectRatio();
+		}
+		auto getExtent() const -> VkExtent2D {
+			return this->offscreen ? this->offscreen->getExtent() : this->swapChain->getSwapChainExtent();
 		}
+		auto getOffscreenTarget() const -> OffscreenTarget* { return this->offscreen.get(); }	// nullptr unless headless
 		auto isFrameInProgress() const -> bool {
 			return this->isFrameStarted;
 		}
@@ -57,9 +85,19 @@ namespace engine {
 			assert(this->isFrameStarted && "Cannot get command buffer when frame not in progress");
 			return this->commandBuffers[this->currentFrameIndex];
 		}
+		/*
+			An extra command buffer from the current frame's pool, not begun. valid until this frame slot comes around again,
+			never free it. primaries are submitted ahead of the frame's command buffer in allocation order and must be ended by endFrame,
+			secondaries are for the frame's command buffer to execute. only from the thread running the frame, workers use getSecondaryRecording
+		*/
+		auto allocateFrameCommandBuffer(VkCommandBufferLevel level = VK_COMMAND_BUFFER_LEVEL_PRIMARY) -> VkCommandBuffer;
+		// secondaries for the swap chain render pass of the current frame, execute them after beginSwapChainRenderPass(..., VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS)
+		auto getSecondaryRecording() -> SecondaryRecording;
 	};
 
-	Renderer::Renderer(Window& w, Device& d) : window{ w }, device{ d } {
+	Renderer::Renderer(Window* w, Device& d, uint32_t framesInFlight, VkExtent2D offscreenExtent) :
+		window{ w }, device{ d }, framesInFlight{ framesInFlight }, offscreenExtent{ offscreenExtent }, secondaryPools{ d, framesInFlight }
+	{
 		this->recreateSwapChain(); // calls create pipeline
 		this->createCommandBuffers();
 	}
@@ -68,14 +106,19 @@ namespace engine {
 	}
 
 	auto Renderer::recreateSwapChain() -> void {
-		auto extent = this->window.getExtent();
+		if (this->window == nullptr) {	// nothing to resize, the offscreen target is created once
+			this->offscreen = std::make_unique<OffscreenTarget>(this->device, this->offscreenExtent, this->framesInFlight);
+			return;
+		}
+		auto extent = this->window->getExtent();
 		while (extent.width == 0 || extent.height == 0) {	// if one dimension is sizeless
-			extent = this->window.getExtent();
+			extent = this->window->getExtent();
 			glfwWaitEvents();								// pause and wait
 		}
 		vkDeviceWaitIdle(this->device.device());	// wait swapchain to be idle
+		this->device.deletionQueue().flush();		// nothing is in flight anymore
 		if (this->swapChain == nullptr)
-			this->swapChain = std::make_unique<SwapChain>(this->device, extent);
+			this->swapChain = std::make_unique<SwapChain>(this->device, extent, this->framesInFlight);
 		else {
 			std::shared_ptr<SwapChain> oldSwapChain = std::move(this->swapChain);
 			this->swapChain = std::make_unique <SwapChain>(this->device, extent, oldSwapChain);
@@ -107,36 +150,75 @@ namespace engine {
 
 			*note: undefined behavior to call Submit on a Command Buffer in the Pending State
 		*/
-		this->commandBuffers.resize(SwapChain::MAX_FRAMES_IN_FLIGHT); // one to one to avoid re-Recording command buffers as they target a frame buffer
-		VkCommandBufferAllocateInfo allocInfo{};
-		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;					// primary: can be submitted to device for submission, can call secondary command buffers
-		// secondary: cannot be submitted to device for submission, but can be called by primary command buffers
-		allocInfo.commandPool = this->device.getCommandPool(); // avoid allocation and deallocating command buffer memory using command pools
-		allocInfo.commandBufferCount = static_cast<uint32_t>(this->commandBuffers.size());
+		this->commandBuffers.resize(this->framesInFlight); // one to one to avoid re-Recording command buffers as they target a frame buffer
+		this->framePools.resize(this->framesInFlight);
+		for (size_t i = 0; i < this->framePools.size(); i++) {
+			VkCommandPoolCreateInfo poolInfo{};
+			poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+			poolInfo.queueFamilyIndex = this->device.findPhysicalQueueFamilies().graphicsFamily;
+			poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;	// short lived, no RESET_COMMAND_BUFFER_BIT since only the whole pool is reset
+			if (vkCreateCommandPool(this->device.device(), &poolInfo, nullptr, &this->framePools[i].pool) != VK_SUCCESS) {
+				throw std::runtime_error("Failed to create frame command pool");
+			}
 
-		if (
-			vkAllocateCommandBuffers(
-				this->device.device(),
-				&allocInfo,
-				this->commandBuffers.data()
-			) != VK_SUCCESS
-			) {
-			throw std::runtime_error("Failed to allocate command buffers");
+			VkCommandBufferAllocateInfo allocInfo{};
+			allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;					// primary: can be submitted to device for submission, can call secondary command buffers
+			// secondary: cannot be submitted to device for submission, but can be called by primary command buffers
+			allocInfo.commandPool = this->framePools[i].pool; // avoid allocation and deallocating command buffer memory using command pools
+			allocInfo.commandBufferCount = 1;
+
+			if (
+				vkAllocateCommandBuffers(
+					this->device.device(),
+					&allocInfo,
+					&this->commandBuffers[i]
+				) != VK_SUCCESS
+				) {
+				throw std::runtime_error("Failed to allocate command buffers");
+			}
 		}
 	}
 	auto Renderer::freeCommandBuffers() -> void {
-		vkFreeCommandBuffers(
-			this->device.device(),
-			this->device.getCommandPool(),
-			static_cast<uint32_t>(this->commandBuffers.size()),
-			this->commandBuffers.data()
-		);
+		for (FrameCommandPool& framePool : this->framePools)
+			vkDestroyCommandPool(this->device.device(), framePool.pool, nullptr);	// frees every buffer allocated from it
+		this->framePools.clear();
 		this->commandBuffers.clear();
 	}
+	auto Renderer::allocateFrameCommandBuffer(VkCommandBufferLevel level) -> VkCommandBuffer {
+		assert(this->isFrameStarted && "Can't allocate frame command buffers while frame is not in progress");
+		FrameCommandPool& framePool = this->framePools[this->currentFrameIndex];
+		std::vector<VkCommandBuffer>& transient = framePool.transient[level];
+		size_t& used = framePool.transientUsed[level];
+		if (used == transient.size()) {
+			VkCommandBufferAllocateInfo allocInfo{};
+			allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			allocInfo.level = level;
+			allocInfo.commandPool = framePool.pool;
+			allocInfo.commandBufferCount = 1;
+			VkCommandBuffer commandBuffer;
+			if (vkAllocateCommandBuffers(this->device.device(), &allocInfo, &commandBuffer) != VK_SUCCESS) {
+				throw std::runtime_error("Failed to allocate frame command buffer");
+			}
+			transient.push_back(commandBuffer);
+		}
+		VkCommandBuffer commandBuffer = transient[used++];
+		if (level == VK_COMMAND_BUFFER_LEVEL_PRIMARY)
+			framePool.pendingPrimaries.push_back(commandBuffer);
+		return commandBuffer;
+	}
+	auto Renderer::waitForFrameSlot() -> void {
+		assert(!this->isFrameStarted && "Can't wait for the next frame slot while a frame is in progress");
+		if (this->offscreen)
+			this->offscreen->waitForFrameSlot();
+		else
+			this->swapChain->waitForFrameSlot();
+	}
 	auto Renderer::beginFrame() -> VkCommandBuffer {
 		assert(!this->isFrameStarted && "Can't call beginFrame while already in progress");
-		auto result = this->swapChain->acquireNextImage(&this->currentImageIndex);
+		auto result = this->offscreen ?
+			this->offscreen->acquireNextImage(&this->currentImageIndex) :
+			this->swapChain->acquireNextImage(&this->currentImageIndex);
 
 		if (result == VK_ERROR_OUT_OF_DATE_KHR) {	// is thrown after window resize and in some other cases
 			this->recreateSwapChain();				// requires swapchain recreation
@@ -145,11 +227,19 @@ namespace engine {
 		if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
 			throw std::runtime_error("failed to acquire swap chain image");
 		}
+		this->device.deletionQueue().advance(this->framesInFlight);	// acquireNextImage waited for this frame slot's last submission
+		this->secondaryPools.reset(this->currentFrameIndex);					// same wait, its secondaries are done executing
+
+		FrameCommandPool& framePool = this->framePools[this->currentFrameIndex];
+		vkResetCommandPool(this->device.device(), framePool.pool, 0);	// and the frame's own command buffers, all back to Initial in one call
+		framePool.transientUsed = {};
+		framePool.pendingPrimaries.clear();
 
 		this->isFrameStarted = true;
 		auto commandBuffer = this->getCurrentCommandBuffer();
 		VkCommandBufferBeginInfo beginInfo{};
 		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;	// re-recorded every frame anyway
 
 		if (
 			vkBeginCommandBuffer( // call Begin event to transition from Initial to Recording
@@ -168,9 +258,13 @@ namespace engine {
 			throw std::runtime_error("failed to transition command buffer to executable state");
 		}
 
-		auto result = this->swapChain->submitCommandBuffers(&commandBuffer, &this->currentImageIndex);
-		if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || this->window.wasWindowResized()) {
-			this->window.resetWindowResizeFlag();
+		std::vector<VkCommandBuffer>& submission = this->framePools[this->currentFrameIndex].pendingPrimaries;
+		submission.push_back(commandBuffer);	// after the transient primaries recorded for this frame
+		auto result = this->offscreen ?
+			this->offscreen->submitCommandBuffers(submission.data(), &this->currentImageIndex, static_cast<uint32_t>(submission.size())) :
+			this->swapChain->submitCommandBuffers(submission.data(), &this->currentImageIndex, static_cast<uint32_t>(submission.size()));
+		if (this->window && (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || this->window->wasWindowResized())) {
+			this->window->resetWindowResizeFlag();	// headless has no window and its offscreen target never goes out of date
 			this->recreateSwapChain();
 		}
 		else if (result != VK_SUCCESS) {
@@ -178,23 +272,23 @@ namespace engine {
 		}
 
 		this->isFrameStarted = false;
-		currentFrameIndex = (currentFrameIndex + 1) % SwapChain::MAX_FRAMES_IN_FLIGHT;
+		currentFrameIndex = (currentFrameIndex + 1) % this->framesInFlight;
 	}
-	auto Renderer::beginSwapChainRenderPass(VkCommandBuffer commandBuffer) -> void {
+	auto Renderer::beginSwapChainRenderPass(VkCommandBuffer commandBuffer, VkSubpassContents contents) -> void {
 		assert(this->isFrameStarted && "Can't call beginSwapChainRenderPass while frame is not in progress");
 		assert(commandBuffer == this->getCurrentCommandBuffer() && "Can't begin render pass on commandbuffer from a different frame");
 
 		VkRenderPassBeginInfo renderPassInfo{};
 		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-		renderPassInfo.renderPass = this->swapChain->getRenderPass();
-		renderPassInfo.framebuffer = this->swapChain->getFrameBuffer(this->currentImageIndex); // associate with frame buffer
+		renderPassInfo.renderPass = this->getSwapChainRenderPass();
+		renderPassInfo.framebuffer = this->getCurrentFrameBuffer(); // associate with frame buffer
 
 		/*
 			framebuffers have 2 parts so far, color (index 0) and depth (index 1). This is according to structure given in renderPass
 		*/
 
 		renderPassInfo.renderArea.offset = { 0, 0 };
-		renderPassInfo.renderArea.extent = this->swapChain->getSwapChainExtent();
+		renderPassInfo.renderArea.extent = this->getExtent();
 
 		std::array<VkClearValue, 2> clearValues{};
 		clearValues[0].color = { 0.01f, 0.01f, 0.01f, 1.0f };
@@ -205,22 +299,39 @@ namespace engine {
 		vkCmdBeginRenderPass(
 			commandBuffer,
 			&renderPassInfo,				// record render pass to command buffer
-			VK_SUBPASS_CONTENTS_INLINE		// only a primary command buffer will be used, no secondaries
-		);									// VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS if ^ isn't the case
+			contents						// VK_SUBPASS_CONTENTS_INLINE if only the primary command buffer records the pass
+		);									// VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS if it only executes secondaries
 		// can't have a command buffer that has inline commands and secondary command buffers
+		if (contents != VK_SUBPASS_CONTENTS_INLINE)
+			return;	// nothing but vkCmdExecuteCommands is allowed now, the secondaries set viewport and scissor themselves
 
 		VkViewport viewport{};
 		viewport.x = 0.0f;
 		viewport.y = 0.0f;
-		viewport.width = static_cast<float>(this->swapChain->getSwapChainExtent().width);
-		viewport.height = static_cast<float>(this->swapChain->getSwapChainExtent().height);
+		viewport.width = static_cast<float>(this->getExtent().width);
+		viewport.height = static_cast<float>(this->getExtent().height);
 		viewport.minDepth = 0.0f;
 		viewport.maxDepth = 1.0f;
-		VkRect2D scissor{ {0, 0}, this->swapChain->getSwapChainExtent() };
+		VkRect2D scissor{ {0, 0}, this->getExtent() };
 		vkCmdSetViewport(commandBuffer, 0, 1, &viewport);		// set viewport just before executing each frame
 		vkCmdSetScissor(commandBuffer, 0, 1, &scissor);		// set scissor just before executing each frame
 		// 0 for viewport index, 1 for viewport count
 	}
+	auto Renderer::getSecondaryRecording() -> SecondaryRecording {
+		assert(this->isFrameStarted && "Can't record secondaries while frame is not in progress");
+		SecondaryRecording recording{};
+		recording.pools = &this->secondaryPools;
+		recording.frameIndex = static_cast<uint32_t>(this->currentFrameIndex);
+		recording.inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+		recording.inheritance.renderPass = this->getSwapChainRenderPass();
+		recording.inheritance.subpass = 0;
+		recording.inheritance.framebuffer = this->getCurrentFrameBuffer();	// optional, but lets drivers specialize
+		recording.extent = this->getExtent();
+		return recording;
+	}
+	auto Renderer::getCurrentFrameBuffer() const -> VkFramebuffer {
+		return this->offscreen ? this->offscreen->getFrameBuffer(this->currentImageIndex) : this->swapChain->getFrameBuffer(this->currentImageIndex);
+	}
 	auto Renderer::endSwapChainRenderPass(VkCommandBuffer commandBuffer) -> void {
 		assert(this->isFrameStarted && "Can't call endSwapChainRenderPass while frame is not in progress");
 		assert(commandBuffer == this->getCurrentCommandBuffer() && "Can't end render pass on commandbuffer from a different frame");
@@ -0,0 +1,108 @@
+#pragma once
+
+#include "Device.hpp"
+
+#include <vector>
+#include <stdexcept>
+
+namespace engine {
+	constexpr const uint32_t MAX_RECORDING_SLOTS = 64;	// command pools per frame, one per thread recording at the same time
+
+	/*
+		Secondary command buffers for recording one render pass from several threads.
+		command pools must not be used by two threads at once, so every frame in flight has a pool per slot and each thread records
+		through its own slot. buffers are reused: reset(frameIndex) resets the frame's pools once its fence has signaled and
+		begin() hands the slot's buffers out again in order. pools are created the first time their slot is used.
+		begin() on different slots is thread safe, on the same slot it isn't.
+	*/
+	class SecondaryCommandPools {
+		struct Slot {
+			VkCommandPool pool = VK_NULL_HANDLE;
+			std::vector<VkCommandBuffer> buffers;
+			size_t used = 0;
+		};
+
+		Device& device;
+		std::vector<std::vector<Slot>> frames;	// [frame][slot], never resized after construction
+	public:
+		SecondaryCommandPools(Device& device, uint32_t frameCount, uint32_t slotCount = MAX_RECORDING_SLOTS);
+		~SecondaryCommandPools();
+
+		SecondaryCommandPools(const SecondaryCommandPools&) = delete;
+		SecondaryCommandPools& operator=(const SecondaryCommandPools&) = delete;
+
+		auto reset(uint32_t frameIndex) -> void;
+		// begun with RENDER_PASS_CONTINUE inside inheritance's render pass, viewport and scissor already cover extent
+		auto begin(uint32_t frameIndex, uint32_t slot, const VkCommandBufferInheritanceInfo& inheritance, VkExtent2D extent) -> VkCommandBuffer;
+		auto getSlotCount() const -> uint32_t { return static_cast<uint32_t>(this->frames[0].size()); }
+	};
+
+	/*
+		What a system needs to record part of the current render pass on another thread
+	*/
+	struct SecondaryRecording {
+		SecondaryCommandPools* pools;
+		uint32_t frameIndex;
+		VkCommandBufferInheritanceInfo inheritance;
+		VkExtent2D extent;
+
+		auto begin(uint32_t slot) const -> VkCommandBuffer { return this->pools->begin(this->frameIndex, slot, this->inheritance, this->extent); }
+	};
+
+	SecondaryCommandPools::SecondaryCommandPools(Device& device, uint32_t frameCount, uint32_t slotCount) : device{ device } {
+		this->frames.resize(frameCount);
+		for (auto& slots : this->frames)
+			slots.resize(slotCount);
+	}
+	SecondaryCommandPools::~SecondaryCommandPools() {
+		for (auto& slots : this->frames)
+			for (Slot& slot : slots)
+				if (slot.pool != VK_NULL_HANDLE)
+					vkDestroyCommandPool(this->device.device(), slot.pool, nullptr);	// frees its buffers too
+	}
+
+	auto SecondaryCommandPools::reset(uint32_t frameIndex) -> void {
+		for (Slot& slot : this->frames[frameIndex]) {
+			if (slot.used == 0) continue;
+			vkResetCommandPool(this->device.device(), slot.pool, 0);	// one call for every buffer the slot recorded
+			slot.used = 0;
+		}
+	}
+	auto SecondaryCommandPools::begin(uint32_t frameIndex, uint32_t slot, const VkCommandBufferInheritanceInfo& inheritance, VkExtent2D extent) -> VkCommandBuffer {
+		Slot& s = this->frames[frameIndex].at(slot);
+		if (s.pool == VK_NULL_HANDLE) {
+			VkCommandPoolCreateInfo poolInfo{};
+			poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+			poolInfo.queueFamilyIndex = this->device.findPhysicalQueueFamilies().graphicsFamily;
+			poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;	// reset as a whole every frame
+			if (vkCreateCommandPool(this->device.device(), &poolInfo, nullptr, &s.pool) != VK_SUCCESS)
+				throw std::runtime_error("failed to create secondary command pool!");
+		}
+		if (s.used == s.buffers.size()) {
+			VkCommandBufferAllocateInfo allocInfo{};
+			allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+			allocInfo.commandPool = s.pool;
+			allocInfo.commandBufferCount = 1;
+			VkCommandBuffer commandBuffer;
+			if (vkAllocateCommandBuffers(this->device.device(), &allocInfo, &commandBuffer) != VK_SUCCESS)
+				throw std::runtime_error("failed to allocate secondary command buffer!");
+			s.buffers.push_back(commandBuffer);
+		}
+		VkCommandBuffer commandBuffer = s.buffers[s.used++];
+
+		VkCommandBufferBeginInfo beginInfo{};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		beginInfo.pInheritanceInfo = &inheritance;
+		if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS)
+			throw std::runtime_error("failed to begin secondary command buffer!");
+
+		// dynamic state isn't inherited from the primary
+		VkViewport viewport{ 0.0f, 0.0f, static_cast<float>(extent.width), static_cast<float>(extent.height), 0.0f, 1.0f };
+		VkRect2D scissor{ { 0, 0 }, extent };
+		vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+		vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+		return commandBuffer;
+	}
+}
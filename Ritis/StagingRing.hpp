@@ -0,0 +1,345 @@
+#pragma once
+
+#include "MemoryAllocator.hpp"
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <cstring>
+
+namespace engine {
+	constexpr const VkDeviceSize STAGING_RING_SIZE = 64ull << 20;
+
+	// host visible source for one copy. data is written by the cpu, then copied from buffer at offset
+	struct StagingRegion {
+		VkBuffer buffer = VK_NULL_HANDLE;
+		VkDeviceSize offset = 0;
+		VkDeviceSize size = 0;
+		void* data = nullptr;
+	};
+
+	// returned by StagingRing::commit. submit the copies reading the committed regions with fence
+	struct StagingTicket {
+		VkFence fence = VK_NULL_HANDLE;
+		uint64_t id = 0;
+	};
+
+	/*
+		One persistently mapped, host coherent buffer that every host -> device upload is staged through.
+		regions are handed out front to back and wrap around. commit() ties everything allocated since the last commit to a fence
+		the caller submits with (even if nothing was staged, so the ids double as submission tickets), and that space is reused once the fence signals. allocate() only blocks when the ring is full and has to
+		wait for the oldest submission. requests that can't fit (bigger than the ring, or the ring full of uncommitted data) get a
+		temporary buffer of their own, released the same way.
+		a commit fences every region allocated before it, from any thread, so allocating and committing is private to UploadBatcher,
+		which does both under its own mutex and only commits once the regions it handed out are recorded. isComplete and wait are thread safe.
+
+		usage (inside UploadBatcher):
+			StagingRegion region = this->staging.allocate(size);
+			memcpy(region.data, data, size);
+			vkCmdCopyBuffer(commandBuffer, region.buffer, destination, ...);	// srcOffset = region.offset
+			vkQueueSubmit(queue, 1, &submitInfo, this->staging.commit().fence);
+	*/
+	class UploadBatcher;
+
+	class StagingRing {
+		struct Overflow {
+			VkBuffer buffer;
+			Allocation allocation;
+		};
+		struct Pending {
+			uint64_t id;
+			VkFence fence;
+			uint64_t end;					// ring position after this submission's regions
+			std::vector<Overflow> overflow;
+		};
+
+		VkDevice device;
+		MemoryAllocator& allocator;
+		VkBuffer buffer = VK_NULL_HANDLE;
+		Allocation memory{};
+		VkDeviceSize capacity;
+
+		// positions count up forever, offset in the buffer = position % capacity
+		uint64_t head = 0;					// next free byte
+		uint64_t tail = 0;					// start of the oldest region still in use
+		std::vector<Overflow> overflow;		// uncommitted
+		std::deque<Pending> pending;
+		std::vector<VkFence> freeFences;
+		uint64_t nextId = 1;
+		uint64_t completedId = 0;			// every id <= this has finished
+		std::mutex mutex;
+
+		uint64_t bytesStaged = 0;
+		uint64_t stalls = 0;
+
+		auto createBuffer(VkDeviceSize size, VkBuffer& buffer, Allocation& allocation) -> void;
+		auto reclaim(bool wait) -> bool;
+		auto allocateOverflow(VkDeviceSize size) -> StagingRegion;
+
+		friend class UploadBatcher;
+		auto allocate(VkDeviceSize size, VkDeviceSize alignment = 16) -> StagingRegion;
+		auto commit() -> StagingTicket;
+	public:
+		StagingRing(VkDevice device, MemoryAllocator& allocator, VkDeviceSize capacity = STAGING_RING_SIZE);
+		~StagingRing();
+
+		StagingRing(const StagingRing&) = delete;
+		StagingRing& operator=(const StagingRing&) = delete;
+
+		auto isComplete(uint64_t id) -> bool;
+		auto wait(uint64_t id) -> void;
+
+		auto getCapacity() const -> VkDeviceSize { return this->capacity; }
+		auto getBytesStaged() const -> uint64_t { return this->bytesStaged; }
+		auto getStallCount() const -> uint64_t { return this->stalls; }		// allocations that had to wait for the gpu
+
+		static auto benchmark(VkDevice device, MemoryAllocator& allocator, VkQueue queue, uint32_t queueFamily) -> void;
+	};
+
+	StagingRing::StagingRing(VkDevice device, MemoryAllocator& allocator, VkDeviceSize capacity) :
+		device{ device }, allocator{ allocator }, capacity{ capacity }
+	{
+		this->createBuffer(capacity, this->buffer, this->memory);
+	}
+	StagingRing::~StagingRing() {
+		while (!this->pending.empty())
+			this->reclaim(true);
+		for (Overflow& overflow : this->overflow) {		// allocated but never committed
+			vkDestroyBuffer(this->device, overflow.buffer, nullptr);
+			this->allocator.free(overflow.allocation);
+		}
+		for (VkFence fence : this->freeFences)
+			vkDestroyFence(this->device, fence, nullptr);
+		vkDestroyBuffer(this->device, this->buffer, nullptr);
+		this->allocator.free(this->memory);
+	}
+
+	auto StagingRing::createBuffer(VkDeviceSize size, VkBuffer& buffer, Allocation& allocation) -> void {
+		VkBufferCreateInfo bufferInfo{};
+		bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		bufferInfo.size = size;
+		bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+		bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		if (vkCreateBuffer(this->device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS)
+			throw std::runtime_error("failed to create staging buffer!");
+
+		VkMemoryRequirements requirements;
+		vkGetBufferMemoryRequirements(this->device, buffer, &requirements);
+		uint32_t memoryType = this->allocator.findMemoryType(
+			requirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);	// coherent, no flushes
+		allocation = this->allocator.allocate(requirements, memoryType, false, MemoryCategory::Staging);
+		vkBindBufferMemory(this->device, buffer, allocation.memory, allocation.offset);
+	}
+
+	auto StagingRing::allocate(VkDeviceSize size, VkDeviceSize alignment) -> StagingRegion {
+		std::lock_guard<std::mutex> lock{ this->mutex };
+		this->bytesStaged += size;
+		if (size > this->capacity)
+			return this->allocateOverflow(size);
+
+		bool stalled = false;
+		uint64_t start;
+		for (;;) {
+			start = (this->head + alignment - 1) / alignment * alignment;
+			if (start % this->capacity + size > this->capacity)		// doesn't fit before the end, skip to the start of the buffer
+				start += this->capacity - start % this->capacity;
+			if (start + size - this->tail <= this->capacity)
+				break;
+
+			if (this->pending.empty())		// everything in the way is uncommitted, only its own submit can free it
+				return this->allocateOverflow(size);
+			if (!this->reclaim(false)) {
+				this->reclaim(true);
+				stalled = true;
+			}
+		}
+		this->stalls += stalled;
+		this->head = start + size;
+
+		StagingRegion region{};
+		region.buffer = this->buffer;
+		region.offset = start % this->capacity;
+		region.size = size;
+		region.data = static_cast<char*>(this->memory.mapped) + region.offset;
+		return region;
+	}
+	// caller holds the mutex
+	auto StagingRing::allocateOverflow(VkDeviceSize size) -> StagingRegion {
+		Overflow overflow{};
+		this->createBuffer(size, overflow.buffer, overflow.allocation);
+		this->overflow.push_back(overflow);
+
+		StagingRegion region{};
+		region.buffer = overflow.buffer;
+		region.size = size;
+		region.data = overflow.allocation.mapped;
+		return region;
+	}
+
+	auto StagingRing::commit() -> StagingTicket {
+		std::lock_guard<std::mutex> lock{ this->mutex };
+		StagingTicket ticket{};
+		ticket.id = this->nextId++;
+		if (this->freeFences.empty()) {
+			VkFenceCreateInfo fenceInfo{};
+			fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+			VkFence fence;
+			if (vkCreateFence(this->device, &fenceInfo, nullptr, &fence) != VK_SUCCESS)
+				throw std::runtime_error("failed to create staging fence!");
+			this->freeFences.push_back(fence);
+		}
+		ticket.fence = this->freeFences.back();
+		this->freeFences.pop_back();
+
+		this->pending.push_back({ ticket.id, ticket.fence, this->head, std::move(this->overflow) });
+		this->overflow.clear();
+		return ticket;
+	}
+
+	auto StagingRing::isComplete(uint64_t id) -> bool {
+		std::lock_guard<std::mutex> lock{ this->mutex };
+		while (id > this->completedId && this->reclaim(false)) {}
+		return id <= this->completedId;
+	}
+	auto StagingRing::wait(uint64_t id) -> void {
+		std::lock_guard<std::mutex> lock{ this->mutex };
+		while (id > this->completedId && this->reclaim(true)) {}
+	}
+
+	// releases the oldest submission if its fence has signaled (or once it has, when waiting). caller holds the mutex
+	auto StagingRing::reclaim(bool wait) -> bool {
+		if (this->pending.empty()) return false;
+		Pending& oldest = this->pending.front();
+		if (wait) {
+			if (vkWaitForFences(this->device, 1, &oldest.fence, VK_TRUE, UINT64_MAX) != VK_SUCCESS)
+				throw std::runtime_error("failed to wait for staging fence!");
+		}
+		else {
+			VkResult status = vkGetFenceStatus(this->device, oldest.fence);
+			if (status == VK_NOT_READY)
+				return false;
+			if (status != VK_SUCCESS)	// ie, VK_ERROR_DEVICE_LOST, which would otherwise read as not ready forever
+				throw std::runtime_error("failed to get staging fence status!");
+		}
+
+		vkResetFences(this->device, 1, &oldest.fence);
+		this->freeFences.push_back(oldest.fence);
+		for (Overflow& overflow : oldest.overflow) {
+			vkDestroyBuffer(this->device, overflow.buffer, nullptr);
+			this->allocator.free(overflow.allocation);
+		}
+		this->tail = oldest.end;
+		this->completedId = oldest.id;
+		this->pending.pop_front();
+		return true;
+	}
+
+	/*
+		Streams uploads into a device local buffer and prints the throughput, once with many small copies and once with few large ones.
+		every submission holds up to 8MB of copies, so the ring keeps several in flight and wraps many times
+	*/
+	auto StagingRing::benchmark(VkDevice device, MemoryAllocator& allocator, VkQueue queue, uint32_t queueFamily) -> void {
+		StagingRing ring{ device, allocator };	// its own ring, so its commits never fence the device ring's regions
+		const VkDeviceSize destinationSize = 16ull << 20;
+		const VkDeviceSize submitSize = 8ull << 20;
+
+		VkCommandPool commandPool;
+		VkCommandPoolCreateInfo poolInfo{};
+		poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		poolInfo.queueFamilyIndex = queueFamily;
+		poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+		if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS)
+			throw std::runtime_error("failed to create staging benchmark command pool!");
+
+		VkBuffer destination;
+		VkBufferCreateInfo bufferInfo{};
+		bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		bufferInfo.size = destinationSize;
+		bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+		bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		if (vkCreateBuffer(device, &bufferInfo, nullptr, &destination) != VK_SUCCESS)
+			throw std::runtime_error("failed to create staging benchmark buffer!");
+		VkMemoryRequirements requirements;
+		vkGetBufferMemoryRequirements(device, destination, &requirements);
+		Allocation destinationMemory = allocator.allocate(
+			requirements, allocator.findMemoryType(requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT), false);
+		vkBindBufferMemory(device, destination, destinationMemory.memory, destinationMemory.offset);
+
+		std::vector<char> source(destinationSize, 1);
+
+		auto stream = [&](const char* name, uint32_t uploadCount, VkDeviceSize uploadSize) {
+			std::deque<std::pair<uint64_t, VkCommandBuffer>> inFlight;
+			VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+			VkDeviceSize recorded = 0;
+			uint64_t stallsBefore = ring.stalls;
+
+			auto submit = [&] {
+				vkEndCommandBuffer(commandBuffer);
+				StagingTicket ticket = ring.commit();
+				VkSubmitInfo submitInfo{};
+				submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+				submitInfo.commandBufferCount = 1;
+				submitInfo.pCommandBuffers = &commandBuffer;
+				vkQueueSubmit(queue, 1, &submitInfo, ticket.fence);
+				inFlight.emplace_back(ticket.id, commandBuffer);
+				commandBuffer = VK_NULL_HANDLE;
+				recorded = 0;
+			};
+
+			auto start = std::chrono::high_resolution_clock::now();
+			for (uint32_t i = 0; i < uploadCount; i++) {
+				if (commandBuffer == VK_NULL_HANDLE) {
+					while (!inFlight.empty() && ring.isComplete(inFlight.front().first)) {
+						vkFreeCommandBuffers(device, commandPool, 1, &inFlight.front().second);
+						inFlight.pop_front();
+					}
+					VkCommandBufferAllocateInfo allocInfo{};
+					allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+					allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+					allocInfo.commandPool = commandPool;
+					allocInfo.commandBufferCount = 1;
+					vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer);
+					VkCommandBufferBeginInfo beginInfo{};
+					beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+					beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+					vkBeginCommandBuffer(commandBuffer, &beginInfo);
+				}
+
+				StagingRegion region = ring.allocate(uploadSize);
+				std::memcpy(region.data, source.data(), uploadSize);
+				VkBufferCopy copyRegion{};
+				copyRegion.srcOffset = region.offset;
+				copyRegion.dstOffset = (i * uploadSize) % (destinationSize - uploadSize + 1) / 16 * 16;
+				copyRegion.size = uploadSize;
+				vkCmdCopyBuffer(commandBuffer, region.buffer, destination, 1, &copyRegion);
+
+				if ((recorded += uploadSize) >= submitSize)
+					submit();
+			}
+			if (commandBuffer != VK_NULL_HANDLE)
+				submit();
+			vkQueueWaitIdle(queue);
+			auto end = std::chrono::high_resolution_clock::now();
+
+			while (!inFlight.empty()) {
+				ring.wait(inFlight.front().first);
+				vkFreeCommandBuffers(device, commandPool, 1, &inFlight.front().second);
+				inFlight.pop_front();
+			}
+
+			double seconds = std::chrono::duration<double>(end - start).count();
+			double megabytes = static_cast<double>(uploadCount) * uploadSize / (1024.0 * 1024.0);
+			std::cout << "staging benchmark, " << name << ": " << uploadCount << " x " << uploadSize / 1024 << "KB, "
+				<< megabytes / seconds << " MB/s, " << ring.stalls - stallsBefore << " stalls on a full ring\n";
+		};
+		stream("small", 65536, 4 * 1024);
+		stream("large", 128, 8ull << 20);
+
+		vkDestroyBuffer(device, destination, nullptr);
+		allocator.free(destinationMemory);
+		vkDestroyCommandPool(device, commandPool, nullptr);
+	}
+}
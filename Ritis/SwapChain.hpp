@@ -21,16 +21,17 @@ namespace engine {
 
     class SwapChain {
     public:
-        static constexpr int MAX_FRAMES_IN_FLIGHT = 2; // max 2 command buffers
+        static constexpr int MAX_FRAMES_IN_FLIGHT = 3;     // upper bound for framesInFlight, per frame arrays can be sized with it
+        static constexpr int DEFAULT_FRAMES_IN_FLIGHT = 2;
 
-        SwapChain(Device& deviceRef, VkExtent2D windowExtent);
-        SwapChain(Device& deviceRef, VkExtent2D windowExtent, std::shared_ptr<SwapChain> previous);
+        SwapChain(Device& deviceRef, VkExtent2D windowExtent, uint32_t framesInFlight = DEFAULT_FRAMES_IN_FLIGHT);
+        SwapChain(Device& deviceRef, VkExtent2D windowExtent, std::shared_ptr<SwapChain> previous); // keeps previous's frames in flight
         ~SwapChain();
 
         SwapChain(const SwapChain&) = delete;
         SwapChain& operator=(const SwapChain&) = delete;
 
-        VkFramebuffer getFrameBuffer(int index) { return swapChainFramebuffers[index]; }
+        VkFramebuffer getFrameBuffer(int index) { return swapChainFramebuffers[index * framesInFlight + currentFrame]; } // the image's framebuffer with this frame's depth
         VkRenderPass getRenderPass() { return renderPass; }
         VkImageView getImageView(int index) { return swapChainImageViews[index]; }
         size_t imageCount() { return swapChainImages.size(); }
@@ -43,9 +44,11 @@ namespace engine {
             return static_cast<float>(swapChainExtent.width) / static_cast<float>(swapChainExtent.height);
         }
         VkFormat findDepthFormat();
+        uint32_t getFramesInFlight() { return framesInFlight; }
 
         VkResult acquireNextImage(uint32_t* imageIndex);
-        VkResult submitCommandBuffers(const VkCommandBuffer* buffers, uint32_t* imageIndex);
+        void waitForFrameSlot();    // until the next frame's slot is free, acquireNextImage does it too but it can be done earlier
+        VkResult submitCommandBuffers(const VkCommandBuffer* buffers, uint32_t* imageIndex, uint32_t bufferCount = 1);
 
         bool compareSwapFormats(const SwapChain& swapChain) const { // if true, this and given are compatibly SwapChains
             return swapChain.swapChainDepthFormat == swapChainDepthFormat && swapChain.swapChainImageFormat == swapChainImageFormat;
@@ -71,11 +74,11 @@ namespace engine {
         VkFormat swapChainDepthFormat;
         VkExtent2D swapChainExtent;
 
-        std::vector<VkFramebuffer> swapChainFramebuffers;
+        std::vector<VkFramebuffer> swapChainFramebuffers;   // one per swapchain image and frame in flight
         VkRenderPass renderPass;
 
-        std::vector<VkImage> depthImages;
-        std::vector<VkDeviceMemory> depthImageMemorys;
+        std::vector<VkImage> depthImages;                   // one per frame in flight, only a frame being rendered uses one
+        std::vector<Allocation> depthImageMemorys;
         std::vector<VkImageView> depthImageViews;
         std::vector<VkImage> swapChainImages;
         std::vector<VkImageView> swapChainImageViews;
@@ -88,17 +91,21 @@ namespace engine {
 
         std::vector<VkSemaphore> imageAvailableSemaphores;
         std::vector<VkSemaphore> renderFinishedSemaphores;
-        std::vector<VkFence> inFlightFences;
-        std::vector<VkFence> imagesInFlight;
+        std::vector<uint64_t> frameValues;          // FrameTimeline value of each frame slot's last submission
+        std::vector<uint64_t> imageFrameValues;     // and of the last submission rendering to each image
         size_t currentFrame = 0;
+        uint32_t framesInFlight;    // 1 for lowest latency, up to MAX_FRAMES_IN_FLIGHT for most cpu / gpu overlap
     };
 
-    SwapChain::SwapChain(Device& deviceRef, VkExtent2D extent)
-        : device{ deviceRef }, windowExtent{ extent } {
+    SwapChain::SwapChain(Device& deviceRef, VkExtent2D extent, uint32_t framesInFlight)
+        : device{ deviceRef }, windowExtent{ extent }, framesInFlight{ framesInFlight } {
+        if (framesInFlight < 1 || framesInFlight > MAX_FRAMES_IN_FLIGHT) {
+            throw std::runtime_error("frames in flight must be between 1 and MAX_FRAMES_IN_FLIGHT!");
+        }
         init();
     }
     SwapChain::SwapChain(Device& deviceRef, VkExtent2D extent, std::shared_ptr<SwapChain> previous)
-        : device{ deviceRef }, windowExtent{ extent }, oldSwapChain{ previous } {
+        : device{ deviceRef }, windowExtent{ extent }, oldSwapChain{ previous }, framesInFlight{ previous->framesInFlight } {
         init();
 
         // clean up old swap chain since it's no longer needed
@@ -127,7 +134,7 @@ namespace engine {
         for (int i = 0; i < depthImages.size(); i++) {
             vkDestroyImageView(device.device(), depthImageViews[i], nullptr);
             vkDestroyImage(device.device(), depthImages[i], nullptr);
-            vkFreeMemory(device.device(), depthImageMemorys[i], nullptr);
+            device.allocator().free(depthImageMemorys[i]);
         }
 
         for (auto framebuffer : swapChainFramebuffers) {
@@ -137,20 +144,14 @@ namespace engine {
         vkDestroyRenderPass(device.device(), renderPass, nullptr);
 
         // cleanup synchronization objects
-        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        for (size_t i = 0; i < framesInFlight; i++) {
             vkDestroySemaphore(device.device(), renderFinishedSemaphores[i], nullptr);
             vkDestroySemaphore(device.device(), imageAvailableSemaphores[i], nullptr);
-            vkDestroyFence(device.device(), inFlightFences[i], nullptr);
         }
     }
 
     VkResult SwapChain::acquireNextImage(uint32_t* imageIndex) {
-        vkWaitForFences(                    // cpu halts here if additional command buffer, beyond 2 at once
-            device.device(),
-            1,
-            &inFlightFences[currentFrame],
-            VK_TRUE,
-            std::numeric_limits<uint64_t>::max());
+        waitForFrameSlot();
 
         VkResult result = vkAcquireNextImageKHR(
             device.device(),
@@ -163,50 +164,57 @@ namespace engine {
         return result;
     }
 
+    void SwapChain::waitForFrameSlot() {
+        device.frameTimeline().wait(frameValues[currentFrame]);    // the frame this slot submitted last, cpu halts here beyond framesInFlight at once
+    }
+
+    // signals the next FrameTimeline value, which waitForFrameSlot waits on.
+    // the binary semaphores stay, presentation can't wait on a timeline semaphore
     VkResult SwapChain::submitCommandBuffers(
-        const VkCommandBuffer* buffers, uint32_t* imageIndex) {
-        if (imagesInFlight[*imageIndex] != VK_NULL_HANDLE) {
-            vkWaitForFences(device.device(), 1, &imagesInFlight[*imageIndex], VK_TRUE, UINT64_MAX);
-        }
-        imagesInFlight[*imageIndex] = inFlightFences[currentFrame];
+        const VkCommandBuffer* buffers, uint32_t* imageIndex, uint32_t bufferCount) {
+        FrameTimeline& timeline = device.frameTimeline();
+        timeline.wait(imageFrameValues[*imageIndex]);   // an earlier frame slot may still be rendering to this image
 
-        VkSubmitInfo submitInfo = {};
-        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        uint64_t frameValue = timeline.next();
+        frameValues[currentFrame] = frameValue;
+        imageFrameValues[*imageIndex] = frameValue;
 
         VkSemaphore waitSemaphores[] = { imageAvailableSemaphores[currentFrame] };
         VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
+        VkSemaphore signalSemaphores[] = { renderFinishedSemaphores[currentFrame], timeline.getSemaphore() };
+        uint64_t signalValues[] = { 0, frameValue };    // the binary semaphore's value is ignored
+
+        VkTimelineSemaphoreSubmitInfo timelineInfo = {};
+        timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+        timelineInfo.signalSemaphoreValueCount = 2;
+        timelineInfo.pSignalSemaphoreValues = signalValues;
+
+        VkSubmitInfo submitInfo = {};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.pNext = &timelineInfo;
         submitInfo.waitSemaphoreCount = 1;
         submitInfo.pWaitSemaphores = waitSemaphores;
         submitInfo.pWaitDstStageMask = waitStages;
-
-        submitInfo.commandBufferCount = 1;
+        submitInfo.commandBufferCount = bufferCount;
         submitInfo.pCommandBuffers = buffers;
-
-        VkSemaphore signalSemaphores[] = { renderFinishedSemaphores[currentFrame] };
-        submitInfo.signalSemaphoreCount = 1;
+        submitInfo.signalSemaphoreCount = 2;
         submitInfo.pSignalSemaphores = signalSemaphores;
 
-        vkResetFences(device.device(), 1, &inFlightFences[currentFrame]);
-        if (vkQueueSubmit(device.graphicsQueue(), 1, &submitInfo, inFlightFences[currentFrame]) !=
-            VK_SUCCESS) {
+        if (vkQueueSubmit(device.graphicsQueue(), 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
             throw std::runtime_error("failed to submit draw command buffer!");
         }
 
         VkPresentInfoKHR presentInfo = {};
         presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-
         presentInfo.waitSemaphoreCount = 1;
         presentInfo.pWaitSemaphores = signalSemaphores;
-
-        VkSwapchainKHR swapChains[] = { swapChain };
         presentInfo.swapchainCount = 1;
-        presentInfo.pSwapchains = swapChains;
-
+        presentInfo.pSwapchains = &swapChain;
         presentInfo.pImageIndices = imageIndex;
 
         auto result = vkQueuePresentKHR(device.presentQueue(), &presentInfo);
 
-        currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+        currentFrame = (currentFrame + 1) % framesInFlight;
 
         return result;
     }
@@ -358,9 +366,10 @@ namespace engine {
     }
 
     void SwapChain::createFramebuffers() {
-        swapChainFramebuffers.resize(imageCount());
-        for (size_t i = 0; i < imageCount(); i++) {
-            std::array<VkImageView, 2> attachments = { swapChainImageViews[i], depthImageViews[i] };
+        swapChainFramebuffers.resize(imageCount() * framesInFlight);
+        for (size_t i = 0; i < swapChainFramebuffers.size(); i++) {
+            std::array<VkImageView, 2> attachments = {
+                swapChainImageViews[i / framesInFlight], depthImageViews[i % framesInFlight] };
 
             VkExtent2D swapChainExtent = getSwapChainExtent();
             VkFramebufferCreateInfo framebufferInfo = {};
@@ -387,9 +396,11 @@ namespace engine {
         swapChainDepthFormat = depthFormat;
         VkExtent2D swapChainExtent = getSwapChainExtent();
 
-        depthImages.resize(imageCount());
-        depthImageMemorys.resize(imageCount());
-        depthImageViews.resize(imageCount());
+        // depth is cleared on load and never stored, so it only has to live through one frame's render pass:
+        // one per frame in flight instead of per swapchain image, transient so tilers can keep it on chip and back it lazily
+        depthImages.resize(framesInFlight);
+        depthImageMemorys.resize(framesInFlight);
+        depthImageViews.resize(framesInFlight);
 
         for (int i = 0; i < depthImages.size(); i++) {
             VkImageCreateInfo imageInfo{};
@@ -403,7 +414,7 @@ namespace engine {
             imageInfo.format = depthFormat;
             imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
             imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-            imageInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+            imageInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
             imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
             imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
             imageInfo.flags = 0;
@@ -412,7 +423,8 @@ namespace engine {
                 imageInfo,
                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
                 depthImages[i],
-                depthImageMemorys[i]);
+                depthImageMemorys[i],
+                VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT);
 
             VkImageViewCreateInfo viewInfo{};
             viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
@@ -429,27 +441,30 @@ namespace engine {
                 throw std::runtime_error("failed to create texture image view!");
             }
         }
+
+        VkMemoryRequirements requirements;
+        vkGetImageMemoryRequirements(device.device(), depthImages[0], &requirements);
+        bool lazy = device.hasMemoryType(1u << depthImageMemorys[0].memoryType, VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT);
+        VkDeviceSize saved = imageCount() > framesInFlight ? (imageCount() - framesInFlight) * requirements.size : 0;
+        std::cout << "depth: " << framesInFlight << " x " << (requirements.size >> 10) << "KB for " << imageCount() << " swapchain images at "
+            << swapChainExtent.width << "x" << swapChainExtent.height << ", " << (saved >> 10) << "KB saved"
+            << (lazy ? ", lazily allocated" : "") << std::endl;
     }
 
     void SwapChain::createSyncObjects() {
-        imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-        renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-        inFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
-        imagesInFlight.resize(imageCount(), VK_NULL_HANDLE);
+        imageAvailableSemaphores.resize(framesInFlight);
+        renderFinishedSemaphores.resize(framesInFlight);
+        frameValues.resize(framesInFlight, 0);     // 0 is always reached, nothing to wait for yet
+        imageFrameValues.resize(imageCount(), 0);
 
         VkSemaphoreCreateInfo semaphoreInfo = {};
         semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
-        VkFenceCreateInfo fenceInfo = {};
-        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-        fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-
-        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        for (size_t i = 0; i < framesInFlight; i++) {
             if (vkCreateSemaphore(device.device(), &semaphoreInfo, nullptr, &imageAvailableSemaphores[i]) !=
                 VK_SUCCESS ||
                 vkCreateSemaphore(device.device(), &semaphoreInfo, nullptr, &renderFinishedSemaphores[i]) !=
-                VK_SUCCESS ||
-                vkCreateFence(device.device(), &fenceInfo, nullptr, &inFlightFences[i]) != VK_SUCCESS) {
+                VK_SUCCESS) {
                 throw std::runtime_error("failed to create synchronization objects for a frame!");
             }
         }
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <atomic>
+#include <memory>
+#include <exception>
+#include <type_traits>
+#include <algorithm>
+
+namespace engine {
+	/*
+		Fixed set of worker threads pulling jobs from a shared queue.
+		submit() returns a future for one job, parallelFor() splits an index range across the workers and blocks until it's done.
+
+		usage:
+			ThreadPool pool{};	// one thread per core
+			pool.parallelFor(chunkCount, [&](size_t i) { parseChunk(i); });
+	*/
+	class ThreadPool {
+		std::vector<std::thread> workers;
+		std::deque<std::function<void()>> jobs;
+		std::mutex mutex;
+		std::condition_variable condition;
+		bool stopping = false;
+
+		auto workerLoop() -> void;
+	public:
+		ThreadPool(size_t threadCount = 0);	// 0 = hardware concurrency
+		~ThreadPool();
+
+		ThreadPool(const ThreadPool&) = delete;
+		auto operator=(const ThreadPool&) -> ThreadPool& = delete;
+
+		template <typename F>
+		auto submit(F&& job) -> std::future<std::invoke_result_t<F>>;
+		auto parallelFor(size_t count, const std::function<void(size_t)>& body) -> void;
+
+		auto getThreadCount() const -> size_t { return this->workers.size(); }
+	};
+
+	ThreadPool::ThreadPool(size_t threadCount) {
+		if (threadCount == 0)
+			threadCount = std::thread::hardware_concurrency();
+		if (threadCount == 0)	// hardware_concurrency is allowed to return 0 if it can't tell
+			threadCount = 1;
+
+		this->workers.reserve(threadCount);
+		for (size_t i = 0; i < threadCount; i++)
+			this->workers.emplace_back([this] { this->workerLoop(); });
+	}
+	ThreadPool::~ThreadPool() {
+		{
+			std::lock_guard<std::mutex> lock{ this->mutex };
+			this->stopping = true;
+		}
+		this->condition.notify_all();
+		for (auto& worker : this->workers)
+			worker.join();	// queued jobs are drained before the workers exit
+	}
+
+	auto ThreadPool::workerLoop() -> void {
+		while (true) {
+			std::function<void()> job;
+			{
+				std::unique_lock<std::mutex> lock{ this->mutex };
+				this->condition.wait(lock, [this] { return this->stopping || !this->jobs.empty(); });
+				if (this->jobs.empty()) return;	// stopping and nothing left
+				job = std::move(this->jobs.front());
+				this->jobs.pop_front();
+			}
+			job();
+		}
+	}
+
+	template <typename F>
+	auto ThreadPool::submit(F&& job) -> std::future<std::invoke_result_t<F>> {
+		using Result = std::invoke_result_t<F>;
+		// packaged_task is move only but std::function needs copyable, so it lives behind a shared_ptr
+		auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(job));
+		std::future<Result> result = task->get_future();
+		{
+			std::lock_guard<std::mutex> lock{ this->mutex };
+			this->jobs.emplace_back([task] { (*task)(); });
+		}
+		this->condition.notify_one();
+		return result;
+	}
+
+	/*
+		Runs body(0..count-1) across the workers and the calling thread, then rethrows the first exception thrown by body (if any).
+		The caller pulls indices too and only waits on indices that were actually started, so calling this from inside
+		a job on the same pool can't deadlock, it just runs with fewer helpers.
+	*/
+	auto ThreadPool::parallelFor(size_t count, const std::function<void(size_t)>& body) -> void {
+		if (count == 0) return;
+
+		struct State {
+			std::atomic<size_t> next{ 0 };
+			size_t count;
+			size_t finished = 0;
+			std::function<void(size_t)> body;
+			std::exception_ptr error;
+			std::mutex mutex;
+			std::condition_variable done;
+		};
+		auto state = std::make_shared<State>();	// shared, helpers that start late may outlive this call
+		state->count = count;
+		state->body = body;
+
+		auto work = [state] {
+			while (true) {
+				size_t i = state->next.fetch_add(1);
+				if (i >= state->count) return;
+				std::exception_ptr error;
+				try {
+					state->body(i);
+				}
+				catch (...) {
+					error = std::current_exception();
+				}
+				std::lock_guard<std::mutex> lock{ state->mutex };
+				if (error && !state->error)
+					state->error = error;
+				if (++state->finished == state->count)
+					state->done.notify_all();
+			}
+		};
+
+		size_t helpers = std::min(count - 1, this->workers.size());
+		{
+			std::lock_guard<std::mutex> lock{ this->mutex };
+			for (size_t i = 0; i < helpers; i++)
+				this->jobs.emplace_back(work);
+		}
+		this->condition.notify_all();
+
+		work();	// caller takes indices as well instead of sitting idle
+
+		std::unique_lock<std::mutex> lock{ state->mutex };
+		state->done.wait(lock, [&] { return state->finished == state->count; });
+		if (state->error)
+			std::rethrow_exception(state->error);
+	}
+}
@@ -0,0 +1,413 @@
+#pragma once
+
+#include "StagingRing.hpp"
+
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <cassert>
+#include <stdexcept>
+#include <cstring>
+
+namespace engine {
+	struct UploadBatcherStats {
+		uint64_t copies = 0;
+		uint64_t submits = 0;
+		uint64_t bytesUploaded = 0;		// through upload(), staged by the batcher itself
+	};
+
+	/*
+		Records buffer and image copies from any number of callers into one command buffer, submitted together
+		instead of each copy waiting for the queue to go idle.
+		with a dedicated transfer queue the copies run there, alongside rendering. the batch ends by releasing every destination to the
+		graphics family and signals a timeline semaphore, a short graphics queue submission waits on it, acquires them and signals a second
+		one. each timeline is only ever signaled from one queue, so its values can't go backwards however the two queues interleave.
+		without one, everything goes to the graphics queue and a plain barrier is enough.
+		every call returns the ticket of the batch it was recorded into. callers either wait(ticket) when they need the data on the gpu,
+		or carry on and check isComplete(ticket) later. submit() sends the batch off, wait() on a ticket that's still recording submits it.
+		staging memory used by upload() comes from the StagingRing and is released when the batch's fence signals.
+		either way the copies are visible to vertex input, shaders and indirect reads of everything submitted to the graphics queue afterwards.
+		destinations may be used on the graphics queue before (their old contents are discarded), copy sources must not have been written
+		on another queue family. images have to be in TRANSFER_DST_OPTIMAL already.
+		upload() and the copy calls are thread safe and never touch a queue. submit(), wait() and waitIdle() submit to the transfer and
+		graphics queues, which need external synchronization, so they belong on the thread that submits frames, the one that created the batcher.
+
+		usage:
+			uint64_t ticket = batcher.upload(vertices.data(), size, vertexBuffer);
+			...
+			batcher.submit();		// once a frame, or
+			batcher.wait(ticket);	// when the data has to be there now
+	*/
+	class UploadBatcher {
+		struct Batch {
+			uint64_t ticket;
+			uint64_t stagingTicket;
+			VkCommandBuffer transferCommands;
+			VkCommandBuffer acquireCommands;	// graphics queue side of the ownership transfer, VK_NULL_HANDLE without a transfer queue
+		};
+
+		VkDevice device;
+		VkQueue graphicsQueue;
+		VkQueue transferQueue;
+		uint32_t graphicsFamily;
+		uint32_t transferFamily;
+		StagingRing& staging;
+		VkCommandPool transferPool;
+		VkCommandPool graphicsPool = VK_NULL_HANDLE;
+		VkSemaphore timeline;				// ticket t has finished at t, signaled by whichever queue runs the batch's last half
+		VkSemaphore transferTimeline = VK_NULL_HANDLE;	// transfer half of ticket t done at t, only with a transfer queue
+
+		VkCommandBuffer recording = VK_NULL_HANDLE;
+		std::vector<VkBufferMemoryBarrier> bufferReleases;	// one per copy destination in the recording batch, with a transfer queue
+		std::vector<VkImageMemoryBarrier> imageReleases;
+		uint64_t nextTicket = 1;			// ticket of the batch being recorded
+		uint64_t completedTicket = 0;		// every ticket <= this has finished
+		std::deque<Batch> inFlight;
+		UploadBatcherStats stats{};
+		std::mutex mutex;
+		std::thread::id queueThread;		// the only one allowed to submit, see onQueueThread
+
+		auto createCommandPool(uint32_t queueFamily) -> VkCommandPool;
+		auto createTimeline() -> VkSemaphore;
+		auto allocateCommandBuffer(VkCommandPool pool) -> VkCommandBuffer;
+		auto begin() -> VkCommandBuffer;
+		auto release(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size) -> void;
+		auto submitRecording() -> void;
+		auto retire(bool wait) -> bool;
+		auto ownershipTransfer() const -> bool { return this->transferFamily != this->graphicsFamily; }
+	public:
+		UploadBatcher(VkDevice device, VkQueue graphicsQueue, uint32_t graphicsFamily, VkQueue transferQueue, uint32_t transferFamily, StagingRing& staging);
+		~UploadBatcher();
+
+		UploadBatcher(const UploadBatcher&) = delete;
+		UploadBatcher& operator=(const UploadBatcher&) = delete;
+
+		auto upload(const void* data, VkDeviceSize size, VkBuffer destination, VkDeviceSize destinationOffset = 0) -> uint64_t;	// stages data and copies it
+		auto copyBuffer(VkBuffer source, VkBuffer destination, VkDeviceSize size, VkDeviceSize sourceOffset = 0, VkDeviceSize destinationOffset = 0) -> uint64_t;
+		auto copyBufferToImage(VkBuffer buffer, VkDeviceSize bufferOffset, VkImage image, uint32_t width, uint32_t height, uint32_t layerCount) -> uint64_t;	// image in TRANSFER_DST_OPTIMAL
+
+		auto submit() -> uint64_t;			// ticket of the batch submitted, or of the last one when nothing was recorded
+		auto isComplete(uint64_t ticket) -> bool;
+		auto wait(uint64_t ticket) -> void;
+		auto waitIdle() -> void;
+
+		auto getStats() -> UploadBatcherStats;
+		auto onQueueThread() const -> bool { return std::this_thread::get_id() == this->queueThread; }
+	};
+
+	UploadBatcher::UploadBatcher(VkDevice device, VkQueue graphicsQueue, uint32_t graphicsFamily, VkQueue transferQueue, uint32_t transferFamily, StagingRing& staging) :
+		device{ device },
+		graphicsQueue{ graphicsQueue },
+		transferQueue{ transferQueue },
+		graphicsFamily{ graphicsFamily },
+		transferFamily{ transferFamily },
+		staging{ staging },
+		queueThread{ std::this_thread::get_id() }
+	{
+		this->transferPool = this->createCommandPool(transferFamily);
+		this->timeline = this->createTimeline();
+		if (this->ownershipTransfer()) {
+			this->graphicsPool = this->createCommandPool(graphicsFamily);
+			this->transferTimeline = this->createTimeline();
+		}
+	}
+	UploadBatcher::~UploadBatcher() {
+		this->waitIdle();
+		vkDestroySemaphore(this->device, this->timeline, nullptr);
+		if (this->transferTimeline != VK_NULL_HANDLE)
+			vkDestroySemaphore(this->device, this->transferTimeline, nullptr);
+		vkDestroyCommandPool(this->device, this->transferPool, nullptr);
+		if (this->graphicsPool != VK_NULL_HANDLE)
+			vkDestroyCommandPool(this->device, this->graphicsPool, nullptr);
+	}
+
+	auto UploadBatcher::upload(const void* data, VkDeviceSize size, VkBuffer destination, VkDeviceSize destinationOffset) -> uint64_t {
+		std::lock_guard<std::mutex> lock{ this->mutex };
+		// never submits, the queues belong to the frame thread. once the batch fills the ring the rest goes to overflow buffers
+		StagingRegion region = this->staging.allocate(size);
+		std::memcpy(region.data, data, size);	// coherent, visible to the copy without a flush
+
+		VkBufferCopy copyRegion{};
+		copyRegion.srcOffset = region.offset;
+		copyRegion.dstOffset = destinationOffset;
+		copyRegion.size = size;
+		vkCmdCopyBuffer(this->begin(), region.buffer, destination, 1, &copyRegion);
+		this->release(destination, destinationOffset, size);
+
+		this->stats.copies++;
+		this->stats.bytesUploaded += size;
+		return this->nextTicket;
+	}
+	auto UploadBatcher::copyBuffer(VkBuffer source, VkBuffer destination, VkDeviceSize size, VkDeviceSize sourceOffset, VkDeviceSize destinationOffset) -> uint64_t {
+		std::lock_guard<std::mutex> lock{ this->mutex };
+		VkBufferCopy copyRegion{};
+		copyRegion.srcOffset = sourceOffset;
+		copyRegion.dstOffset = destinationOffset;
+		copyRegion.size = size;
+		vkCmdCopyBuffer(this->begin(), source, destination, 1, &copyRegion);
+		this->release(destination, destinationOffset, size);
+
+		this->stats.copies++;
+		return this->nextTicket;
+	}
+	auto UploadBatcher::copyBufferToImage(VkBuffer buffer, VkDeviceSize bufferOffset, VkImage image, uint32_t width, uint32_t height, uint32_t layerCount) -> uint64_t {
+		std::lock_guard<std::mutex> lock{ this->mutex };
+		VkBufferImageCopy region{};
+		region.bufferOffset = bufferOffset;
+		region.bufferRowLength = 0;
+		region.bufferImageHeight = 0;
+
+		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		region.imageSubresource.mipLevel = 0;
+		region.imageSubresource.baseArrayLayer = 0;
+		region.imageSubresource.layerCount = layerCount;
+
+		region.imageOffset = { 0, 0, 0 };
+		region.imageExtent = { width, height, 1 };
+		vkCmdCopyBufferToImage(this->begin(), buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+		if (this->ownershipTransfer()) {
+			VkImageMemoryBarrier barrier{};
+			barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;	// the layout stays, whoever samples the image transitions it
+			barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			barrier.srcQueueFamilyIndex = this->transferFamily;
+			barrier.dstQueueFamilyIndex = this->graphicsFamily;
+			barrier.image = image;
+			barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, layerCount };
+			this->imageReleases.push_back(barrier);
+		}
+		this->stats.copies++;
+		return this->nextTicket;
+	}
+
+	auto UploadBatcher::submit() -> uint64_t {
+		assert(this->onQueueThread() && "UploadBatcher::submit submits to the queues, call it on the thread that submits frames");
+		std::lock_guard<std::mutex> lock{ this->mutex };
+		if (this->recording == VK_NULL_HANDLE)
+			return this->nextTicket - 1;
+		uint64_t ticket = this->nextTicket;
+		this->submitRecording();
+		return ticket;
+	}
+	auto UploadBatcher::isComplete(uint64_t ticket) -> bool {
+		std::lock_guard<std::mutex> lock{ this->mutex };
+		if (ticket >= this->nextTicket) return false;	// still recording
+		while (ticket > this->completedTicket && this->retire(false)) {}
+		return ticket <= this->completedTicket;
+	}
+	auto UploadBatcher::wait(uint64_t ticket) -> void {
+		assert(this->onQueueThread() && "UploadBatcher::wait may submit to the queues, call it on the thread that submits frames");
+		std::lock_guard<std::mutex> lock{ this->mutex };
+		if (ticket >= this->nextTicket && this->recording != VK_NULL_HANDLE)
+			this->submitRecording();
+		while (ticket > this->completedTicket && this->retire(true)) {}
+	}
+	auto UploadBatcher::waitIdle() -> void {
+		assert(this->onQueueThread() && "UploadBatcher::waitIdle submits to the queues, call it on the thread that submits frames");
+		std::lock_guard<std::mutex> lock{ this->mutex };
+		if (this->recording != VK_NULL_HANDLE)
+			this->submitRecording();
+		while (this->retire(true)) {}
+	}
+
+	auto UploadBatcher::getStats() -> UploadBatcherStats {
+		std::lock_guard<std::mutex> lock{ this->mutex };
+		return this->stats;
+	}
+
+	auto UploadBatcher::createCommandPool(uint32_t queueFamily) -> VkCommandPool {
+		VkCommandPoolCreateInfo poolInfo{};
+		poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		poolInfo.queueFamilyIndex = queueFamily;
+		poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;	// each command buffer is recorded once, submitted once, then freed
+		VkCommandPool pool;
+		if (vkCreateCommandPool(this->device, &poolInfo, nullptr, &pool) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create upload command pool!");
+		}
+		return pool;
+	}
+	auto UploadBatcher::createTimeline() -> VkSemaphore {
+		VkSemaphoreTypeCreateInfo typeInfo{};
+		typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+		typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+		typeInfo.initialValue = 0;
+		VkSemaphoreCreateInfo semaphoreInfo{};
+		semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+		semaphoreInfo.pNext = &typeInfo;
+		VkSemaphore semaphore;
+		if (vkCreateSemaphore(this->device, &semaphoreInfo, nullptr, &semaphore) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create upload timeline semaphore!");
+		}
+		return semaphore;
+	}
+	// allocated and begun. caller holds the mutex
+	auto UploadBatcher::allocateCommandBuffer(VkCommandPool pool) -> VkCommandBuffer {
+		VkCommandBufferAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocInfo.commandPool = pool;
+		allocInfo.commandBufferCount = 1;
+		VkCommandBuffer commandBuffer;
+		if (vkAllocateCommandBuffers(this->device, &allocInfo, &commandBuffer) != VK_SUCCESS) {
+			throw std::runtime_error("failed to allocate upload command buffer!");
+		}
+
+		VkCommandBufferBeginInfo beginInfo{};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		vkBeginCommandBuffer(commandBuffer, &beginInfo);
+		return commandBuffer;
+	}
+	// command buffer of the batch being recorded, started on first use. caller holds the mutex
+	auto UploadBatcher::begin() -> VkCommandBuffer {
+		if (this->recording == VK_NULL_HANDLE)
+			this->recording = this->allocateCommandBuffer(this->transferPool);
+		return this->recording;
+	}
+	// hands a copy destination over to the graphics family at the end of the batch. caller holds the mutex
+	auto UploadBatcher::release(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size) -> void {
+		if (!this->ownershipTransfer()) return;
+		VkBufferMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.srcQueueFamilyIndex = this->transferFamily;
+		barrier.dstQueueFamilyIndex = this->graphicsFamily;
+		barrier.buffer = buffer;
+		barrier.offset = offset;
+		barrier.size = size;
+		this->bufferReleases.push_back(barrier);
+	}
+	// caller holds the mutex
+	auto UploadBatcher::submitRecording() -> void {
+		// what later graphics queue submissions (the frames drawing with the data) read
+		const VkAccessFlags readAccess = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+		const VkPipelineStageFlags readStages = VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+			VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;	// meshlet buffers are read by the cull shader
+		const uint64_t ticket = this->nextTicket;	// the value both timelines signal for this batch
+
+		Batch batch{ this->nextTicket, 0, this->recording, VK_NULL_HANDLE };
+		if (this->ownershipTransfer()) {
+			// release half, on the transfer queue. dst access and stages are ignored for a release
+			vkCmdPipelineBarrier(
+				this->recording,
+				VK_PIPELINE_STAGE_TRANSFER_BIT,
+				VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+				0,
+				0, nullptr,
+				static_cast<uint32_t>(this->bufferReleases.size()), this->bufferReleases.data(),
+				static_cast<uint32_t>(this->imageReleases.size()), this->imageReleases.data()
+			);
+		}
+		else {
+			VkMemoryBarrier barrier{};
+			barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.dstAccessMask = readAccess;
+			vkCmdPipelineBarrier(this->recording, VK_PIPELINE_STAGE_TRANSFER_BIT, readStages, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+		}
+		vkEndCommandBuffer(this->recording);
+
+		StagingTicket stagingTicket = this->staging.commit();	// everything staged since the last batch is read by this one
+		batch.stagingTicket = stagingTicket.id;
+
+		VkTimelineSemaphoreSubmitInfo timelineInfo{};
+		timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+		timelineInfo.signalSemaphoreValueCount = 1;
+		timelineInfo.pSignalSemaphoreValues = &ticket;
+
+		VkSubmitInfo submitInfo{};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.pNext = &timelineInfo;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &this->recording;
+		submitInfo.signalSemaphoreCount = 1;
+		submitInfo.pSignalSemaphores = this->ownershipTransfer() ? &this->transferTimeline : &this->timeline;
+		if (vkQueueSubmit(this->transferQueue, 1, &submitInfo, stagingTicket.fence) != VK_SUCCESS) {
+			throw std::runtime_error("failed to submit uploads!");
+		}
+
+		if (this->ownershipTransfer()) {
+			// acquire half, on the graphics queue once the copies are done. the same barriers with the read access the frames need
+			for (auto& barrier : this->bufferReleases) {
+				barrier.srcAccessMask = 0;
+				barrier.dstAccessMask = readAccess;
+			}
+			for (auto& barrier : this->imageReleases) {
+				barrier.srcAccessMask = 0;
+				barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+			}
+			batch.acquireCommands = this->allocateCommandBuffer(this->graphicsPool);
+			vkCmdPipelineBarrier(
+				batch.acquireCommands,
+				VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,		// chained to the semaphore wait below
+				readStages | VK_PIPELINE_STAGE_TRANSFER_BIT,
+				0,
+				0, nullptr,
+				static_cast<uint32_t>(this->bufferReleases.size()), this->bufferReleases.data(),
+				static_cast<uint32_t>(this->imageReleases.size()), this->imageReleases.data()
+			);
+			vkEndCommandBuffer(batch.acquireCommands);
+
+			VkTimelineSemaphoreSubmitInfo acquireTimelineInfo{};
+			acquireTimelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+			acquireTimelineInfo.waitSemaphoreValueCount = 1;
+			acquireTimelineInfo.pWaitSemaphoreValues = &ticket;
+			acquireTimelineInfo.signalSemaphoreValueCount = 1;
+			acquireTimelineInfo.pSignalSemaphoreValues = &ticket;
+
+			VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+			VkSubmitInfo acquireInfo{};
+			acquireInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+			acquireInfo.pNext = &acquireTimelineInfo;
+			acquireInfo.waitSemaphoreCount = 1;
+			acquireInfo.pWaitSemaphores = &this->transferTimeline;
+			acquireInfo.pWaitDstStageMask = &waitStage;
+			acquireInfo.commandBufferCount = 1;
+			acquireInfo.pCommandBuffers = &batch.acquireCommands;
+			acquireInfo.signalSemaphoreCount = 1;
+			acquireInfo.pSignalSemaphores = &this->timeline;
+			if (vkQueueSubmit(this->graphicsQueue, 1, &acquireInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+				throw std::runtime_error("failed to submit upload ownership acquire!");
+			}
+			this->bufferReleases.clear();
+			this->imageReleases.clear();
+		}
+
+		this->inFlight.push_back(batch);
+		this->recording = VK_NULL_HANDLE;
+		this->nextTicket++;
+		this->stats.submits++;
+	}
+	// frees the oldest batch once it has finished (or waits for it), acquire half included. caller holds the mutex
+	auto UploadBatcher::retire(bool wait) -> bool {
+		if (this->inFlight.empty()) return false;
+		Batch& oldest = this->inFlight.front();
+		uint64_t batchDone = oldest.ticket;
+		if (wait) {
+			VkSemaphoreWaitInfo waitInfo{};
+			waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+			waitInfo.semaphoreCount = 1;
+			waitInfo.pSemaphores = &this->timeline;
+			waitInfo.pValues = &batchDone;
+			if (vkWaitSemaphores(this->device, &waitInfo, UINT64_MAX) != VK_SUCCESS)
+				throw std::runtime_error("failed to wait for upload timeline semaphore!");
+		}
+		else {
+			uint64_t value = 0;
+			if (vkGetSemaphoreCounterValue(this->device, this->timeline, &value) != VK_SUCCESS)	// a lost device would otherwise never complete
+				throw std::runtime_error("failed to get upload timeline semaphore value!");
+			if (value < batchDone) return false;
+		}
+
+		this->staging.isComplete(oldest.stagingTicket);	// already signaled, lets the ring reuse the space now instead of when it runs full
+		vkFreeCommandBuffers(this->device, this->transferPool, 1, &oldest.transferCommands);
+		if (oldest.acquireCommands != VK_NULL_HANDLE)
+			vkFreeCommandBuffers(this->device, this->graphicsPool, 1, &oldest.acquireCommands);
+		this->completedTicket = oldest.ticket;
+		this->inFlight.pop_front();
+		return true;
+	}
+}
@@ -1,5 +1,7 @@
 C:\VulkanSDK\1.3.250.1\Bin\glslc.exe shaders/simpleShader.vert -o shaders/simpleShader.vert.spv
 C:\VulkanSDK\1.3.250.1\Bin\glslc.exe shaders/simpleShader.frag -o shaders/simpleShader.frag.spv
+C:\VulkanSDK\1.3.250.1\Bin\glslc.exe shaders/simpleShaderPacked.vert -o shaders/simpleShaderPacked.vert.spv
 C:\VulkanSDK\1.3.250.1\Bin\glslc.exe shaders/pointLight.vert -o shaders/pointLight.vert.spv
 C:\VulkanSDK\1.3.250.1\Bin\glslc.exe shaders/pointLight.frag -o shaders/pointLight.frag.spv
+C:\VulkanSDK\1.3.250.1\Bin\glslc.exe shaders/meshletCull.comp -o shaders/meshletCull.comp.spv
 pause
\ No newline at end of file
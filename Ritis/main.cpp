@@ -5,8 +5,16 @@
 #include <iostream>
 #include <stdexcept>
 
-int main() {
-    engine::FirstApp app{};
+int main(int argc, char** argv) {
+    engine::AppConfig config{};
+    try {
+        config = engine::AppConfig::fromArgs(argc, argv);
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    engine::FirstApp app{ config };
 
     try {
         app.run();
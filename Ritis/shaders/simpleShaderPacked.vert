@@ -0,0 +1,48 @@
+#version 450
+// VERTEX SHADER, Model::PackedVertex variant of simpleShader.vert
+
+layout(location = 0) in vec4 position;	// unorm16, 0-1 within the mesh bounds. modelMatrix already includes the bounds scale and offset
+layout(location = 1) in vec4 color;		// unorm8
+layout(location = 2) in vec2 normal;	// octahedral encoded snorm16
+layout(location = 3) in vec2 uv;		// half float
+
+layout(location = 0) out vec3 fragColor;
+layout(location = 1) out vec3 fragPosWorld;
+layout(location = 2) out vec3 fragNormalWorld;
+
+struct PointLight {
+	vec4 position; // ignore w
+	vec4 color; // w is intensity
+};
+
+layout(set = 0, binding = 0) uniform GlobalUbo {
+	mat4 projection;
+	mat4 view;
+	mat4 inverseView;
+	vec4 ambientLightColor; // w is intensity
+	PointLight pointLights[10];
+	int numLights;
+} ubo;
+
+layout(push_constant) uniform Push {
+	mat4 modelMatrix;		// model * dequantize
+	mat4 normalMatrix;		// actually a mat3, but mat4 for alignment
+} push;
+
+// inverse of Model::PackedVertex::pack, unfolds the bottom half of the octahedron
+vec3 decodeOctahedral(vec2 e) {
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.x += n.x >= 0.0 ? -t : t;
+	n.y += n.y >= 0.0 ? -t : t;
+	return normalize(n);
+}
+
+void main() {
+	vec4 positionWorld = push.modelMatrix * vec4(position.xyz, 1.0);
+	gl_Position = ubo.projection * ubo.view * positionWorld;
+
+	fragNormalWorld = normalize(mat3(push.normalMatrix) * decodeOctahedral(normal));
+	fragPosWorld = positionWorld.xyz;
+	fragColor = color.rgb;
+}
@@ -0,0 +1,410 @@
+#pragma once
+
+#include "../Device.hpp"
+#include "../Pipeline.hpp"
+#include "../GameObject.hpp"
+#include "../FrameInfo.hpp"
+#include "../Buffer.hpp"
+#include "../Descriptors.hpp"
+#include "../SwapChain.hpp"
+#include "SimpleRenderSystem.hpp"
+
+#define GLM_FORCE_RADIANS					// functions expect radians, not degrees
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE			// Depth buffer values will range from 0 to 1, not -1 to 1
+#include <glm/glm.hpp>
+
+// std
+#include <memory>
+#include <vector>
+#include <stdexcept>
+#include <unordered_map>
+#include <cstring>
+#include <iostream>
+
+#include "../Camera.hpp"
+
+namespace engine {
+	constexpr uint32_t MESHLET_INITIAL_DRAWS = 1 << 16;	// indirect draw slots per frame (1.25MB) to start with, a frame needing more doubles them
+	constexpr uint32_t MESHLET_MAX_MODELS = 64;			// meshlet models alive at once (plus ones destroyed in the last frames in flight), each needs its own descriptor set
+	constexpr uint32_t MESHLET_CULL_GROUP_SIZE = 64;	// local_size_x in meshletCull.comp
+
+	struct MeshletCullPushConstants {
+		glm::mat4 modelMatrix{ 1.0f };
+		glm::vec4 cameraObjectSpace{};	// camera position in model space, the cone test runs there so non-uniform scale doesn't skew it
+		uint32_t meshletCount;
+		uint32_t commandOffset;			// first slot of the indirect buffer this object writes
+		uint32_t coneCulling;
+		float radiusScale;				// largest axis scale of modelMatrix, keeps world space spheres conservative
+	};
+
+	struct MeshletCullStats {	// matches the Stats block in meshletCull.comp
+		uint32_t meshletsVisible = 0;
+		uint32_t meshletsFrustumCulled = 0;
+		uint32_t meshletsBackfaceCulled = 0;
+		uint32_t trianglesVisible = 0;
+		uint32_t trianglesCulled = 0;
+	};
+
+	/*
+		Draws models that have meshlets (see Model::Builder::buildMeshlets) with per cluster culling:
+		cull() records a compute pass, one invocation per meshlet, that tests each cluster's bounding sphere against the frustum and its
+		normal cone against the camera, then writes an indexed indirect draw with instanceCount 0 or 1.
+		render() then issues those draws inside the render pass. only core vulkan 1.0 (compute + indirect draws), so lavapipe runs it too.
+
+		back-face culling assumes closed meshes, the pipelines here use VK_CULL_MODE_NONE so open meshes show their inside.
+		so it only runs on models whose Builder found them closed (Model::isClosed), open ones like the vase keep every cluster,
+		and setBackfaceCulling(false) turns it off for all of them.
+
+		usage (per frame):
+			meshletRenderSystem.cull(frameInfo);	// before beginSwapChainRenderPass, dispatches aren't allowed inside a render pass
+			...begin render pass...
+			meshletRenderSystem.render(frameInfo);
+	*/
+	class MeshletRenderSystem {
+		Device& device;
+		VkRenderPass renderPass;
+		uint32_t framesInFlight;
+		bool backfaceCulling = true;
+		MeshletCullStats stats{};
+
+		std::unique_ptr<DescriptorPool> descriptorPool;
+		std::unique_ptr<DescriptorSetLayout> frameSetLayout;	// set 1: indirect commands and stats, one per frame in flight
+		std::unique_ptr<DescriptorSetLayout> meshletSetLayout;	// set 2: one model's meshlets
+		std::vector<std::unique_ptr<Buffer>> drawBuffers;
+		std::vector<std::unique_ptr<Buffer>> statsBuffers;		// host visible so the cpu can read last frame's counters
+		std::vector<VkDescriptorSet> frameDescriptorSets;
+		struct MeshletSet {
+			VkDescriptorSet descriptorSet;
+			std::weak_ptr<Model> model;		// expires when the model is destroyed, cull() then retires the set
+		};
+		struct RetiredSet {
+			VkDescriptorSet descriptorSet;
+			uint64_t frame;					// cull() call it was retired in
+		};
+		std::unordered_map<uint64_t, MeshletSet> meshletDescriptorSets;	// by Model::getId, so a new model at a freed model's address never finds its set
+		std::vector<RetiredSet> retiredSets;	// sets of destroyed models, frames still in flight may have them bound
+		uint64_t cullFrame = 0;
+
+		struct MeshletDraw {
+			std::shared_ptr<Model> model;
+			glm::mat4 modelMatrix;			// meshlet bounds are in unpacked object space, so culling uses this without the dequantize matrix
+			SimplePushConstantData push;
+			uint32_t commandOffset;
+		};
+		std::vector<MeshletDraw> draws;		// what cull() wrote this frame, consumed by render()
+
+		VkPipelineLayout cullPipelineLayout;
+		std::unique_ptr<ComputePipeline> cullPipeline;		// created the first time a meshlet model is drawn
+		VkPipelineLayout pipelineLayout;
+		std::unique_ptr<Pipeline> pipeline;
+		std::unique_ptr<Pipeline> packedPipeline;	// for VertexFormat::Packed models, created the first time one is drawn
+
+		auto createDescriptors() -> void;
+		auto createPipelineLayouts(VkDescriptorSetLayout) -> void;
+		auto createPipelines() -> void;
+		auto getPipeline(VertexFormat) -> Pipeline&;
+		auto getCullPipeline() -> ComputePipeline&;
+		auto getMeshletDescriptorSet(const std::shared_ptr<Model>&) -> VkDescriptorSet;
+		auto retireDestroyedModels() -> void;
+		auto createDrawBuffer(uint32_t frameIndex, uint32_t drawCount) -> void;
+	public:
+		MeshletRenderSystem(Device&, VkRenderPass, VkDescriptorSetLayout, uint32_t framesInFlight = SwapChain::DEFAULT_FRAMES_IN_FLIGHT);	// global set layout needs VK_SHADER_STAGE_COMPUTE_BIT
+		~MeshletRenderSystem();
+
+		MeshletRenderSystem(const MeshletRenderSystem&) = delete;
+		MeshletRenderSystem& operator=(const MeshletRenderSystem&) = delete;
+
+		auto cull(FrameInfo&) -> void;
+		auto render(FrameInfo&) -> void;
+
+		auto setBackfaceCulling(bool enabled) -> void { this->backfaceCulling = enabled; }
+		auto getStats() const -> const MeshletCullStats& { return this->stats; }	// counters from the last frame that finished on the gpu
+	};
+
+	MeshletRenderSystem::MeshletRenderSystem(Device& d, VkRenderPass renderPass, VkDescriptorSetLayout globalSetLayout, uint32_t framesInFlight) :
+		device{ d }, renderPass{ renderPass }, framesInFlight{ framesInFlight }
+	{
+		this->createDescriptors();
+		this->createPipelineLayouts(globalSetLayout);
+		this->createPipelines();
+	}
+	MeshletRenderSystem::~MeshletRenderSystem() {
+		vkDestroyPipelineLayout(this->device.device(), this->cullPipelineLayout, nullptr);
+		vkDestroyPipelineLayout(this->device.device(), this->pipelineLayout, nullptr);
+	}
+
+	auto MeshletRenderSystem::createDescriptors() -> void {
+		this->descriptorPool = DescriptorPool::Builder(this->device)
+			.setMaxSets(this->framesInFlight + MESHLET_MAX_MODELS)
+			.setPoolFlags(VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT)	// meshlet sets go back to the pool when their model is destroyed
+			.addPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, this->framesInFlight * 2 + MESHLET_MAX_MODELS)
+			.build();
+		this->frameSetLayout = DescriptorSetLayout::Builder(this->device)
+			.addBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+			.addBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+			.build();
+		this->meshletSetLayout = DescriptorSetLayout::Builder(this->device)
+			.addBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+			.build();
+
+		this->drawBuffers.resize(this->framesInFlight);
+		this->statsBuffers.resize(this->framesInFlight);
+		this->frameDescriptorSets.resize(this->framesInFlight);
+		for (uint32_t i = 0; i < this->framesInFlight; i++) {
+			this->statsBuffers[i] = std::make_unique<Buffer>(
+				this->device,
+				sizeof(MeshletCullStats),
+				1,
+				VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+			);
+			this->statsBuffers[i]->map();
+			std::memset(this->statsBuffers[i]->getMappedMemory(), 0, sizeof(MeshletCullStats));
+			this->createDrawBuffer(i, MESHLET_INITIAL_DRAWS);
+		}
+	}
+	// (re)creates the frame's indirect buffer and points its descriptor set at it. the frame slot must not be in flight
+	auto MeshletRenderSystem::createDrawBuffer(uint32_t frameIndex, uint32_t drawCount) -> void {
+		this->drawBuffers[frameIndex] = std::make_unique<Buffer>(
+			this->device,
+			sizeof(VkDrawIndexedIndirectCommand),
+			drawCount,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,	// written by the cull shader, read by vkCmdDrawIndexedIndirect
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+		);
+
+		auto drawInfo = this->drawBuffers[frameIndex]->descriptorInfo();
+		auto statsInfo = this->statsBuffers[frameIndex]->descriptorInfo();
+		DescriptorWriter writer{ *this->frameSetLayout, *this->descriptorPool };
+		writer.writeBuffer(0, &drawInfo).writeBuffer(1, &statsInfo);
+		if (this->frameDescriptorSets[frameIndex] == VK_NULL_HANDLE)
+			writer.build(this->frameDescriptorSets[frameIndex]);
+		else
+			writer.overwrite(this->frameDescriptorSets[frameIndex]);
+	}
+	auto MeshletRenderSystem::createPipelineLayouts(VkDescriptorSetLayout globalSetLayout) -> void {
+		VkPushConstantRange cullPushRange{};
+		cullPushRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		cullPushRange.offset = 0;
+		cullPushRange.size = sizeof(MeshletCullPushConstants);
+
+		std::vector<VkDescriptorSetLayout> cullSetLayouts{
+			globalSetLayout,
+			this->frameSetLayout->getDescriptorSetLayout(),
+			this->meshletSetLayout->getDescriptorSetLayout()
+		};
+
+		VkPipelineLayoutCreateInfo cullLayoutInfo{};
+		cullLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		cullLayoutInfo.setLayoutCount = static_cast<uint32_t>(cullSetLayouts.size());
+		cullLayoutInfo.pSetLayouts = cullSetLayouts.data();
+		cullLayoutInfo.pushConstantRangeCount = 1;
+		cullLayoutInfo.pPushConstantRanges = &cullPushRange;
+		if (vkCreatePipelineLayout(this->device.device(), &cullLayoutInfo, nullptr, &this->cullPipelineLayout) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create meshlet cull pipeline layout");
+		}
+
+		// drawing uses the simple shaders, so the same layout as SimpleRenderSystem
+		VkPushConstantRange pushConstantRange{};
+		pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+		pushConstantRange.offset = 0;
+		pushConstantRange.size = sizeof(SimplePushConstantData);
+
+		VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+		pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		pipelineLayoutInfo.setLayoutCount = 1;
+		pipelineLayoutInfo.pSetLayouts = &globalSetLayout;
+		pipelineLayoutInfo.pushConstantRangeCount = 1;
+		pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+		if (vkCreatePipelineLayout(this->device.device(), &pipelineLayoutInfo, nullptr, &this->pipelineLayout) != VK_SUCCESS) {
+			vkDestroyPipelineLayout(this->device.device(), this->cullPipelineLayout, nullptr);
+			throw std::runtime_error("Failed to create pipeline layout");
+		}
+	}
+	auto MeshletRenderSystem::createPipelines() -> void {
+		PipelineConfigInfo pipelineConfig{};
+		Pipeline::defaultPipelineConfigInfo(pipelineConfig);
+		pipelineConfig.renderPass = this->renderPass;
+		pipelineConfig.pipelineLayout = this->pipelineLayout;
+		this->pipeline = std::make_unique<Pipeline>(
+			this->device,
+			"shaders/simpleShader.vert.spv",
+			"shaders/simpleShader.frag.spv",
+			pipelineConfig
+		);
+	}
+	auto MeshletRenderSystem::getPipeline(VertexFormat vertexFormat) -> Pipeline& {
+		if (vertexFormat == VertexFormat::Full)
+			return *this->pipeline;
+
+		if (this->packedPipeline == nullptr) {
+			PipelineConfigInfo pipelineConfig{};
+			Pipeline::defaultPipelineConfigInfo(pipelineConfig);
+			pipelineConfig.bindingDescriptions = Model::PackedVertex::getBindingDescriptions();
+			pipelineConfig.attributeDescriptions = Model::PackedVertex::getAttributeDescriptions();
+			pipelineConfig.renderPass = this->renderPass;
+			pipelineConfig.pipelineLayout = this->pipelineLayout;
+			this->packedPipeline = std::make_unique<Pipeline>(
+				this->device,
+				"shaders/simpleShaderPacked.vert.spv",
+				"shaders/simpleShader.frag.spv",
+				pipelineConfig
+			);
+		}
+		return *this->packedPipeline;
+	}
+	auto MeshletRenderSystem::getCullPipeline() -> ComputePipeline& {
+		if (this->cullPipeline == nullptr) {	// lazy so scenes without meshlet models don't need the compute shader
+			this->cullPipeline = std::make_unique<ComputePipeline>(
+				this->device,
+				"shaders/meshletCull.comp.spv",
+				this->cullPipelineLayout
+			);
+		}
+		return *this->cullPipeline;
+	}
+	auto MeshletRenderSystem::getMeshletDescriptorSet(const std::shared_ptr<Model>& model) -> VkDescriptorSet {
+		auto found = this->meshletDescriptorSets.find(model->getId());
+		if (found != this->meshletDescriptorSets.end())
+			return found->second.descriptorSet;
+
+		VkDescriptorSet descriptorSet;
+		auto meshletInfo = model->getMeshletBuffer().descriptorInfo();
+		if (!DescriptorWriter(*this->meshletSetLayout, *this->descriptorPool).writeBuffer(0, &meshletInfo).build(descriptorSet)) {
+			throw std::runtime_error("Ran out of meshlet descriptor sets, raise MESHLET_MAX_MODELS");
+		}
+		this->meshletDescriptorSets.emplace(model->getId(), MeshletSet{ descriptorSet, model });
+		return descriptorSet;
+	}
+	/*
+		Sets of models destroyed since the last call are retired, and sets retired framesInFlight calls ago go back to the pool.
+		cull() runs once a frame after the frame slot's FrameTimeline wait, so by then no frame in flight can still have them bound (same rule as DeletionQueue)
+	*/
+	auto MeshletRenderSystem::retireDestroyedModels() -> void {
+		this->cullFrame++;
+		std::vector<VkDescriptorSet> freed;
+		std::erase_if(this->retiredSets, [&](const RetiredSet& retired) {
+			if (retired.frame + this->framesInFlight > this->cullFrame) return false;
+			freed.push_back(retired.descriptorSet);
+			return true;
+		});
+		if (!freed.empty())
+			this->descriptorPool->freeDescriptors(freed);
+
+		for (auto it = this->meshletDescriptorSets.begin(); it != this->meshletDescriptorSets.end();) {
+			if (it->second.model.expired()) {
+				this->retiredSets.push_back({ it->second.descriptorSet, this->cullFrame });
+				it = this->meshletDescriptorSets.erase(it);
+			}
+			else {
+				++it;
+			}
+		}
+	}
+
+	auto MeshletRenderSystem::cull(FrameInfo& frameInfo) -> void {
+		// this frame slot's last submission has been waited on, so its last counters are final. read then clear them for this frame
+		auto* frameStats = static_cast<MeshletCullStats*>(this->statsBuffers[frameInfo.frameIndex]->getMappedMemory());
+		this->stats = *frameStats;
+		*frameStats = {};
+
+		this->draws.clear();	// drops last frame's references first, so models unloaded since then show up as expired
+		this->retireDestroyedModels();
+		uint32_t commandCount = 0;
+		for (auto& [id, obj] : frameInfo.gameObjects) {
+			if (obj.model == nullptr || !obj.model->hasMeshlets()) continue;
+
+			MeshletDraw draw{};
+			draw.model = obj.model;
+			draw.commandOffset = commandCount;
+			draw.modelMatrix = obj.transform.mat4();
+			draw.push.modelMatrix = draw.modelMatrix * obj.model->getDequantizeMatrix();
+			draw.push.normalMatrix = obj.transform.normalMatrix();
+			this->draws.push_back(draw);
+			commandCount += obj.model->getMeshletCount();
+		}
+		if (this->draws.empty()) return;
+
+		uint32_t capacity = this->drawBuffers[frameInfo.frameIndex]->getInstanceCount();
+		if (commandCount > capacity) {	// beginFrame waited for this slot, nothing reads its buffer or set anymore
+			while (capacity < commandCount) capacity *= 2;
+			std::cout << "Meshlet draws: " << commandCount << " need more than the frame's indirect buffer holds, growing it to " << capacity << "\n";
+			this->createDrawBuffer(frameInfo.frameIndex, capacity);
+		}
+
+		this->getCullPipeline().bind(frameInfo.commandBuffer);
+		VkDescriptorSet frameSets[] = { frameInfo.globalDescriptorSet, this->frameDescriptorSets[frameInfo.frameIndex] };
+		vkCmdBindDescriptorSets(frameInfo.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, this->cullPipelineLayout, 0, 2, frameSets, 1, &frameInfo.globalUniformOffset);
+
+		for (const auto& draw : this->draws) {
+			VkDescriptorSet meshletSet = this->getMeshletDescriptorSet(draw.model);
+			vkCmdBindDescriptorSets(frameInfo.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, this->cullPipelineLayout, 2, 1, &meshletSet, 0, nullptr);
+
+			const glm::mat4& modelMatrix = draw.modelMatrix;
+			MeshletCullPushConstants push{};
+			push.modelMatrix = modelMatrix;
+			push.cameraObjectSpace = glm::inverse(modelMatrix) * glm::vec4{ frameInfo.camera.getPosition(), 1.0f };
+			push.meshletCount = draw.model->getMeshletCount();
+			push.commandOffset = draw.commandOffset;
+			push.coneCulling = this->backfaceCulling && draw.model->isClosed() ? 1 : 0;	// an open mesh shows the back of its clusters
+			push.radiusScale = glm::max(
+				glm::length(glm::vec3{ modelMatrix[0] }),
+				glm::max(glm::length(glm::vec3{ modelMatrix[1] }), glm::length(glm::vec3{ modelMatrix[2] }))
+			);
+			vkCmdPushConstants(frameInfo.commandBuffer, this->cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(MeshletCullPushConstants), &push);
+			vkCmdDispatch(frameInfo.commandBuffer, (push.meshletCount + MESHLET_CULL_GROUP_SIZE - 1) / MESHLET_CULL_GROUP_SIZE, 1, 1);
+		}
+
+		// draw commands are read by the indirect stage, stats by the cpu once the frame's FrameTimeline value signals
+		VkMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_HOST_READ_BIT;
+		vkCmdPipelineBarrier(
+			frameInfo.commandBuffer,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_HOST_BIT,
+			0,
+			1, &barrier,
+			0, nullptr,
+			0, nullptr
+		);
+	}
+	auto MeshletRenderSystem::render(FrameInfo& frameInfo) -> void {
+		if (this->draws.empty()) return;
+
+		Pipeline* boundPipeline = this->pipeline.get();
+		boundPipeline->bind(frameInfo.commandBuffer);
+		vkCmdBindDescriptorSets(frameInfo.commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, this->pipelineLayout, 0, 1, &frameInfo.globalDescriptorSet, 1, &frameInfo.globalUniformOffset);
+
+		// without multiDrawIndirect each vkCmdDrawIndexedIndirect may only carry one draw
+		const uint32_t maxDrawCount = this->device.enabledFeatures.multiDrawIndirect ? this->device.properties.limits.maxDrawIndirectCount : 1;
+		const VkBuffer drawBuffer = this->drawBuffers[frameInfo.frameIndex]->getBuffer();
+		for (const auto& draw : this->draws) {
+			Pipeline& modelPipeline = this->getPipeline(draw.model->getVertexFormat());
+			if (&modelPipeline != boundPipeline) {
+				boundPipeline = &modelPipeline;
+				boundPipeline->bind(frameInfo.commandBuffer);
+			}
+
+			vkCmdPushConstants(
+				frameInfo.commandBuffer,
+				this->pipelineLayout,
+				VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+				0,
+				sizeof(SimplePushConstantData),
+				&draw.push
+			);
+			draw.model->bind(frameInfo.commandBuffer);
+			for (uint32_t first = 0; first < draw.model->getMeshletCount(); first += maxDrawCount) {
+				vkCmdDrawIndexedIndirect(
+					frameInfo.commandBuffer,
+					drawBuffer,
+					(draw.commandOffset + first) * sizeof(VkDrawIndexedIndirectCommand),
+					std::min(maxDrawCount, draw.model->getMeshletCount() - first),
+					sizeof(VkDrawIndexedIndirectCommand)
+				);
+			}
+		}
+	}
+}
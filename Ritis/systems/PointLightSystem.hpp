@@ -142,8 +142,8 @@ namespace engine {
 			this->pipelineLayout,
 			0, 1,					// which descriptor set to bind and how many to bind (bind 0th, and bind only 1). all bound after 0th are undone, so want earliest ones to be the ones that need to rebind least commonly
 			&frameInfo.globalDescriptorSet,
-			0,
-			nullptr
+			1,
+			&frameInfo.globalUniformOffset
 		);
 
 		// iterate through sorted lights in reverse order (back to front)
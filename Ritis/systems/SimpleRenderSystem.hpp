@@ -4,6 +4,8 @@
 #include "../Pipeline.hpp"
 #include "../GameObject.hpp"
 #include "../FrameInfo.hpp"
+#include "../SecondaryCommandPools.hpp"
+#include "../ThreadPool.hpp"
 
 #define GLM_FORCE_RADIANS					// functions expect radians, not degrees
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE			// Depth buffer values will range from 0 to 1, not -1 to 1
@@ -15,6 +17,9 @@
 #include <vector>
 #include <stdexcept>
 #include <array>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
 
 #include "../Camera.hpp"
 
@@ -28,14 +33,30 @@ namespace engine {
 		glm::mat4 normalMatrix{1.0f}; // still mat4 for alignment
 	};
 
+	constexpr float LOD_SCREEN_ERROR = 1.0f / 1080.0f;	// largest simplification error allowed on screen, as a fraction of its height (about a pixel at 1080p)
+	constexpr size_t MIN_OBJECTS_PER_RECORDING = 256;		// fewer objects per thread cost more in secondary setup and hand off than they save
+
+	struct SimpleRenderStats {	// from the last renderGameObjects call
+		uint32_t objectsDrawn = 0;
+		uint64_t trianglesDrawn = 0;
+		uint64_t fullDetailTriangles = 0;	// what the same objects would cost without lods
+	};
+
 	class SimpleRenderSystem {
 		Device& device;
+		SimpleRenderStats stats{};
 
 		std::unique_ptr<Pipeline> pipeline;
+		std::unique_ptr<Pipeline> packedPipeline;	// for VertexFormat::Packed models, created the first time one is drawn
 		VkPipelineLayout pipelineLayout;
+		VkRenderPass renderPass;
 
 		auto createPipelineLayout(VkDescriptorSetLayout) -> void;
 		auto createPipeline(VkRenderPass) -> void;
+		auto getPipeline(VertexFormat) -> Pipeline&;
+		auto selectLod(const Model&, const glm::mat4& modelMatrix, const Camera&) const -> uint32_t;
+		auto bindGlobals(VkCommandBuffer, FrameInfo&) -> void;
+		auto drawObject(VkCommandBuffer, GameObject&, const Camera&, Pipeline*& boundPipeline, SimpleRenderStats&) -> void;
 	public:
 		SimpleRenderSystem(Device&, VkRenderPass, VkDescriptorSetLayout);
 		~SimpleRenderSystem();
@@ -44,10 +65,14 @@ namespace engine {
 		SimpleRenderSystem& operator=(const SimpleRenderSystem&) = delete;
 
 		auto renderGameObjects(FrameInfo&) -> void;
+		// records the objects split across threads into secondaries, returned in draw order for vkCmdExecuteCommands. chunkCount 0 picks one per thread
+		auto renderGameObjectsParallel(FrameInfo&, const SecondaryRecording&, ThreadPool&, uint32_t chunkCount = 0) -> std::vector<VkCommandBuffer>;
+		auto benchmarkRecording(FrameInfo&, ThreadPool&, VkExtent2D) -> void;
+		auto getStats() const -> const SimpleRenderStats& { return this->stats; }
 		auto run() -> void;
 	};
 
-	SimpleRenderSystem::SimpleRenderSystem(Device& d, VkRenderPass renderPass, VkDescriptorSetLayout globalSetLayout) : device{ d } {
+	SimpleRenderSystem::SimpleRenderSystem(Device& d, VkRenderPass renderPass, VkDescriptorSetLayout globalSetLayout) : device{ d }, renderPass{ renderPass } {
 		this->createPipelineLayout(globalSetLayout);
 		this->createPipeline(renderPass);
 	}
@@ -97,38 +122,201 @@ namespace engine {
 			pipelineConfig
 		);
 	}
-	auto SimpleRenderSystem::renderGameObjects(
-		FrameInfo& frameInfo
-	) -> void {
-		this->pipeline->bind(frameInfo.commandBuffer);
+	auto SimpleRenderSystem::getPipeline(VertexFormat vertexFormat) -> Pipeline& {
+		if (vertexFormat == VertexFormat::Full)
+			return *this->pipeline;
 
+		if (this->packedPipeline == nullptr) {	// lazy so scenes without packed models don't need the shader variant
+			PipelineConfigInfo pipelineConfig{};
+			Pipeline::defaultPipelineConfigInfo(pipelineConfig);
+			pipelineConfig.bindingDescriptions = Model::PackedVertex::getBindingDescriptions();
+			pipelineConfig.attributeDescriptions = Model::PackedVertex::getAttributeDescriptions();
+			pipelineConfig.renderPass = this->renderPass;
+			pipelineConfig.pipelineLayout = this->pipelineLayout;
+			this->packedPipeline = std::make_unique<Pipeline>(
+				device,
+				"shaders/simpleShaderPacked.vert.spv",
+				"shaders/simpleShader.frag.spv",
+				pipelineConfig
+			);
+		}
+		return *this->packedPipeline;
+	}
+	/*
+		Coarsest lod whose error still projects under LOD_SCREEN_ERROR, measured at the nearest point of the world space bounding sphere.
+		projection[1][1] is 1 / tan(fovy / 2), so size * projection[1][1] / distance is the size in ndc, where the screen is 2 tall
+	*/
+	auto SimpleRenderSystem::selectLod(const Model& model, const glm::mat4& modelMatrix, const Camera& camera) const -> uint32_t {
+		if (model.getLodCount() <= 1) return 0;
+
+		glm::vec3 center{ modelMatrix * glm::vec4{ model.getBoundingSphereCenter(), 1.0f } };
+		float scale = glm::max(	// largest axis scale, keeps the sphere and errors conservative under non-uniform scale
+			glm::length(glm::vec3{ modelMatrix[0] }),
+			glm::max(glm::length(glm::vec3{ modelMatrix[1] }), glm::length(glm::vec3{ modelMatrix[2] }))
+		);
+		float distance = glm::length(center - camera.getPosition()) - model.getBoundingSphereRadius() * scale;
+		if (distance <= 0.0f) return 0;	// camera inside the bounds
+
+		float screenScale = scale * camera.getProjection()[1][1] * 0.5f / distance;
+		for (uint32_t lod = model.getLodCount() - 1; lod > 0; lod--) {
+			if (model.getLodError(lod) * screenScale <= LOD_SCREEN_ERROR)
+				return lod;
+		}
+		return 0;
+	}
+	auto SimpleRenderSystem::bindGlobals(VkCommandBuffer commandBuffer, FrameInfo& frameInfo) -> void {
 		vkCmdBindDescriptorSets(
-			frameInfo.commandBuffer,
+			commandBuffer,
 			VK_PIPELINE_BIND_POINT_GRAPHICS,
 			this->pipelineLayout,
 			0, 1,					// which descriptor set to bind and how many to bind (bind 0th, and bind only 1). all bound after 0th are undone, so want earliest ones to be the ones that need to rebind least commonly
 			&frameInfo.globalDescriptorSet,
+			1,
+			&frameInfo.globalUniformOffset
+		);
+	}
+	auto SimpleRenderSystem::drawObject(VkCommandBuffer commandBuffer, GameObject& obj, const Camera& camera, Pipeline*& boundPipeline, SimpleRenderStats& stats) -> void {
+		Pipeline& modelPipeline = this->getPipeline(obj.model->getVertexFormat());
+		if (&modelPipeline != boundPipeline) {	// both pipelines share the layout, so the descriptor set stays bound
+			boundPipeline = &modelPipeline;
+			boundPipeline->bind(commandBuffer);
+		}
+
+		glm::mat4 modelMatrix = obj.transform.mat4();
+		uint32_t lod = this->selectLod(*obj.model, modelMatrix, camera);
+
+		SimplePushConstantData push{};
+		push.modelMatrix = modelMatrix * obj.model->getDequantizeMatrix();	// packed positions are 0-1 in the mesh bounds
+		push.normalMatrix = obj.transform.normalMatrix(); // auto convert mat3 -> padded mat4
+
+		vkCmdPushConstants(
+			commandBuffer,
+			pipelineLayout,
+			VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
 			0,
-			nullptr
+			sizeof(SimplePushConstantData),
+			&push
 		);
+		obj.model->bind(commandBuffer);
+		obj.model->draw(commandBuffer, lod);
 
+		stats.objectsDrawn++;
+		stats.trianglesDrawn += obj.model->getTriangleCount(lod);
+		stats.fullDetailTriangles += obj.model->getTriangleCount();
+	}
+	auto SimpleRenderSystem::renderGameObjects(
+		FrameInfo& frameInfo
+	) -> void {
+		Pipeline* boundPipeline = this->pipeline.get();
+		boundPipeline->bind(frameInfo.commandBuffer);
+		this->bindGlobals(frameInfo.commandBuffer, frameInfo);
+
+		this->stats = {};
 		for (auto& [id, obj] : frameInfo.gameObjects) {
-			if (obj.model == nullptr) continue;
-			SimplePushConstantData push{};
-			push.modelMatrix = obj.transform.mat4();
-			push.normalMatrix = obj.transform.normalMatrix(); // auto convert mat3 -> padded mat4
-
-			vkCmdPushConstants(
-				frameInfo.commandBuffer,
-				pipelineLayout,
-				VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
-				0,
-				sizeof(SimplePushConstantData),
-				&push
-			);
-			obj.model->bind(frameInfo.commandBuffer);
-			obj.model->draw(frameInfo.commandBuffer);
+			if (obj.model == nullptr || obj.model->hasMeshlets()) continue;	// meshlet models are culled and drawn by MeshletRenderSystem
+			this->drawObject(frameInfo.commandBuffer, obj, frameInfo.camera, boundPipeline, this->stats);
 		}
 	}
-}
+	/*
+		Same draws as renderGameObjects, in the same order, but the objects are cut into contiguous chunks and every chunk is recorded
+		into its own secondary on a pool thread, chunk i through slot i of the recording's pools.
+		the map is only read, and the packed pipeline is created up front so getPipeline doesn't create it from two threads.
+		the render pass has to be begun with VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS
+	*/
+	auto SimpleRenderSystem::renderGameObjectsParallel(FrameInfo& frameInfo, const SecondaryRecording& recording, ThreadPool& pool, uint32_t chunkCount) -> std::vector<VkCommandBuffer> {
+		std::vector<GameObject*> objects;
+		objects.reserve(frameInfo.gameObjects.size());
+		bool anyPacked = false;
+		for (auto& [id, obj] : frameInfo.gameObjects) {
+			if (obj.model == nullptr || obj.model->hasMeshlets()) continue;	// meshlet models are culled and drawn by MeshletRenderSystem
+			objects.push_back(&obj);
+			anyPacked |= obj.model->getVertexFormat() == VertexFormat::Packed;
+		}
+		if (anyPacked)
+			this->getPipeline(VertexFormat::Packed);
+
+		if (chunkCount == 0) {
+			size_t threads = pool.getThreadCount() + 1;	// parallelFor runs on the caller too
+			chunkCount = static_cast<uint32_t>(std::min(threads, objects.size() / MIN_OBJECTS_PER_RECORDING));
+		}
+		chunkCount = std::clamp<uint32_t>(chunkCount, 1, recording.pools->getSlotCount());
 
+		std::vector<VkCommandBuffer> secondaries(chunkCount);
+		std::vector<SimpleRenderStats> chunkStats(chunkCount);
+		pool.parallelFor(chunkCount, [&](size_t chunk) {
+			size_t first = objects.size() * chunk / chunkCount;
+			size_t last = objects.size() * (chunk + 1) / chunkCount;
+
+			VkCommandBuffer commandBuffer = recording.begin(static_cast<uint32_t>(chunk));
+			Pipeline* boundPipeline = this->pipeline.get();
+			boundPipeline->bind(commandBuffer);
+			this->bindGlobals(commandBuffer, frameInfo);	// secondaries start with nothing bound
+			for (size_t i = first; i < last; i++)
+				this->drawObject(commandBuffer, *objects[i], frameInfo.camera, boundPipeline, chunkStats[chunk]);
+			if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+				throw std::runtime_error("failed to record secondary command buffer!");
+			secondaries[chunk] = commandBuffer;
+		});
+
+		this->stats = {};
+		for (const SimpleRenderStats& chunk : chunkStats) {
+			this->stats.objectsDrawn += chunk.objectsDrawn;
+			this->stats.trianglesDrawn += chunk.trianglesDrawn;
+			this->stats.fullDetailTriangles += chunk.fullDetailTriangles;
+		}
+		return secondaries;
+	}
+	/*
+		Cpu time of recording 10k to 100k objects with 1 thread up to every thread of the pool (plus the caller).
+		records into its own pools without a framebuffer and never submits, frameInfo only lends the camera and descriptor set
+	*/
+	auto SimpleRenderSystem::benchmarkRecording(FrameInfo& frameInfo, ThreadPool& pool, VkExtent2D extent) -> void {
+		constexpr uint32_t iterations = 20;
+		std::shared_ptr<Model> model = Model::createModelFromFile(this->device, "models/smooth_vase.obj");
+		SecondaryCommandPools pools{ this->device, 1 };
+
+		SecondaryRecording recording{};
+		recording.pools = &pools;
+		recording.frameIndex = 0;
+		recording.inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+		recording.inheritance.renderPass = this->renderPass;
+		recording.inheritance.subpass = 0;
+		recording.extent = extent;
+
+		std::cout << "command recording benchmark, ms per frame\n";
+		for (uint32_t objectCount : { 10000u, 25000u, 50000u, 100000u }) {
+			GameObject::Map objects;
+			for (uint32_t i = 0; i < objectCount; i++) {
+				auto vase = GameObject::createGameObject();
+				vase.model = model;
+				vase.transform.translation = { (i % 100) * 0.5f - 25.0f, 0.5f, (i / 100) * 0.5f };
+				objects.emplace(vase.getId(), std::move(vase));
+			}
+			FrameInfo benchmarkInfo{
+				frameInfo.frameIndex,
+				frameInfo.frameTime,
+				VK_NULL_HANDLE,
+				frameInfo.camera,
+				frameInfo.globalDescriptorSet,
+				objects,
+				frameInfo.uniforms,
+				frameInfo.globalUniformOffset
+			};
+
+			std::cout << "  " << objectCount << " objects:";
+			uint32_t maxThreads = std::min<uint32_t>(static_cast<uint32_t>(pool.getThreadCount()) + 1, pools.getSlotCount());
+			for (uint32_t threads = 1; ; threads = std::min(threads * 2, maxThreads)) {
+				float total = 0.0f;
+				for (uint32_t i = 0; i < iterations; i++) {
+					pools.reset(0);
+					auto start = std::chrono::high_resolution_clock::now();
+					this->renderGameObjectsParallel(benchmarkInfo, recording, pool, threads);
+					total += std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - start).count();
+				}
+				std::cout << " " << threads << (threads == 1 ? " thread " : " threads ") << total / iterations << "ms";
+				if (threads == maxThreads) break;
+			}
+			std::cout << "\n";
+		}
+	}
+}